@@ -0,0 +1,25 @@
+#include "stdafx.h"
+#include "Clock.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+double NowMillis()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency = { 0 };
+	if (!frequency.QuadPart) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart * 1000.0 / frequency.QuadPart;
+#else
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+#endif
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// A monotonic clock in milliseconds, shared by the Maestro writer's
+// stats, the loop scheduler's deadlines and telemetry so their times
+// compare
+double NowMillis();
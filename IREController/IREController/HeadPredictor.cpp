@@ -0,0 +1,141 @@
+#include "stdafx.h"
+#include "HeadPredictor.h"
+#include <math.h>
+
+// Weight of a new latency measurement, every half second
+#define LATENCY_SMOOTHING 0.2
+
+static float Length(const PredictorVector & v)
+{
+	return sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
+}
+
+static PredictorQuat Multiply(const PredictorQuat & a, const PredictorQuat & b)
+{
+	PredictorQuat result;
+	result.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
+	result.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
+	result.y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x;
+	result.z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w;
+	return result;
+}
+
+// The rotation about rotation / |rotation| by |rotation| radians
+static PredictorQuat FromRotationVector(const PredictorVector & rotation)
+{
+	PredictorQuat result = { 0, 0, 0, 1 };
+	float angle = Length(rotation);
+	if (angle < 1e-6f) {
+		return result;
+	}
+	float scale = sinf(angle / 2) / angle;
+	result.x = rotation.x * scale;
+	result.y = rotation.y * scale;
+	result.z = rotation.z * scale;
+	result.w = cosf(angle / 2);
+	return result;
+}
+
+HeadPredictor::Settings HeadPredictor::Defaults()
+{
+	Settings settings;
+	settings.horizon = -1;
+	// hobby servos take some 50 ms to follow a step of the gimbal, the
+	// camera another frame
+	settings.actuatorLatency = 0.07;
+	settings.useAcceleration = true;
+	settings.stillSpeed = 0.1f;
+	settings.fullSpeed = 0.6f;
+	settings.accelerationLimit = 0.5f;
+	return settings;
+}
+
+HeadPredictor::HeadPredictor(const Settings & settings)
+	: settings(settings), measuredLatency(-1)
+{
+}
+
+void HeadPredictor::SetMeasuredLatency(double seconds)
+{
+	if (measuredLatency < 0) {
+		measuredLatency = seconds;
+	} else {
+		measuredLatency += (seconds - measuredLatency) * LATENCY_SMOOTHING;
+	}
+}
+
+double HeadPredictor::GetHorizon() const
+{
+	if (settings.horizon >= 0) {
+		return settings.horizon;
+	}
+	return settings.actuatorLatency + (measuredLatency > 0 ? measuredLatency : 0);
+}
+
+PredictorQuat HeadPredictor::Predict(const PredictorQuat & orientation, const PredictorVector & angularVelocity,
+	const PredictorVector & angularAcceleration, double sampleAge) const
+{
+	return Extrapolate(settings, orientation, angularVelocity, angularAcceleration, sampleAge + GetHorizon());
+}
+
+PredictorQuat HeadPredictor::Extrapolate(const Settings & settings, const PredictorQuat & orientation,
+	const PredictorVector & angularVelocity, const PredictorVector & angularAcceleration, double seconds)
+{
+	float speed = Length(angularVelocity);
+	float blend = 1;
+	if (settings.fullSpeed > settings.stillSpeed) {
+		float t = (speed - settings.stillSpeed) / (settings.fullSpeed - settings.stillSpeed);
+		t = t < 0 ? 0 : (t > 1 ? 1 : t);
+		// smoothstep, so the horizon doesn't jump at either end
+		blend = t * t * (3 - 2 * t);
+	}
+	float dt = (float)seconds * blend;
+	if (dt <= 0) {
+		return orientation;
+	}
+
+	PredictorVector rotation = { angularVelocity.x * dt, angularVelocity.y * dt, angularVelocity.z * dt };
+	if (settings.useAcceleration) {
+		float half = dt * dt / 2;
+		PredictorVector change = { angularAcceleration.x * half, angularAcceleration.y * half, angularAcceleration.z * half };
+		float limit = settings.accelerationLimit * Length(rotation);
+		float length = Length(change);
+		if (length > limit) {
+			float scale = limit / length;
+			change.x *= scale;
+			change.y *= scale;
+			change.z *= scale;
+		}
+		rotation.x += change.x;
+		rotation.y += change.y;
+		rotation.z += change.z;
+	}
+	// rates in the sensor's frame turn the orientation from the right
+	return Multiply(orientation, FromRotationVector(rotation));
+}
+
+float HeadPredictor::Difference(const PredictorQuat & a, const PredictorQuat & b)
+{
+	float dot = fabsf(a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w);
+	return 2 * acosf(dot < 1 ? dot : 1);
+}
+
+PredictorQuat HeadPredictor::Slerp(const PredictorQuat & a, const PredictorQuat & b, float fraction)
+{
+	float dot = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+	float sign = dot < 0 ? -1.0f : 1.0f;
+	dot *= sign;
+	float wa = 1 - fraction, wb = fraction * sign;
+	if (dot < 0.9995f) {
+		float angle = acosf(dot);
+		wa = sinf((1 - fraction) * angle) / sinf(angle);
+		wb = sinf(fraction * angle) / sinf(angle) * sign;
+	}
+	PredictorQuat result = { wa * a.x + wb * b.x, wa * a.y + wb * b.y, wa * a.z + wb * b.z, wa * a.w + wb * b.w };
+	float norm = sqrtf(result.x * result.x + result.y * result.y + result.z * result.z + result.w * result.w);
+	result.x /= norm;
+	result.y /= norm;
+	result.z /= norm;
+	result.w /= norm;
+	return result;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+// The layout of ovrQuatf and ovrVector3f, so the states of the SDK copy
+// over field by field, without the SDK for replaying recorded traces
+struct PredictorQuat {
+	float x, y, z, w;
+};
+
+struct PredictorVector {
+	float x, y, z;
+};
+
+// Predicts where the head will be when the servos and the camera have
+// caught up with a target sent now, so the gimbal doesn't trail the head
+// by the latency of the serial line, the servos and the camera.
+//
+// The orientation of a sensor sample is rotated on by its angular
+// velocity, and optionally its angular acceleration, both in the frame
+// of the sensor like the SDK's own prediction does it.  Prediction also
+// amplifies the sensor noise, which a still head would see as jitter of
+// the camera, so the horizon is blended in with the angular speed: none
+// below stillSpeed, all of it from fullSpeed on.  The noisy acceleration
+// may only add so much to what the velocity predicts.
+//
+// The horizon is either fixed or follows the serial latency the writer
+// measures, plus what the servos and the camera take, which nothing here
+// can measure.
+class HeadPredictor
+{
+public:
+	struct Settings {
+		// seconds ahead of now, or negative to follow
+		// SetMeasuredLatency() plus actuatorLatency
+		double horizon;
+		// servo response and camera, seconds
+		double actuatorLatency;
+		bool useAcceleration;
+		// angular speeds in radians per second
+		float stillSpeed;
+		float fullSpeed;
+		// acceleration changes the predicted rotation by at most this
+		// fraction of the rotation from the velocity
+		float accelerationLimit;
+	};
+
+	static Settings Defaults();
+
+	HeadPredictor(const Settings & settings);
+
+	// The serial latency as measured, smoothed over the calls
+	void SetMeasuredLatency(double seconds);
+	// Seconds ahead of now that Predict() looks
+	double GetHorizon() const;
+
+	// Extrapolates the latest sample forward by its age plus the
+	// prediction horizon, i.e. to where the head will be a horizon from now
+	PredictorQuat Predict(const PredictorQuat & orientation, const PredictorVector & angularVelocity,
+		const PredictorVector & angularAcceleration, double sampleAge) const;
+
+	// The orientation the given seconds after the sample, with the
+	// blending and limits of the settings, for replaying traces
+	static PredictorQuat Extrapolate(const Settings & settings, const PredictorQuat & orientation,
+		const PredictorVector & angularVelocity, const PredictorVector & angularAcceleration, double seconds);
+
+	// Angle between two orientations in radians
+	static float Difference(const PredictorQuat & a, const PredictorQuat & b);
+	// Between a at 0 and b at 1, the short way round
+	static PredictorQuat Slerp(const PredictorQuat & a, const PredictorQuat & b, float fraction);
+
+private:
+	Settings settings;
+	// smoothed serial latency, negative before the first measurement
+	double measuredLatency;
+};
@@ -5,6 +5,9 @@
 #include "Kernel\OVR_Math.h"
 #include "MaestroController.h"
 #include "Gamepad.h"
+#include "LoopScheduler.h"
+#include "Telemetry.h"
+#include "HeadPredictor.h"
 
 #pragma comment (lib, "user32.lib")
 
@@ -37,10 +40,20 @@ using namespace std;
 #define ROLL_SERVO_MID (ROLL_SERVO_MIN + ROLL_SERVO_MAX) / 2
 #define SERVO_ANGLE_MAX 78.5f
 #define SERVO_ANGLE_MIN -78.5f
+// Servo targets per second.  The timer sleeps to within a fraction of a
+// millisecond, the rest is spun through.
+#define LOOP_HERTZ 250
+#define LOOP_SPIN_MILLIS 0.3
+// Everything the loop computes goes to the log, the console only gets
+// the newest values every so often
+#define TELEMETRY_LOG "IREController.telemetry"
+#define TELEMETRY_CONSOLE_MILLIS 500
 
 Gamepad	_gamepad;
 MaestroController _maestroController;
 ovrHmd hmd;
+// aims the gimbal where the head will be once the servos got there
+HeadPredictor headPredictor(HeadPredictor::Defaults());
 bool terminateApp = false;
 bool pauseApp = false;
 bool tankControlMode = false;
@@ -76,18 +89,32 @@ int _tmain(int argc, _TCHAR* argv[])
 		printf("Unable to connect to Maestro.");
 		return -1;
 	}
+	// a busy port must not hold up sampling the head tracker
+	_maestroController.StartWriter();
 
 	ovr_Initialize();
 	hmd = ovrHmd_Create(0);
 	if (!hmd || !ovrHmd_StartSensor(hmd, ovrSensorCap_Orientation | ovrSensorCap_YawCorrection, ovrSensorCap_Orientation)) {
 		printf("Unable to detect Rift head tracker\n");
+		_maestroController.Disconnect();
+		ovr_Shutdown();
 		return -1;
 	}
 
+	// only now, every path from here on ends with Telemetry::Stop()
+	if (!Telemetry::Start(TELEMETRY_LOG, TELEMETRY_CONSOLE_MILLIS)) {
+		Telemetry::Start(NULL, TELEMETRY_CONSOLE_MILLIS);
+	}
+
 	float         hertz = 0;
+	MaestroController::WriterStats writerStats = _maestroController.GetWriterStats();
 	int cycleCount = 0;
 	long start = ElapsedMillis();
 
+	LoopScheduler loop(LOOP_HERTZ);
+	loop.SetSpinMillis(LOOP_SPIN_MILLIS);
+	loop.SetRealtimePriority();
+
 	unsigned short leftMotor = 0; unsigned short rightMotor = 0;
 	unsigned short yawServo = 0; unsigned short pitchServo = 0; unsigned short rollServo = 0;
 	while (!terminateApp)
@@ -97,7 +124,6 @@ int _tmain(int argc, _TCHAR* argv[])
 				GetMotorTargets(leftMotor, rightMotor);
 			}
 			else {
-				printf("Pausing MOTOR\n");
 				leftMotor = LEFT_MOTOR_MID;
 				rightMotor = RIGHT_MOTOR_MID;
 			}
@@ -105,9 +131,6 @@ int _tmain(int argc, _TCHAR* argv[])
 			if (!pauseServo) {
 				GetServoTargets(yawServo, pitchServo, rollServo);
 			}
-			else {
-				printf("Pausing SERVO\n");
-			}
 
 			SendCommands(leftMotor, rightMotor, yawServo, pitchServo, rollServo);
 
@@ -119,15 +142,25 @@ int _tmain(int argc, _TCHAR* argv[])
 				hertz = (float)cycleCount / elapsed;
 				start = now;
 				cycleCount = 0;
+				writerStats = _maestroController.GetWriterStats(true);
+				const LoopScheduler::Stats & loopStats = loop.GetStats();
+				Telemetry::Log(mainCycleCounter, TELEMETRY_LOOP, { hertz, (float)loopStats.overruns,
+					(float)loopStats.jitter.GetMean(), (float)loopStats.jitter.GetPercentile(0.99), (float)loopStats.jitter.GetMax(),
+					(float)loopStats.execution.GetMean(), (float)loopStats.execution.GetPercentile(0.99), (float)loopStats.execution.GetMax(),
+					(float)writerStats.written, (float)writerStats.overwritten,
+					(float)writerStats.meanAgeMillis, (float)writerStats.maxAgeMillis });
+				if (writerStats.written > 0) {
+					headPredictor.SetMeasuredLatency(writerStats.meanAgeMillis / 1000);
+				}
+				loop.ResetStats();
 			}
-			printf("Hertz: %0.2f \n", hertz);
 
 			mainCycleCounter++;
 		}
 
 		CheckForHotkey();
 
-		Sleep(1);
+		loop.WaitForNextCycle();
 	}
 
 	if (!pauseApp) {
@@ -135,6 +168,7 @@ int _tmain(int argc, _TCHAR* argv[])
 	}
 
 	_maestroController.Disconnect();
+	Telemetry::Stop();
 
 	ovrHmd_Destroy(hmd);
 	ovr_Shutdown();
@@ -145,7 +179,8 @@ int _tmain(int argc, _TCHAR* argv[])
 //-----------------------------------------------------------------------------
 bool SendCommands(unsigned short leftMotor, unsigned short rightMotor, unsigned short yawServo, unsigned short pitchServo, unsigned short rollServo)
 {
-	printf("LEFT MOTOR: %d RIGHT MOTOR %d YAW SERVO: %d PITCH SERVO: %d ROLL SERVO: %d \n", leftMotor, rightMotor, yawServo, pitchServo, rollServo);
+	Telemetry::Log(mainCycleCounter, TELEMETRY_TARGETS, { (float)leftMotor, (float)rightMotor, (float)yawServo, (float)pitchServo, (float)rollServo,
+		(float)pauseMotor, (float)pauseServo });
 
 	return _maestroController.SetMultipleTargets(0, { leftMotor, rightMotor, yawServo, pitchServo, rollServo });
 }
@@ -169,7 +204,7 @@ void GetMotorTargets(unsigned short& leftMotor, unsigned short& rightMotor) {
 		short leftStickY = _gamepad.GetControllerAxis(Gamepad::LEFT_Y);
 		short rightStick = _gamepad.GetControllerAxis(Gamepad::RIGHT_Y);
 
-		printf("LEFT Y: %d RIGHT Y: %d \n", leftStickY, rightStick);
+		Telemetry::Log(mainCycleCounter, TELEMETRY_STICKS, { 1, (float)leftStickY, (float)rightStick });
 
 		thisLeftMotor = Maps(leftStickY, GAMEPAD_MIN, GAMEPAD_MAX, LEFT_MOTOR_MIN, LEFT_MOTOR_MAX);
 		thisRightMotor = Maps(rightStick, GAMEPAD_MIN, GAMEPAD_MAX, RIGHT_MOTOR_MIN, RIGHT_MOTOR_MAX);
@@ -178,7 +213,7 @@ void GetMotorTargets(unsigned short& leftMotor, unsigned short& rightMotor) {
 		short stickY = _gamepad.GetControllerAxis(Gamepad::LEFT_Y);
 		short stickX = _gamepad.GetControllerAxis(Gamepad::RIGHT_X);
 
-		printf("LEFT Y: %d RIGHT X: %d \n", stickY, stickX);
+		Telemetry::Log(mainCycleCounter, TELEMETRY_STICKS, { 0, (float)stickY, (float)stickX });
 
 		short leftMotorInput = (stickY + stickX) / 2;
 		short rightMotorInput = (stickY - stickX) / 2;
@@ -199,8 +234,25 @@ void GetMotorTargets(unsigned short& leftMotor, unsigned short& rightMotor) {
 
 //-----------------------------------------------------------------------------
 void GetServoTargets(unsigned short &yawServo, unsigned short &pitchServo, unsigned short &rollServo){
-	ovrSensorState state = ovrHmd_GetSensorState(hmd, ovr_GetTimeInSeconds()/* + 0.1f*/);
-	Quatf orientation = state.Recorded.Pose.Orientation;
+	double now = ovr_GetTimeInSeconds();
+	ovrSensorState state = ovrHmd_GetSensorState(hmd, now);
+	const ovrPoseStatef & sample = state.Recorded;
+	double sampleAge = now - sample.TimeInSeconds;
+
+	// The gimbal needs the serial line, the servos and the camera to catch
+	// up with a target, so it is aimed where the head will be by then
+	PredictorQuat sampleOrientation = { sample.Pose.Orientation.x, sample.Pose.Orientation.y, sample.Pose.Orientation.z, sample.Pose.Orientation.w };
+	PredictorVector angularVelocity = { sample.AngularVelocity.x, sample.AngularVelocity.y, sample.AngularVelocity.z };
+	PredictorVector angularAcceleration = { sample.AngularAcceleration.x, sample.AngularAcceleration.y, sample.AngularAcceleration.z };
+	PredictorQuat predicted = headPredictor.Predict(sampleOrientation, angularVelocity, angularAcceleration, sampleAge);
+	Quatf orientation(predicted.x, predicted.y, predicted.z, predicted.w);
+
+	// the raw sample, for replaying with PredictionEvaluator
+	Telemetry::Log(mainCycleCounter, TELEMETRY_HEAD_POSE, { (float)(sampleAge * 1000),
+		sampleOrientation.x, sampleOrientation.y, sampleOrientation.z, sampleOrientation.w,
+		angularVelocity.x, angularVelocity.y, angularVelocity.z,
+		angularAcceleration.x, angularAcceleration.y, angularAcceleration.z,
+		(float)(headPredictor.GetHorizon() * 1000) });
 
 	float yaw; float pitch; float roll;
 	orientation.GetEulerAngles<Axis_Y, Axis_X, Axis_Z>(&yaw, &pitch, &roll);
@@ -210,8 +262,8 @@ void GetServoTargets(unsigned short &yawServo, unsigned short &pitchServo, unsig
 	float y = -sin(pitch);
 	float z = cos(yaw) * cos(pitch);
 
-	printf("Vector: X: %0.2f Y: %0.2f Z: %0.2f \n", x, y, z);
-	printf("YAW: %0.2f PITCH: %0.2f ROLL: %0.2f \n", yaw*RADIANS_TO_DEGREES, pitch*RADIANS_TO_DEGREES, roll*RADIANS_TO_DEGREES);
+	Telemetry::Log(mainCycleCounter, TELEMETRY_LOOK_AT, { x, y, z });
+	Telemetry::Log(mainCycleCounter, TELEMETRY_ANGLES, { 0, yaw*RADIANS_TO_DEGREES, pitch*RADIANS_TO_DEGREES, roll*RADIANS_TO_DEGREES });
 
 	// if head is looking back, normalize angles
 	if (z < 0)
@@ -236,7 +288,7 @@ void GetServoTargets(unsigned short &yawServo, unsigned short &pitchServo, unsig
 	pitch *= RADIANS_TO_DEGREES;
 	roll *= RADIANS_TO_DEGREES;
 
-	printf("YAW: %0.2f PITCH: %0.2f ROLL: %0.2f \n", yaw, pitch, roll);
+	Telemetry::Log(mainCycleCounter, TELEMETRY_ANGLES, { 1, yaw, pitch, roll });
 
 	// avoid fast jittering movements when looking to sky and further back
 	if (pitch > 50)
@@ -274,7 +326,7 @@ void GetServoTargets(unsigned short &yawServo, unsigned short &pitchServo, unsig
 		lastRollBeforeOutsideViewport = NULL;
 	}
 
-	printf("YAW: %0.2f PITCH: %0.2f ROLL: %0.2f \n", yaw, pitch, roll);
+	Telemetry::Log(mainCycleCounter, TELEMETRY_ANGLES, { 2, yaw, pitch, roll });
 
 	yaw = Clip(yaw, SERVO_ANGLE_MIN, SERVO_ANGLE_MAX);
 	yawServo = Mapf(yaw, -79, 79, YAW_SERVO_MIN, YAW_SERVO_MAX);
@@ -285,7 +337,7 @@ void GetServoTargets(unsigned short &yawServo, unsigned short &pitchServo, unsig
 	// Avoid hitting the gimbal frame
 	if (pitch >= -79 && pitch <= -5) {
 		float rollMax = (-0.0003f * powf(pitch, 3)) - (0.0512f * powf(pitch, 2)) - 3.3477 * pitch - 90.803f;
-		printf("Roll max: %0.2f \n", rollMax)
+		Telemetry::Log(mainCycleCounter, TELEMETRY_ROLL_MAX, { pitch, rollMax });
 		roll = max(roll, rollMax);
 	}
 
@@ -364,9 +416,11 @@ void CheckForHotkey() {
 			break;
 		case 73:
 			pauseMotor = !pauseMotor;
+			Telemetry::Log(mainCycleCounter, TELEMETRY_PAUSE, { (float)pauseMotor, (float)pauseServo });
 			break;
 		case 81:
 			pauseServo = !pauseServo;
+			Telemetry::Log(mainCycleCounter, TELEMETRY_PAUSE, { (float)pauseMotor, (float)pauseServo });
 			break;
 		}
 	}
@@ -0,0 +1,207 @@
+#include "stdafx.h"
+#include "LoopScheduler.h"
+#include "Clock.h"
+#include <math.h>
+#include <string.h>
+#include <iomanip>
+#include <sstream>
+
+#ifdef _WIN32
+#pragma comment (lib, "winmm.lib")
+// Windows 10 1803 and later, newer than the SDK of VS2013
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+// Width of a histogram bucket
+#define BUCKET_MILLIS 0.01
+
+CycleHistogram::CycleHistogram()
+{
+	Reset();
+}
+
+void CycleHistogram::Add(double millis)
+{
+	if (millis < 0) {
+		millis = 0;
+	}
+	int bucket = (int)(millis / BUCKET_MILLIS);
+	++buckets[bucket < BUCKETS ? bucket : BUCKETS - 1];
+	++count;
+	sum += millis;
+	if (millis > maximum) {
+		maximum = millis;
+	}
+}
+
+void CycleHistogram::Reset()
+{
+	memset(buckets, 0, sizeof(buckets));
+	count = 0;
+	sum = 0;
+	maximum = 0;
+}
+
+double CycleHistogram::GetPercentile(double fraction) const
+{
+	if (!count) {
+		return 0;
+	}
+	unsigned long rank = (unsigned long)(fraction * count);
+	if (rank >= count) {
+		rank = count - 1;
+	}
+	unsigned long seen = 0;
+	for (int i = 0; i < BUCKETS - 1; ++i) {
+		seen += buckets[i];
+		if (seen > rank) {
+			return (i + 0.5) * BUCKET_MILLIS;
+		}
+	}
+	return maximum;
+}
+
+std::string CycleHistogram::Describe() const
+{
+	std::ostringstream text;
+	text << std::fixed << std::setprecision(3) << "mean " << GetMean() << " p50 " << GetPercentile(0.5)
+		<< " p99 " << GetPercentile(0.99) << " max " << GetMax() << " ms";
+	return text.str();
+}
+
+LoopScheduler::LoopScheduler(double hertz)
+	: periodMillis(1000.0 / hertz), spinMillis(0), deadlineMillis(0), cycleStartMillis(0)
+{
+	ResetStats();
+#ifdef _WIN32
+	raisedTimerResolution = false;
+	timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (!timer) {
+		// Older Windows wake up on the system timer tick, 15.6 ms unless
+		// somebody asks for 1 ms
+		timer = CreateWaitableTimer(NULL, TRUE, NULL);
+		raisedTimerResolution = timeBeginPeriod(1) == TIMERR_NOERROR;
+	}
+#endif
+}
+
+LoopScheduler::~LoopScheduler()
+{
+#ifdef _WIN32
+	if (timer) {
+		CloseHandle(timer);
+	}
+	if (raisedTimerResolution) {
+		timeEndPeriod(1);
+	}
+#endif
+}
+
+bool LoopScheduler::SetRealtimePriority()
+{
+#ifdef _WIN32
+	if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+		fprintf(stderr, "Error: Unable to raise the loop's priority.  Error code 0x%x.\n", GetLastError());
+		return false;
+	}
+#else
+	// In the middle of the real time range, above interrupt threads that
+	// run at 50
+	sched_param param;
+	param.sched_priority = (sched_get_priority_min(SCHED_FIFO) + sched_get_priority_max(SCHED_FIFO)) / 2 + 10;
+	int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (error) {
+		fprintf(stderr, "Error: Unable to raise the loop's priority.  %s.\n", strerror(error));
+		return false;
+	}
+#endif
+	return true;
+}
+
+bool LoopScheduler::PinToCpus(unsigned long long mask)
+{
+#ifdef _WIN32
+	if (!SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask)) {
+		fprintf(stderr, "Error: Unable to pin the loop to CPUs 0x%llx.  Error code 0x%x.\n", mask, GetLastError());
+		return false;
+	}
+#else
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (int i = 0; i < 64; ++i) {
+		if (mask & (1ull << i)) {
+			CPU_SET(i, &cpus);
+		}
+	}
+	int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	if (error) {
+		fprintf(stderr, "Error: Unable to pin the loop to CPUs 0x%llx.  %s.\n", mask, strerror(error));
+		return false;
+	}
+#endif
+	return true;
+}
+
+void LoopScheduler::ResetStats()
+{
+	stats.cycles = 0;
+	stats.overruns = 0;
+	stats.skipped = 0;
+	stats.jitter.Reset();
+	stats.execution.Reset();
+}
+
+void LoopScheduler::WaitForNextCycle()
+{
+	double now = NowMillis();
+	if (!deadlineMillis) {
+		deadlineMillis = now;
+	} else {
+		stats.execution.Add(now - cycleStartMillis);
+		if (now > deadlineMillis) {
+			++stats.overruns;
+			// start right away, but only once for all the deadlines missed
+			double missed = floor((now - deadlineMillis) / periodMillis);
+			stats.skipped += (unsigned long)missed;
+			deadlineMillis += missed * periodMillis;
+		}
+	}
+
+	SleepUntil(deadlineMillis);
+	cycleStartMillis = NowMillis();
+	stats.jitter.Add(cycleStartMillis - deadlineMillis);
+	++stats.cycles;
+	deadlineMillis += periodMillis;
+}
+
+void LoopScheduler::SleepUntil(double deadline)
+{
+	double wakeUp = deadline - spinMillis;
+#ifdef _WIN32
+	double wait = wakeUp - NowMillis();
+	if (wait > 0 && timer) {
+		// relative, in 100 ns units, computed right before waiting
+		LARGE_INTEGER due;
+		due.QuadPart = -(LONGLONG)(wait * 10000);
+		if (SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE)) {
+			WaitForSingleObject(timer, INFINITE);
+		}
+	}
+#else
+	double whole = floor(wakeUp / 1000);
+	timespec until;
+	until.tv_sec = (time_t)whole;
+	until.tv_nsec = (long)((wakeUp - whole * 1000) * 1e6);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+	}
+#endif
+	while (NowMillis() < deadline) {
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <string>
+
+// Durations of a loop cycle in milliseconds, counted in buckets of 10 us
+// up to 50 ms, longer ones in the last bucket.  Not thread safe, it
+// belongs to the thread running the loop.
+class CycleHistogram
+{
+public:
+	CycleHistogram();
+	void Add(double millis);
+	void Reset();
+	unsigned long GetCount() const { return count; }
+	double GetMean() const { return count ? sum / count : 0; }
+	double GetMax() const { return maximum; }
+	// The duration the given fraction (0 to 1) of the cycles didn't
+	// exceed, as the middle of its bucket
+	double GetPercentile(double fraction) const;
+	// mean, median, p99 and max in one line
+	std::string Describe() const;
+private:
+	enum { BUCKETS = 5000 };
+	unsigned long buckets[BUCKETS];
+	unsigned long count;
+	double sum;
+	double maximum;
+};
+
+// Runs a loop at a fixed rate: WaitForNextCycle() sleeps until the next
+// deadline on an absolute grid of periods, so the time the cycle itself
+// took doesn't add up into drift.  Sleeping uses a high resolution
+// waitable timer on Windows and clock_nanosleep with an absolute time
+// elsewhere, optionally spinning through the last bit for the timers'
+// slack.
+//
+// A cycle running past the next deadline is an overrun, and the next
+// cycle starts right away.  Deadlines missed entirely are skipped rather
+// than caught up on in a burst.
+//
+// Every cycle adds how late it woke up (jitter) and how long the work
+// between two waits took (execution) to histograms.
+class LoopScheduler
+{
+public:
+	struct Stats {
+		unsigned long cycles;
+		// cycles that ran past the next deadline
+		unsigned long overruns;
+		// deadlines missed entirely
+		unsigned long skipped;
+		CycleHistogram jitter;
+		CycleHistogram execution;
+	};
+
+	LoopScheduler(double hertz);
+	~LoopScheduler();
+
+	// For the calling thread, which should be the one running the loop.
+	// Real time priority needs privileges on Linux (CAP_SYS_NICE).
+	bool SetRealtimePriority();
+	// One bit per logical CPU the thread may run on
+	bool PinToCpus(unsigned long long mask);
+	// Busy waits the last part of every sleep, 0 to sleep all of it
+	void SetSpinMillis(double millis) { spinMillis = millis; }
+
+	// Ends the current cycle and returns when the next one is due.  The
+	// first call starts the grid.
+	void WaitForNextCycle();
+
+	double GetPeriodMillis() const { return periodMillis; }
+	const Stats & GetStats() const { return stats; }
+	void ResetStats();
+
+private:
+	void SleepUntil(double deadlineMillis);
+
+	const double periodMillis;
+	double spinMillis;
+	// when the next cycle is due, 0 before the first one
+	double deadlineMillis;
+	double cycleStartMillis;
+	Stats stats;
+#ifdef _WIN32
+	HANDLE timer;
+	// timeBeginPeriod() was needed, the timer isn't high resolution
+	bool raisedTimerResolution;
+#endif
+};
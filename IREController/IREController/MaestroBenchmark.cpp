@@ -0,0 +1,148 @@
+// Runs the serial path of the control loop against a simulated Maestro
+// on a pseudo terminal and reports command throughput and latency.
+//
+//   MaestroBenchmark [loop rate in Hz] [seconds] [sync]
+//
+// First the five targets of the robot are sent at the loop rate, through
+// the writer thread unless "sync" is given, the yaw target counting up so
+// that every command received can be matched with the moment it was set.
+// Then the yaw servo is stepped between its limits with the Maestro's
+// speed limit, and every step is timed until the position reported back
+// reaches the target.
+#include "MaestroSimulator.h"
+#include "LoopScheduler.h"
+#include "Clock.h"
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+
+#define BAUD_RATE 230400
+#define YAW_CHANNEL 2
+#define YAW_SERVO_MIN 3012
+#define YAW_SERVO_MAX 9932
+// the target range the counting yaw target wraps around in
+#define SEQUENCE_RANGE 4096
+#define STEP_SPEED 200
+#define STEPS 20
+
+static void Report(const char * name, std::vector<double> & millis)
+{
+	if (millis.empty()) {
+		printf("  %-22s no samples\n", name);
+		return;
+	}
+	std::sort(millis.begin(), millis.end());
+	double sum = 0;
+	for (size_t i = 0; i < millis.size(); ++i) {
+		sum += millis[i];
+	}
+	printf("  %-22s mean %6.2f ms  p50 %6.2f  p99 %6.2f  max %6.2f  (%u samples)\n", name,
+		sum / millis.size(), millis[millis.size() / 2], millis[millis.size() * 99 / 100],
+		millis.back(), (unsigned)millis.size());
+}
+
+static void Wait(double millis)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds((long long)(millis * 1000)));
+}
+
+int main(int argc, char* argv[])
+{
+	double hertz = argc > 1 ? atof(argv[1]) : 500;
+	double seconds = argc > 2 ? atof(argv[2]) : 5;
+	bool async = !(argc > 3 && 0 == strcmp(argv[3], "sync"));
+
+	MaestroSimulator simulator(BAUD_RATE);
+	MaestroController controller;
+	if (!simulator.Start() || !controller.Connect(simulator.GetPortName(), BAUD_RATE)) {
+		return -1;
+	}
+	if (async) {
+		controller.StartWriter();
+	}
+	printf("%s writes at %0.0f Hz for %0.1f s, %d baud on %s\n", async ? "Asynchronous" : "Blocking",
+		hertz, seconds, BAUD_RATE, simulator.GetPortName());
+
+	// The yaw target of sequence number n is YAW_SERVO_MIN + n % SEQUENCE_RANGE
+	std::vector<double> postedMillis;
+	std::vector<double> callMillis;
+	postedMillis.reserve((size_t)(hertz * seconds) + 1);
+	LoopScheduler loop(hertz);
+	double start = NowMillis();
+	while (NowMillis() < start + seconds * 1000) {
+		loop.WaitForNextCycle();
+		unsigned short yaw = YAW_SERVO_MIN + postedMillis.size() % SEQUENCE_RANGE;
+		double before = NowMillis();
+		postedMillis.push_back(before);
+		controller.SetMultipleTargets(0, { 6000, 6000, yaw, 6000, 6000 });
+		callMillis.push_back(NowMillis() - before);
+	}
+	double end = NowMillis();
+	MaestroController::WriterStats writerStats = controller.GetWriterStats(true);
+	controller.StopWriter();
+
+	// until whatever the drivers buffered is through the line as well
+	std::vector<MaestroSimulator::Command> commands = simulator.TakeCommands();
+	while (true) {
+		Wait(100);
+		std::vector<MaestroSimulator::Command> more = simulator.TakeCommands();
+		if (more.empty()) {
+			break;
+		}
+		commands.insert(commands.end(), more.begin(), more.end());
+	}
+	std::vector<double> latency;
+	size_t sequence = 0;
+	unsigned long received = 0;
+	for (size_t i = 0; i < commands.size(); ++i) {
+		const MaestroSimulator::Command & command = commands[i];
+		if (command.code != 0x9F || command.firstChannel > YAW_CHANNEL || command.firstChannel + command.count <= YAW_CHANNEL) {
+			continue;
+		}
+		++received;
+		// the first target set posted since the last one received with that yaw
+		size_t residue = (command.values[YAW_CHANNEL - command.firstChannel] - YAW_SERVO_MIN) % SEQUENCE_RANGE;
+		while (sequence < postedMillis.size() && sequence % SEQUENCE_RANGE != residue) {
+			++sequence;
+		}
+		if (sequence < postedMillis.size()) {
+			latency.push_back(command.receivedMillis - postedMillis[sequence]);
+			++sequence;
+		}
+	}
+	double elapsed = (end - start) / 1000;
+	double receiving = commands.empty() ? elapsed : (commands.back().receivedMillis - start) / 1000;
+	printf("Throughput: %0.0f target sets/s posted, %0.0f commands/s received, %lu overwritten, %lu errors\n",
+		postedMillis.size() / elapsed, received / receiving, writerStats.overwritten, simulator.GetErrorCount());
+	Report("Set call", callMillis);
+	printf("  %-22s %s, %lu overruns\n", "Loop jitter", loop.GetStats().jitter.Describe().c_str(), loop.GetStats().overruns);
+	Report("Set to received", latency);
+	if (async) {
+		printf("  %-22s mean %6.2f ms  max %6.2f\n", "Writer in WriteFile", writerStats.meanWriteMillis, writerStats.maxWriteMillis);
+	}
+
+	// Steps with the speed limit of the servo
+	if (async) {
+		controller.StartWriter();
+	}
+	simulator.SetSpeed(YAW_CHANNEL, STEP_SPEED);
+	std::vector<double> settle;
+	for (int i = 0; i < STEPS; ++i) {
+		unsigned short target = (i % 2) ? YAW_SERVO_MIN : YAW_SERVO_MAX;
+		double before = NowMillis();
+		controller.SetTarget(YAW_CHANNEL, target);
+		unsigned short position = 0;
+		while (controller.GetPosition(YAW_CHANNEL, position) && position != target) {
+		}
+		settle.push_back(NowMillis() - before);
+	}
+	printf("Steps of %d at speed %d:\n", YAW_SERVO_MAX - YAW_SERVO_MIN, STEP_SPEED);
+	Report("Set to position", settle);
+
+	controller.Disconnect();
+	simulator.Stop();
+	return 0;
+}
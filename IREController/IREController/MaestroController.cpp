@@ -1,16 +1,36 @@
 #include "stdafx.h"
 #include "MaestroController.h"
+#include "Clock.h"
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#endif
 
 MaestroController::MaestroController()
+	: serial(INVALID_SERIAL), stopWriter(false), dirtyChannels(0), postedAt(0), byteMillis(0), lineFreeMillis(0), writeMillisSum(0), ageMillisSum(0)
 {
+	memset(mailbox, 0, sizeof(mailbox));
+	memset(&stats, 0, sizeof(stats));
+	// the most the writer composes, every other channel in a command
+	// of its own, so it never allocates
+	writerCommand.reserve(MAESTRO_MAX_CHANNELS / 2 * 5);
 }
 
 
 MaestroController::~MaestroController()
 {
+	StopWriter();
 }
 
+#ifdef _WIN32
 bool MaestroController::Connect(const char * portName, unsigned int baudRate)
 {
 	DCB commState;
@@ -67,6 +87,7 @@ bool MaestroController::Connect(const char * portName, unsigned int baudRate)
 		CloseHandle(serial);
 		return false;
 	}
+	byteMillis = SERIAL_BITS_PER_BYTE * 1000.0 / baudRate;
 	commState.BaudRate = baudRate;
 	commState.ByteSize = 8;
 	commState.StopBits = ONESTOPBIT;
@@ -92,12 +113,167 @@ bool MaestroController::Connect(const char * portName, unsigned int baudRate)
 }
 
 bool MaestroController::Disconnect() {
-	if (serial) {
-		return (bool) CloseHandle(serial);
+	StopWriter();
+	if (serial != INVALID_SERIAL) {
+		bool success = 0 != CloseHandle(serial);
+		serial = INVALID_SERIAL;
+		return success;
+	}
+	return false;
+}
+
+bool MaestroController::SendData(unsigned char* command, const short commandSize) {
+	DWORD bytesTransferred;
+	BOOL success;
+
+	// Send the command to the device.
+	success = WriteFile(serial, command, commandSize, &bytesTransferred, NULL);
+	if (!success)
+	{
+		fprintf(stderr, "Error: Unable to write Set Target command to serial port.  Error code 0x%x.", GetLastError());
+		return false;
+	}
+	if (commandSize != bytesTransferred)
+	{
+		fprintf(stderr, "Error: Expected to write %d bytes but only wrote %d.", commandSize, bytesTransferred);
+		return false;
+	}
+
+	return true;
+}
+
+bool MaestroController::ReceiveData(unsigned char* response, const short responseSize) {
+	DWORD bytesTransferred;
+	BOOL success = ReadFile(serial, response, responseSize, &bytesTransferred, NULL);
+	if (!success)
+	{
+		fprintf(stderr, "Error: Unable to read from serial port.  Error code 0x%x.", GetLastError());
+		return false;
+	}
+	if (responseSize != bytesTransferred)
+	{
+		fprintf(stderr, "Error: Expected to read %d bytes but only read %d.", responseSize, bytesTransferred);
+		return false;
+	}
+	return true;
+}
+#else
+static speed_t BaudRateConstant(unsigned int baudRate)
+{
+	switch (baudRate) {
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	default: return B0;
+	}
+}
+
+bool MaestroController::Connect(const char * portName, unsigned int baudRate)
+{
+	speed_t speed = BaudRateConstant(baudRate);
+	if (speed == B0)
+	{
+		fprintf(stderr, "Error: Baud rate %u isn't supported.\n", baudRate);
+		return false;
+	}
+
+	serial = open(portName, O_RDWR | O_NOCTTY);
+	if (serial == INVALID_SERIAL)
+	{
+		switch (errno)
+		{
+		case EACCES:
+			fprintf(stderr, "Error: Access denied.  Make sure you are in the group owning \"%s\".\n", portName);
+			break;
+		case ENOENT:
+			fprintf(stderr, "Error: Serial port not found.  "
+				"Make sure that \"%s\" is the right port name.\n", portName);
+			break;
+		default:
+			fprintf(stderr, "Error: Unable to open serial port.  %s.\n", strerror(errno));
+			break;
+		}
+		return false;
+	}
+
+	/* Raw bytes, 8N1, reads time out after a second like on Windows. */
+	termios options;
+	if (tcgetattr(serial, &options) != 0)
+	{
+		fprintf(stderr, "Error: Unable to get port attributes.  %s.\n", strerror(errno));
+		Disconnect();
+		return false;
+	}
+	cfmakeraw(&options);
+	options.c_cflag &= ~(PARENB | CSTOPB | CSIZE | CRTSCTS);
+	options.c_cflag |= CS8 | CLOCAL | CREAD;
+	options.c_cc[VMIN] = 0;
+	options.c_cc[VTIME] = 10;
+	cfsetispeed(&options, speed);
+	cfsetospeed(&options, speed);
+	byteMillis = SERIAL_BITS_PER_BYTE * 1000.0 / baudRate;
+	if (tcsetattr(serial, TCSANOW, &options) != 0)
+	{
+		fprintf(stderr, "Error: Unable to set port attributes.  %s.\n", strerror(errno));
+		Disconnect();
+		return false;
+	}
+
+	/* Throw away any bytes received from the device earlier. */
+	tcflush(serial, TCIOFLUSH);
+	return true;
+}
+
+bool MaestroController::Disconnect() {
+	StopWriter();
+	if (serial != INVALID_SERIAL) {
+		bool success = 0 == close(serial);
+		serial = INVALID_SERIAL;
+		return success;
 	}
 	return false;
 }
 
+bool MaestroController::SendData(unsigned char* command, const short commandSize) {
+	short written = 0;
+	while (written < commandSize) {
+		ssize_t result = write(serial, command + written, commandSize - written);
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result <= 0) {
+			fprintf(stderr, "Error: Unable to write Set Target command to serial port.  %s.\n", strerror(errno));
+			return false;
+		}
+		written += (short)result;
+	}
+	return true;
+}
+
+bool MaestroController::ReceiveData(unsigned char* response, const short responseSize) {
+	short received = 0;
+	while (received < responseSize) {
+		ssize_t result = read(serial, response + received, responseSize - received);
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result < 0) {
+			fprintf(stderr, "Error: Unable to read from serial port.  %s.\n", strerror(errno));
+			return false;
+		}
+		if (result == 0) {
+			fprintf(stderr, "Error: Expected to read %d bytes but only read %d.\n", responseSize, received);
+			return false;
+		}
+		received += (short)result;
+	}
+	return true;
+}
+#endif
+
 bool MaestroController::SetTarget(unsigned char channel, unsigned short target) {
 	unsigned char command[4];
 
@@ -107,49 +283,172 @@ bool MaestroController::SetTarget(unsigned char channel, unsigned short target)
 	command[2] = target & 0x7F;
 	command[3] = (target >> 7) & 0x7F;
 
-	return SendData(command);
+	if (writer.joinable()) {
+		return Post(channel, &target, 1);
+	}
+	std::lock_guard<std::mutex> lock(portMutex);
+	return SendData(command, sizeof(command));
+}
+
+bool MaestroController::GetPosition(unsigned char channel, unsigned short & position) {
+	unsigned char command[2] = { 0x90, channel };
+	unsigned char response[2];
+
+	// the writer must not get between the query and its answer
+	std::lock_guard<std::mutex> lock(portMutex);
+	if (!SendData(command, sizeof(command)) || !ReceiveData(response, sizeof(response))) {
+		return false;
+	}
+	position = response[0] + 256 * response[1];
+	return true;
 }
 
 bool MaestroController::SetMultipleTargets(unsigned char firstChannel, std::initializer_list<unsigned short> targets) {
 	const unsigned char numTargets = targets.size();
-	const short commandSize = 3 + (numTargets * 2);
-	std::vector<unsigned char> command(commandSize);
+	if (writer.joinable()) {
+		return Post(firstChannel, targets.begin(), numTargets);
+	}
 
-	// Compose the command.
-	command[0] = 0x9F;
-	command[1] = numTargets;
-	command[2] = firstChannel;
+	std::vector<unsigned char> command;
+	ComposeMultipleTargets(command, firstChannel, targets.begin(), numTargets);
+	std::lock_guard<std::mutex> lock(portMutex);
+	return SendData(&command[0], command.size());
+}
+
+void MaestroController::ComposeMultipleTargets(std::vector<unsigned char> & command, unsigned char firstChannel, const unsigned short * targets, unsigned char count) {
+	size_t start = command.size();
+	command.resize(start + 3 + (count * 2));
 
-	int i = 3;
-	for (auto& target : targets) {
-		command[i] = target & 0x7F;
-		command[i + 1] = (target >> 7) & 0x7F;
-		i += 2;
+	// Compose the command, after whatever the buffer holds already.
+	command[start] = 0x9F;
+	command[start + 1] = count;
+	command[start + 2] = firstChannel;
+
+	for (int i = 0; i < count; ++i) {
+		command[start + 3 + i * 2] = targets[i] & 0x7F;
+		command[start + 4 + i * 2] = (targets[i] >> 7) & 0x7F;
 	}
+}
 
-	return SendData(&command[0], commandSize);
+bool MaestroController::StartWriter() {
+	if (writer.joinable()) {
+		return true;
+	}
+	stopWriter = false;
+	dirtyChannels = 0;
+	writer = std::thread(&MaestroController::WriterLoop, this);
+#ifdef _WIN32
+	// Above the control loop, a target waiting for the CPU is as stale
+	// as one waiting for the port
+	SetThreadPriority(writer.native_handle(), THREAD_PRIORITY_ABOVE_NORMAL);
+#endif
+	return true;
 }
 
-bool MaestroController::SendData(unsigned char* command) {
-	return SendData(command, sizeof(command));
+void MaestroController::StopWriter() {
+	if (!writer.joinable()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mailboxMutex);
+		stopWriter = true;
+	}
+	mailboxChanged.notify_one();
+	writer.join();
 }
 
-bool MaestroController::SendData(unsigned char* command, const short commandSize) {
-	DWORD bytesTransferred;
-	BOOL success;
+MaestroController::WriterStats MaestroController::GetWriterStats(bool reset) {
+	std::lock_guard<std::mutex> lock(mailboxMutex);
+	WriterStats result = stats;
+	if (stats.written) {
+		result.meanWriteMillis = writeMillisSum / stats.written;
+		result.meanAgeMillis = ageMillisSum / stats.written;
+	}
+	if (reset) {
+		memset(&stats, 0, sizeof(stats));
+		writeMillisSum = 0;
+		ageMillisSum = 0;
+	}
+	return result;
+}
 
-	// Send the command to the device.
-	success = WriteFile(serial, command, commandSize, &bytesTransferred, NULL);
-	if (!success)
-	{
-		fprintf(stderr, "Error: Unable to write Set Target command to serial port.  Error code 0x%x.", GetLastError());
+bool MaestroController::Post(unsigned char firstChannel, const unsigned short * targets, unsigned char count) {
+	if (!count || firstChannel + count > MAESTRO_MAX_CHANNELS) {
+		fprintf(stderr, "Error: Channels %d to %d don't exist.\n", firstChannel, firstChannel + count - 1);
 		return false;
 	}
-	if (commandSize != bytesTransferred)
+	unsigned long channels = ((1ul << count) - 1) << firstChannel;
 	{
-		fprintf(stderr, "Error: Expected to write %d bytes but only wrote %d.", sizeof(command), bytesTransferred);
-		return false;
+		std::lock_guard<std::mutex> lock(mailboxMutex);
+		++stats.posted;
+		if (dirtyChannels & channels) {
+			++stats.overwritten;
+		}
+		memcpy(mailbox + firstChannel, targets, count * sizeof(unsigned short));
+		dirtyChannels |= channels;
+		postedAt = NowMillis();
 	}
-
+	mailboxChanged.notify_one();
 	return true;
-}
\ No newline at end of file
+}
+
+void MaestroController::WriterLoop() {
+	std::unique_lock<std::mutex> lock(mailboxMutex);
+	while (true) {
+		mailboxChanged.wait(lock, [this] { return dirtyChannels || stopWriter; });
+		if (!dirtyChannels) {
+			break;
+		}
+
+		// While the last command is still on the line, newer targets can
+		// replace these.  Drivers buffer far more than a command, so by
+		// the time a write blocks, the buffer is full of old targets.
+		double wait = lineFreeMillis - NowMillis();
+		if (wait > 0 && !stopWriter) {
+			lock.unlock();
+			std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(wait));
+			lock.lock();
+		}
+
+		// A command for every run of channels with new targets, all of
+		// them in a single write.  Channels without new targets are left
+		// alone, a target of 0 would switch them off.
+		writerCommand.clear();
+		for (unsigned char first = 0; first < MAESTRO_MAX_CHANNELS; ++first) {
+			if (!(dirtyChannels & (1ul << first))) {
+				continue;
+			}
+			unsigned char end = first + 1;
+			while (end < MAESTRO_MAX_CHANNELS && (dirtyChannels & (1ul << end))) {
+				++end;
+			}
+			ComposeMultipleTargets(writerCommand, first, mailbox + first, end - first);
+			first = end;
+		}
+		dirtyChannels = 0;
+		double posted = postedAt;
+		lock.unlock();
+
+		double start = NowMillis();
+		bool success;
+		{
+			std::lock_guard<std::mutex> portLock(portMutex);
+			success = SendData(&writerCommand[0], writerCommand.size());
+		}
+		double end = NowMillis();
+		lineFreeMillis = (std::max)(start, lineFreeMillis) + writerCommand.size() * byteMillis;
+
+		lock.lock();
+		if (!success) {
+			++stats.failed;
+			continue;
+		}
+		double writeMillis = end - start;
+		double ageMillis = end - posted;
+		++stats.written;
+		writeMillisSum += writeMillis;
+		ageMillisSum += ageMillis;
+		stats.maxWriteMillis = (std::max)(stats.maxWriteMillis, writeMillis);
+		stats.maxAgeMillis = (std::max)(stats.maxAgeMillis, ageMillis);
+	}
+}
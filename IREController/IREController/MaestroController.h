@@ -1,19 +1,89 @@
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
+typedef HANDLE SerialPort;
+#define INVALID_SERIAL INVALID_HANDLE_VALUE
+#else
+// a termios file descriptor
+typedef int SerialPort;
+#define INVALID_SERIAL -1
+#endif
 #include <initializer_list>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// The Maestro with the most channels has 24
+#define MAESTRO_MAX_CHANNELS 24
+// Start bit, 8 data bits and a stop bit
+#define SERIAL_BITS_PER_BYTE 10
+
 class MaestroController
 {
 public:
+	// Metrics of the writer thread, times in milliseconds
+	struct WriterStats {
+		// target sets handed to the writer
+		unsigned long posted;
+		// target sets replaced by newer ones before they were written
+		unsigned long overwritten;
+		unsigned long written;
+		unsigned long failed;
+		// time spent in WriteFile
+		double meanWriteMillis;
+		double maxWriteMillis;
+		// time from posting the newest targets until they were written
+		double meanAgeMillis;
+		double maxAgeMillis;
+	};
+
 	MaestroController();
 	~MaestroController();
+	// A port like \\.\COM3 on Windows, a tty like /dev/ttyACM0 elsewhere
 	bool Connect(const char * portName, unsigned int baudRate);
 	bool Disconnect();
 	bool SetTarget(unsigned char channel, unsigned short target);
 	bool SetMultipleTargets(unsigned char firstChannel, std::initializer_list<unsigned short> targets);
+	// Where the servo is now, in quarter microseconds like the targets
+	bool GetPosition(unsigned char channel, unsigned short & position);
+
+	// Hands the writes to a thread of their own, so a slow port doesn't
+	// stall the caller.  Targets go into a mailbox holding the newest
+	// target of every channel, and whatever is in it when the last
+	// command is through the line at the baud rate goes out in a single
+	// write.  Targets the line had no time for are overwritten, not
+	// queued.  The Set methods then only fail on bad channels, write
+	// errors are counted in the stats.
+	bool StartWriter();
+	// Writes what is left in the mailbox and ends the thread
+	void StopWriter();
+	WriterStats GetWriterStats(bool reset = false);
 private:
-	HANDLE serial;
-	bool SendData(unsigned char* command);
+	SerialPort serial;
+	// one command and its answer at a time
+	std::mutex portMutex;
 	bool SendData(unsigned char* command, const short commandSize);
-};
+	bool ReceiveData(unsigned char* response, const short responseSize);
+	bool Post(unsigned char firstChannel, const unsigned short * targets, unsigned char count);
+	void WriterLoop();
+	static void ComposeMultipleTargets(std::vector<unsigned char> & command, unsigned char firstChannel, const unsigned short * targets, unsigned char count);
 
+	std::thread writer;
+	std::mutex mailboxMutex;
+	std::condition_variable mailboxChanged;
+	bool stopWriter;
+	unsigned short mailbox[MAESTRO_MAX_CHANNELS];
+	// one bit per channel with a target not written yet
+	unsigned long dirtyChannels;
+	double postedAt;
+	// time a byte takes on the line at the baud rate, 8N1
+	double byteMillis;
+	// when the last command written is through the line
+	double lineFreeMillis;
+	std::vector<unsigned char> writerCommand;
+	WriterStats stats;
+	double writeMillisSum;
+	double ageMillisSum;
+};
@@ -0,0 +1,305 @@
+#include "MaestroSimulator.h"
+#include "Clock.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+static void SleepUntil(double millis)
+{
+	double wait = millis - NowMillis();
+	if (wait > 0) {
+		timespec duration;
+		duration.tv_sec = (time_t)(wait / 1000);
+		duration.tv_nsec = (long)((wait - duration.tv_sec * 1000.0) * 1e6);
+		nanosleep(&duration, NULL);
+	}
+}
+
+MaestroSimulator::MaestroSimulator(unsigned int baudRate, unsigned short speed)
+	: byteMillis(SERIAL_BITS_PER_BYTE * 1000.0 / baudRate), master(-1), slave(-1), running(false),
+	lineFreeMillis(0), updatedMillis(0), errorCount(0)
+{
+	for (int i = 0; i < MAESTRO_MAX_CHANNELS; ++i) {
+		servos[i].position = 0;
+		servos[i].target = 0;
+		servos[i].speed = speed;
+	}
+	partial.reserve(3 + MAESTRO_MAX_CHANNELS * 2);
+}
+
+MaestroSimulator::~MaestroSimulator()
+{
+	Stop();
+}
+
+bool MaestroSimulator::Start()
+{
+	if (running) {
+		return true;
+	}
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+		fprintf(stderr, "Error: Unable to create a pseudo terminal.  %s.\n", strerror(errno));
+		Stop();
+		return false;
+	}
+	portName = ptsname(master);
+	slave = open(portName.c_str(), O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		fprintf(stderr, "Error: Unable to open %s.  %s.\n", portName.c_str(), strerror(errno));
+		Stop();
+		return false;
+	}
+	// no echo or line editing, even before a controller configures it
+	termios options;
+	tcgetattr(slave, &options);
+	cfmakeraw(&options);
+	tcsetattr(slave, TCSANOW, &options);
+
+	updatedMillis = lineFreeMillis = NowMillis();
+	running = true;
+	thread = std::thread(&MaestroSimulator::Run, this);
+	return true;
+}
+
+void MaestroSimulator::Stop()
+{
+	running = false;
+	if (thread.joinable()) {
+		thread.join();
+	}
+	if (slave >= 0) {
+		close(slave);
+		slave = -1;
+	}
+	if (master >= 0) {
+		close(master);
+		master = -1;
+	}
+}
+
+const char * MaestroSimulator::GetPortName() const
+{
+	return portName.c_str();
+}
+
+void MaestroSimulator::SetSpeed(unsigned char channel, unsigned short speed)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	servos[channel % MAESTRO_MAX_CHANNELS].speed = speed;
+}
+
+unsigned short MaestroSimulator::GetTarget(unsigned char channel)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return servos[channel % MAESTRO_MAX_CHANNELS].target;
+}
+
+unsigned short MaestroSimulator::GetPosition(unsigned char channel)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	UpdatePositions(NowMillis());
+	return (unsigned short)(servos[channel % MAESTRO_MAX_CHANNELS].position + 0.5);
+}
+
+std::vector<MaestroSimulator::Command> MaestroSimulator::TakeCommands()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<Command> result;
+	result.swap(commands);
+	return result;
+}
+
+unsigned long MaestroSimulator::GetErrorCount()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return errorCount;
+}
+
+void MaestroSimulator::Run()
+{
+	unsigned char buffer[256];
+	while (running) {
+		pollfd readable = { master, POLLIN, 0 };
+		if (poll(&readable, 1, 50) <= 0 || !(readable.revents & POLLIN)) {
+			continue;
+		}
+		ssize_t count = read(master, buffer, sizeof(buffer));
+		if (count <= 0) {
+			continue;
+		}
+
+		// The bytes were written at once, but a real line would have
+		// delivered them one after the other
+		double now = NowMillis();
+		double arrival = std::max(now, lineFreeMillis);
+		for (ssize_t i = 0; i < count; ++i) {
+			arrival += byteMillis;
+			Receive(buffer[i], arrival);
+		}
+		lineFreeMillis = arrival;
+		// not reading any faster than the line keeps the rest in the
+		// pty, where the writer runs into it
+		SleepUntil(arrival);
+	}
+}
+
+int MaestroSimulator::CommandSize(const std::vector<unsigned char> & bytes)
+{
+	switch (bytes[0]) {
+	case 0x84:
+	case 0x87:
+		return 4;
+	case 0x90:
+		return 2;
+	case 0x93:
+		return 1;
+	case 0x9F:
+		return bytes.size() < 2 ? 2 : 3 + bytes[1] * 2;
+	default:
+		return 0;
+	}
+}
+
+void MaestroSimulator::Receive(unsigned char byte, double arrivalMillis)
+{
+	if (byte & 0x80) {
+		if (!partial.empty()) {
+			// a new command before the last one was complete
+			std::lock_guard<std::mutex> lock(mutex);
+			errorCount += partial.size();
+		}
+		partial.clear();
+	} else if (partial.empty()) {
+		std::lock_guard<std::mutex> lock(mutex);
+		++errorCount;
+		return;
+	}
+	partial.push_back(byte);
+
+	int size = CommandSize(partial);
+	if (!size) {
+		std::lock_guard<std::mutex> lock(mutex);
+		++errorCount;
+		partial.clear();
+		return;
+	}
+	if ((int)partial.size() < size) {
+		return;
+	}
+
+	Command command;
+	memset(&command, 0, sizeof(command));
+	command.receivedMillis = arrivalMillis;
+	command.code = partial[0];
+	switch (command.code) {
+	case 0x84:
+	case 0x87:
+		command.firstChannel = partial[1];
+		command.count = 1;
+		command.values[0] = partial[2] + 128 * partial[3];
+		break;
+	case 0x90:
+		command.firstChannel = partial[1];
+		command.count = 1;
+		break;
+	case 0x9F:
+		command.count = partial[1];
+		command.firstChannel = partial[2];
+		for (int i = 0; i < command.count && i < MAESTRO_MAX_CHANNELS; ++i) {
+			command.values[i] = partial[3 + i * 2] + 128 * partial[4 + i * 2];
+		}
+		break;
+	}
+	partial.clear();
+	Execute(command);
+}
+
+void MaestroSimulator::Execute(const Command & command)
+{
+	unsigned char response[2];
+	size_t responseSize = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (command.firstChannel + command.count > MAESTRO_MAX_CHANNELS) {
+			++errorCount;
+			return;
+		}
+		UpdatePositions(command.receivedMillis);
+		commands.push_back(command);
+
+		switch (command.code) {
+		case 0x84:
+		case 0x9F:
+			for (int i = 0; i < command.count; ++i) {
+				Servo & servo = servos[command.firstChannel + i];
+				servo.target = command.values[i];
+				// a servo switched on starts where it is told to be
+				if (!servo.position || !servo.target) {
+					servo.position = servo.target;
+				}
+			}
+			break;
+		case 0x87:
+			servos[command.firstChannel].speed = command.values[0];
+			break;
+		case 0x90: {
+			unsigned short position = (unsigned short)(servos[command.firstChannel].position + 0.5);
+			response[0] = position & 0xFF;
+			response[1] = position >> 8;
+			responseSize = 2;
+			break;
+		}
+		case 0x93: {
+			response[0] = 0;
+			for (int i = 0; i < MAESTRO_MAX_CHANNELS; ++i) {
+				if (servos[i].position != servos[i].target) {
+					response[0] = 1;
+				}
+			}
+			responseSize = 1;
+			break;
+		}
+		}
+	}
+	if (responseSize) {
+		// not before the query is through the line
+		SleepUntil(command.receivedMillis);
+		Respond(response, responseSize);
+	}
+}
+
+void MaestroSimulator::Respond(const unsigned char * response, size_t size)
+{
+	if (write(master, response, size) != (ssize_t)size) {
+		fprintf(stderr, "Error: Unable to answer on %s.  %s.\n", portName.c_str(), strerror(errno));
+	}
+}
+
+void MaestroSimulator::UpdatePositions(double nowMillis)
+{
+	double elapsed = nowMillis - updatedMillis;
+	if (elapsed <= 0) {
+		return;
+	}
+	updatedMillis = nowMillis;
+	for (int i = 0; i < MAESTRO_MAX_CHANNELS; ++i) {
+		Servo & servo = servos[i];
+		if (!servo.speed) {
+			servo.position = servo.target;
+			continue;
+		}
+		double step = servo.speed * elapsed / 10.0;
+		double delta = servo.target - servo.position;
+		servo.position = fabs(delta) <= step ? servo.target : servo.position + (delta > 0 ? step : -step);
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MaestroController.h"
+
+// Pretends to be a Maestro servo controller on the slave side of a
+// pseudo terminal, so the serial path can be run and measured without
+// the robot.  POSIX only.
+//
+// Understands the compact protocol: Set Target (0x84), Set Speed (0x87),
+// Get Position (0x90), Get Moving State (0x93) and Set Multiple Targets
+// (0x9F).  Bytes are taken off the line no faster than the baud rate
+// allows with 8N1 framing, so a controller writing too much backs up
+// like it would on a real port.  Answers go back without delay.
+//
+// Positions move towards their targets no faster than the speed of the
+// channel, in quarter microseconds per 10 ms like on the Maestro, 0
+// meaning instantly.
+class MaestroSimulator
+{
+public:
+	struct Command {
+		// when the last byte of the command was through the line, on the
+		// clock of NowMillis()
+		double receivedMillis;
+		unsigned char code;
+		unsigned char firstChannel;
+		unsigned char count;
+		unsigned short values[MAESTRO_MAX_CHANNELS];
+	};
+
+	MaestroSimulator(unsigned int baudRate = 230400, unsigned short speed = 0);
+	~MaestroSimulator();
+	// Creates the pseudo terminal and starts answering on it
+	bool Start();
+	void Stop();
+	// The tty to connect the controller to
+	const char * GetPortName() const;
+
+	void SetSpeed(unsigned char channel, unsigned short speed);
+	unsigned short GetTarget(unsigned char channel);
+	unsigned short GetPosition(unsigned char channel);
+	// The commands received since the last call, in order
+	std::vector<Command> TakeCommands();
+	// Bytes that didn't make up a known command
+	unsigned long GetErrorCount();
+
+private:
+	struct Servo {
+		double position;
+		unsigned short target;
+		unsigned short speed;
+	};
+
+	void Run();
+	void Receive(unsigned char byte, double arrivalMillis);
+	void Execute(const Command & command);
+	void Respond(const unsigned char * response, size_t size);
+	void UpdatePositions(double nowMillis);
+	static int CommandSize(const std::vector<unsigned char> & bytes);
+
+	const double byteMillis;
+	int master;
+	// kept open, so the master doesn't hang up between controllers
+	int slave;
+	std::string portName;
+	std::thread thread;
+	std::atomic<bool> running;
+	double lineFreeMillis;
+	// the command received so far
+	std::vector<unsigned char> partial;
+
+	std::mutex mutex;
+	Servo servos[MAESTRO_MAX_CHANNELS];
+	double updatedMillis;
+	std::vector<Command> commands;
+	unsigned long errorCount;
+};
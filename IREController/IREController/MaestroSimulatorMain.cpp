@@ -0,0 +1,45 @@
+// Serves a simulated Maestro on a pseudo terminal until Ctrl-C, printing
+// the targets it receives.  Connect the controller to the tty it names.
+//
+//   MaestroSimulator [baud rate] [speed]
+#include "MaestroSimulator.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t terminateApp = 0;
+
+static void OnSignal(int)
+{
+	terminateApp = 1;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int baudRate = argc > 1 ? atoi(argv[1]) : 230400;
+	unsigned short speed = argc > 2 ? atoi(argv[2]) : 0;
+	MaestroSimulator simulator(baudRate, speed);
+	if (!simulator.Start()) {
+		return -1;
+	}
+	printf("Simulating a Maestro at %u baud on %s\n", baudRate, simulator.GetPortName());
+	fflush(stdout);
+
+	signal(SIGINT, OnSignal);
+	signal(SIGTERM, OnSignal);
+	unsigned long received = 0;
+	while (!terminateApp) {
+		sleep(1);
+		std::vector<MaestroSimulator::Command> commands = simulator.TakeCommands();
+		received += commands.size();
+		printf("%lu commands, %lu errors, targets:", received, simulator.GetErrorCount());
+		for (int i = 0; i < 6; ++i) {
+			printf(" %d", simulator.GetTarget(i));
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+	simulator.Stop();
+	return 0;
+}
@@ -0,0 +1,171 @@
+// Replays the head poses of a telemetry log through the predictor and
+// reports how far off the predictions were from where the head actually
+// went, for a range of horizons.
+//
+//   PredictionEvaluator <log> [max horizon millis] [step millis]
+//
+// Every head_pose record holds a raw sensor sample.  The orientation the
+// head really had a horizon after a sample is interpolated between the
+// samples around that time, and compared to what holding the sample,
+// velocity alone, velocity and acceleration, and the blended settings of
+// the controller predict.  Errors are in degrees.
+#include "Telemetry.h"
+#include "HeadPredictor.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define DEFAULT_MAX_HORIZON_MILLIS 200
+#define DEFAULT_STEP_MILLIS 10
+// Samples further apart are a gap in the log, nothing to interpolate over
+#define MAX_GAP_MILLIS 50
+// Samples closer together are the same sample, read in two cycles
+#define SAME_SAMPLE_MILLIS 0.05
+#define RADIANS_TO_DEGREES (180.0f / 3.14159265f)
+
+struct Sample {
+	double millis;
+	PredictorQuat orientation;
+	PredictorVector angularVelocity;
+	PredictorVector angularAcceleration;
+};
+
+enum Mode {
+	MODE_HOLD,
+	MODE_VELOCITY,
+	MODE_ACCELERATION,
+	MODE_BLENDED,
+	MODES
+};
+
+static const char * modeNames[MODES] = { "hold", "velocity", "acceleration", "blended" };
+
+static bool Earlier(const Sample & a, const Sample & b)
+{
+	return a.millis < b.millis;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <log> [max horizon millis] [step millis]\n", argv[0]);
+		return -1;
+	}
+	double maxHorizon = argc > 2 ? atof(argv[2]) : DEFAULT_MAX_HORIZON_MILLIS;
+	double step = argc > 3 ? atof(argv[3]) : DEFAULT_STEP_MILLIS;
+	if (maxHorizon < 0 || step <= 0) {
+		fprintf(stderr, "Error: Horizons must not be negative, steps must be positive.\n");
+		return -1;
+	}
+
+	FILE * file = fopen(argv[1], "rb");
+	if (!file) {
+		fprintf(stderr, "Error: Unable to open \"%s\".\n", argv[1]);
+		return -1;
+	}
+	TelemetryFileHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "IRET", 4) != 0) {
+		fprintf(stderr, "Error: \"%s\" isn't a telemetry log.\n", argv[1]);
+		return -1;
+	}
+	if (header.recordSize != sizeof(TelemetryRecord)) {
+		fprintf(stderr, "Error: Records of %u bytes, expected %u.\n", header.recordSize, (unsigned)sizeof(TelemetryRecord));
+		return -1;
+	}
+
+	std::vector<Sample> samples;
+	double horizonSum = 0;
+	TelemetryRecord record;
+	while (fread(&record, sizeof(record), 1, file) == 1) {
+		if (record.type != TELEMETRY_HEAD_POSE || record.count < 11) {
+			continue;
+		}
+		const float * v = record.values;
+		Sample sample = { record.millis - v[0], { v[1], v[2], v[3], v[4] }, { v[5], v[6], v[7] }, { v[8], v[9], v[10] } };
+		samples.push_back(sample);
+		horizonSum += record.count > 11 ? v[11] : 0;
+	}
+	fclose(file);
+	if (samples.size() < 2) {
+		fprintf(stderr, "Error: Not enough head_pose records in \"%s\".\n", argv[1]);
+		return -1;
+	}
+	double usedHorizon = horizonSum / samples.size();
+
+	std::stable_sort(samples.begin(), samples.end(), Earlier);
+	size_t kept = 1;
+	for (size_t i = 1; i < samples.size(); ++i) {
+		if (samples[i].millis - samples[kept - 1].millis > SAME_SAMPLE_MILLIS) {
+			samples[kept++] = samples[i];
+		}
+	}
+	samples.resize(kept);
+	fprintf(stderr, "%u samples over %0.1f s, the controller predicted %0.1f ms ahead\n",
+		(unsigned)samples.size(), (samples.back().millis - samples.front().millis) / 1000, usedHorizon);
+
+	HeadPredictor::Settings settings[MODES];
+	settings[MODE_BLENDED] = HeadPredictor::Defaults();
+	settings[MODE_ACCELERATION] = settings[MODE_BLENDED];
+	settings[MODE_ACCELERATION].stillSpeed = settings[MODE_ACCELERATION].fullSpeed = 0;
+	settings[MODE_ACCELERATION].accelerationLimit = 1e9f;
+	settings[MODE_VELOCITY] = settings[MODE_ACCELERATION];
+	settings[MODE_VELOCITY].useAcceleration = false;
+	settings[MODE_HOLD] = settings[MODE_VELOCITY];
+
+	printf("horizon_ms,compared");
+	for (int mode = 0; mode < MODES; ++mode) {
+		printf(",%s_mean,%s_p95,%s_max", modeNames[mode], modeNames[mode], modeNames[mode]);
+	}
+	printf("\n");
+
+	std::vector<float> errors[MODES];
+	for (double horizon = 0; horizon <= maxHorizon + 1e-9; horizon += step) {
+		for (int mode = 0; mode < MODES; ++mode) {
+			errors[mode].clear();
+		}
+		size_t next = 1;
+		for (size_t i = 0; i < samples.size(); ++i) {
+			const Sample & sample = samples[i];
+			double target = sample.millis + horizon;
+			while (next < samples.size() && samples[next].millis < target) {
+				++next;
+			}
+			if (next >= samples.size()) {
+				break;
+			}
+			const Sample & before = samples[next - 1];
+			const Sample & after = samples[next];
+			if (after.millis - before.millis > MAX_GAP_MILLIS) {
+				continue;
+			}
+			float fraction = (float)((target - before.millis) / (after.millis - before.millis));
+			fraction = (std::max)(0.0f, (std::min)(1.0f, fraction));
+			PredictorQuat actual = HeadPredictor::Slerp(before.orientation, after.orientation, fraction);
+
+			for (int mode = 0; mode < MODES; ++mode) {
+				PredictorQuat predicted = mode == MODE_HOLD ? sample.orientation : HeadPredictor::Extrapolate(settings[mode],
+					sample.orientation, sample.angularVelocity, sample.angularAcceleration, horizon / 1000);
+				errors[mode].push_back(HeadPredictor::Difference(predicted, actual) * RADIANS_TO_DEGREES);
+			}
+		}
+		if (errors[0].empty()) {
+			break;
+		}
+
+		printf("%g,%u", horizon, (unsigned)errors[0].size());
+		for (int mode = 0; mode < MODES; ++mode) {
+			std::vector<float> & e = errors[mode];
+			double sum = 0;
+			for (size_t i = 0; i < e.size(); ++i) {
+				sum += e[i];
+			}
+			std::sort(e.begin(), e.end());
+			printf(",%0.3f,%0.3f,%0.3f", sum / e.size(), e[(size_t)(0.95 * (e.size() - 1))], e.back());
+		}
+		printf("\n");
+	}
+	return 0;
+}
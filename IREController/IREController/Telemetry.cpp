@@ -0,0 +1,237 @@
+#include "stdafx.h"
+#include "Telemetry.h"
+#include "Clock.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+// VS2013 has no thread_local, but a pointer is all we need
+#define TELEMETRY_THREAD_LOCAL __declspec(thread)
+#else
+#define TELEMETRY_THREAD_LOCAL __thread
+#endif
+
+// Records per producer thread, a few seconds of the control loop
+#define RING_CAPACITY 4096
+// How often the drain thread empties the rings
+#define DRAIN_MILLIS 10
+#define DRAIN_BATCH 256
+
+static const TelemetryTypeInfo typeInfos[TELEMETRY_TYPES + 1] = {
+	{ "sticks", { "tank_mode", "left_y", "right" } },
+	{ "look_at", { "x", "y", "z" } },
+	{ "angles", { "stage", "yaw", "pitch", "roll" } },
+	{ "roll_max", { "pitch", "roll_max" } },
+	{ "targets", { "left_motor", "right_motor", "yaw_servo", "pitch_servo", "roll_servo", "motor_paused", "servo_paused" } },
+	{ "loop", { "hertz", "overruns", "jitter_mean", "jitter_p99", "jitter_max", "execution_mean", "execution_p99", "execution_max",
+		"serial_written", "serial_overwritten", "serial_age_mean", "serial_age_max" } },
+	{ "head_pose", { "age_ms", "qx", "qy", "qz", "qw", "wx", "wy", "wz", "ax", "ay", "az", "horizon_ms" } },
+	{ "pause", { "motor_paused", "servo_paused" } },
+	{ "unknown", { 0 } },
+};
+
+static std::atomic<bool> running(false);
+static double startMillis;
+static FILE * file;
+static double consoleInterval;
+static std::thread drainer;
+static std::mutex mutex;
+static std::condition_variable stopping;
+// every ring any thread ever logged to, freed by Stop()
+static std::vector<TelemetryRing *> rings;
+static std::atomic<unsigned long> recordCount(0);
+// dropped by the rings of the last Start(), which are gone
+static unsigned long droppedBefore;
+// counts Start() calls, rings of an earlier one are gone
+static std::atomic<unsigned> generation(0);
+static TELEMETRY_THREAD_LOCAL TelemetryRing * threadRing;
+static TELEMETRY_THREAD_LOCAL unsigned threadGeneration;
+
+TelemetryRing::TelemetryRing(uint32_t capacity)
+	: capacity(capacity), records(new TelemetryRecord[capacity]), head(0), cachedTail(0), dropped(0), tail(0)
+{
+}
+
+TelemetryRing::~TelemetryRing()
+{
+	delete[] records;
+}
+
+uint32_t TelemetryRing::Take(TelemetryRecord * out, uint32_t max)
+{
+	uint32_t tail = this->tail.load(std::memory_order_relaxed);
+	uint32_t available = head.load(std::memory_order_acquire) - tail;
+	uint32_t count = available < max ? available : max;
+	for (uint32_t i = 0; i < count; ++i) {
+		out[i] = records[(tail + i) & (capacity - 1)];
+	}
+	this->tail.store(tail + count, std::memory_order_release);
+	return count;
+}
+
+// The newest record of every type, one line each
+static void PrintSummary(const TelemetryRecord * latest, const bool * seen)
+{
+	printf("Telemetry: %lu records, %lu dropped\n", Telemetry::GetRecordCount(), Telemetry::GetDroppedCount());
+	for (int type = 0; type < TELEMETRY_TYPES; ++type) {
+		if (!seen[type]) {
+			continue;
+		}
+		const TelemetryRecord & record = latest[type];
+		const TelemetryTypeInfo & info = typeInfos[type];
+		printf("  %-9s", info.name);
+		for (int i = 0; i < record.count; ++i) {
+			printf(" %s %0.2f", info.columns[i] ? info.columns[i] : "?", record.values[i]);
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+static void Drain()
+{
+	std::vector<TelemetryRecord> batch(DRAIN_BATCH);
+	TelemetryRecord latest[TELEMETRY_TYPES];
+	bool seen[TELEMETRY_TYPES] = { false };
+	double printed = NowMillis();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		bool last = !running;
+		for (size_t i = 0; i < rings.size(); ++i) {
+			uint32_t count;
+			while ((count = rings[i]->Take(&batch[0], DRAIN_BATCH)) > 0) {
+				if (file) {
+					fwrite(&batch[0], sizeof(TelemetryRecord), count, file);
+				}
+				for (uint32_t j = 0; j < count; ++j) {
+					if (batch[j].type < TELEMETRY_TYPES) {
+						latest[batch[j].type] = batch[j];
+						seen[batch[j].type] = true;
+					}
+				}
+				recordCount += count;
+			}
+		}
+		if (last) {
+			break;
+		}
+
+		double now = NowMillis();
+		if (consoleInterval > 0 && now - printed >= consoleInterval) {
+			printed = now;
+			lock.unlock();
+			PrintSummary(latest, seen);
+			lock.lock();
+		}
+		stopping.wait_for(lock, std::chrono::milliseconds(DRAIN_MILLIS));
+	}
+}
+
+bool Telemetry::Start(const char * path, double consoleIntervalMillis)
+{
+	if (running) {
+		return true;
+	}
+	file = NULL;
+	if (path) {
+#ifdef _WIN32
+		if (fopen_s(&file, path, "wb") != 0) {
+			file = NULL;
+		}
+#else
+		file = fopen(path, "wb");
+#endif
+		if (!file) {
+			fprintf(stderr, "Error: Unable to open telemetry log \"%s\".\n", path);
+			return false;
+		}
+		TelemetryFileHeader header = { { 'I', 'R', 'E', 'T' }, sizeof(TelemetryRecord) };
+		fwrite(&header, sizeof(header), 1, file);
+	}
+	consoleInterval = consoleIntervalMillis;
+	startMillis = NowMillis();
+	recordCount = 0;
+	droppedBefore = 0;
+	++generation;
+	running = true;
+	drainer = std::thread(Drain);
+	return true;
+}
+
+void Telemetry::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!running) {
+			return;
+		}
+		running = false;
+	}
+	stopping.notify_one();
+	drainer.join();
+	if (file) {
+		fclose(file);
+		file = NULL;
+	}
+	// Threads still holding one get a new one after the next Start()
+	std::lock_guard<std::mutex> lock(mutex);
+	droppedBefore = 0;
+	for (size_t i = 0; i < rings.size(); ++i) {
+		droppedBefore += rings[i]->GetDropped();
+		delete rings[i];
+	}
+	rings.clear();
+}
+
+void Telemetry::Log(uint32_t cycle, TelemetryType type, std::initializer_list<float> values)
+{
+	if (!running.load(std::memory_order_relaxed)) {
+		return;
+	}
+	TelemetryRing * ring = threadRing;
+	if (!ring || threadGeneration != generation.load(std::memory_order_relaxed)) {
+		// once per thread
+		std::lock_guard<std::mutex> lock(mutex);
+		ring = threadRing = new TelemetryRing(RING_CAPACITY);
+		threadGeneration = generation;
+		rings.push_back(ring);
+	}
+	TelemetryRecord * record = ring->Claim();
+	if (!record) {
+		return;
+	}
+	record->millis = NowMillis() - startMillis;
+	record->cycle = cycle;
+	record->type = (uint16_t)type;
+	uint16_t count = 0;
+	for (auto value = values.begin(); value != values.end() && count < TELEMETRY_MAX_VALUES; ++value) {
+		record->values[count++] = *value;
+	}
+	record->count = count;
+	ring->Publish();
+}
+
+unsigned long Telemetry::GetRecordCount()
+{
+	return recordCount;
+}
+
+unsigned long Telemetry::GetDroppedCount()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	unsigned long dropped = droppedBefore;
+	for (size_t i = 0; i < rings.size(); ++i) {
+		dropped += rings[i]->GetDropped();
+	}
+	return dropped;
+}
+
+const TelemetryTypeInfo & Telemetry::GetTypeInfo(unsigned type)
+{
+	return typeInfos[type < (unsigned)TELEMETRY_TYPES ? type : (unsigned)TELEMETRY_TYPES];
+}
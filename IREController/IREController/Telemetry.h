@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <initializer_list>
+#include <stdint.h>
+
+#define TELEMETRY_MAX_VALUES 12
+
+enum TelemetryType {
+	TELEMETRY_STICKS,
+	TELEMETRY_LOOK_AT,
+	TELEMETRY_ANGLES,
+	TELEMETRY_ROLL_MAX,
+	TELEMETRY_TARGETS,
+	TELEMETRY_LOOP,
+	TELEMETRY_HEAD_POSE,
+	TELEMETRY_PAUSE,
+	TELEMETRY_TYPES
+};
+
+// What a record of a type holds, for the console and the CSV decoder
+struct TelemetryTypeInfo {
+	const char * name;
+	const char * columns[TELEMETRY_MAX_VALUES];
+};
+
+// One record of the binary log, 64 bytes, in the byte order of the
+// machine that wrote it
+struct TelemetryRecord {
+	// since Telemetry::Start()
+	double millis;
+	uint32_t cycle;
+	uint16_t type;
+	uint16_t count;
+	float values[TELEMETRY_MAX_VALUES];
+};
+
+// What a log file starts with
+struct TelemetryFileHeader {
+	char magic[4];
+	uint32_t recordSize;
+};
+
+// Records of one producer thread on their way to the drain thread.  Only
+// the producer moves the head and only the consumer moves the tail, so
+// neither ever waits for the other.  A full ring drops records.
+class TelemetryRing
+{
+public:
+	// capacity must be a power of two
+	TelemetryRing(uint32_t capacity);
+	~TelemetryRing();
+
+	// The slot for the next record, or null when the ring is full
+	TelemetryRecord * Claim() {
+		uint32_t head = this->head.load(std::memory_order_relaxed);
+		if (head - cachedTail == capacity) {
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (head - cachedTail == capacity) {
+				dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				return nullptr;
+			}
+		}
+		return &records[head & (capacity - 1)];
+	}
+	// Hands the claimed record to the consumer
+	void Publish() {
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+	// Consumer side, copies out up to max records
+	uint32_t Take(TelemetryRecord * out, uint32_t max);
+	uint32_t GetDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+	TelemetryRing(const TelemetryRing &);
+	TelemetryRing & operator=(const TelemetryRing &);
+
+	const uint32_t capacity;
+	TelemetryRecord * records;
+	// producer and consumer data on cache lines of their own
+	char padding0[64];
+	std::atomic<uint32_t> head;
+	// the producer's last look at the tail, refreshed when it seems full
+	uint32_t cachedTail;
+	std::atomic<uint32_t> dropped;
+	char padding1[64];
+	std::atomic<uint32_t> tail;
+	char padding2[64];
+};
+
+// Numbers from the control loop, written to a binary log and summed up
+// on the console at a fixed interval by a thread of its own, instead of
+// being printed where they are computed.  Log() only copies the values
+// into a ring buffer of the calling thread, well under a microsecond, so
+// it can stay on in the field.
+//
+// TelemetryDecoder turns a log into CSV.
+class Telemetry
+{
+public:
+	// path may be null for the console only, an interval of 0 turns the
+	// console off
+	static bool Start(const char * path, double consoleIntervalMillis);
+	// Writes what is left and ends the drain thread.  No thread may log
+	// while it stops.
+	static void Stop();
+
+	static void Log(uint32_t cycle, TelemetryType type, std::initializer_list<float> values);
+
+	// Since the last Start(), also after Stop()
+	static unsigned long GetRecordCount();
+	static unsigned long GetDroppedCount();
+
+	static const TelemetryTypeInfo & GetTypeInfo(unsigned type);
+};
@@ -0,0 +1,88 @@
+// Renders a binary telemetry log as CSV on stdout.
+//
+//   TelemetryDecoder <log> [type]
+//
+// Without a type, every record becomes a line with its type name and up
+// to TELEMETRY_MAX_VALUES generic value columns.  With one, like "angles"
+// or "loop", only records of that type are written, with named columns.
+#include "Telemetry.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <log> [type]\n", argv[0]);
+		return -1;
+	}
+	FILE * file = fopen(argv[1], "rb");
+	if (!file) {
+		fprintf(stderr, "Error: Unable to open \"%s\".\n", argv[1]);
+		return -1;
+	}
+	TelemetryFileHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "IRET", 4) != 0) {
+		fprintf(stderr, "Error: \"%s\" isn't a telemetry log.\n", argv[1]);
+		return -1;
+	}
+	if (header.recordSize != sizeof(TelemetryRecord)) {
+		fprintf(stderr, "Error: Records of %u bytes, expected %u.\n", header.recordSize, (unsigned)sizeof(TelemetryRecord));
+		return -1;
+	}
+
+	int only = -1;
+	if (argc > 2) {
+		for (int type = 0; type < TELEMETRY_TYPES; ++type) {
+			if (0 == strcmp(argv[2], Telemetry::GetTypeInfo(type).name)) {
+				only = type;
+			}
+		}
+		if (only < 0) {
+			fprintf(stderr, "Error: No records of type \"%s\".\n", argv[2]);
+			return -1;
+		}
+	}
+
+	printf("millis,cycle");
+	if (only < 0) {
+		printf(",type");
+	}
+	for (int i = 0; i < TELEMETRY_MAX_VALUES; ++i) {
+		const char * column = only < 0 ? NULL : Telemetry::GetTypeInfo(only).columns[i];
+		if (only < 0) {
+			printf(",v%d", i);
+		} else if (column) {
+			printf(",%s", column);
+		}
+	}
+	printf("\n");
+
+	TelemetryRecord record;
+	unsigned long count = 0;
+	while (fread(&record, sizeof(record), 1, file) == 1) {
+		if (only >= 0 && record.type != only) {
+			continue;
+		}
+		printf("%0.3f,%u", record.millis, record.cycle);
+		if (only < 0) {
+			printf(",%s", Telemetry::GetTypeInfo(record.type).name);
+		}
+		for (int i = 0; i < record.count && i < TELEMETRY_MAX_VALUES; ++i) {
+			printf(",%g", record.values[i]);
+		}
+		// the same number of fields on every line
+		int columns = TELEMETRY_MAX_VALUES;
+		if (only >= 0) {
+			for (columns = 0; columns < TELEMETRY_MAX_VALUES && Telemetry::GetTypeInfo(only).columns[columns]; ++columns) {
+			}
+		}
+		for (int i = record.count; i < columns; ++i) {
+			printf(",");
+		}
+		printf("\n");
+		++count;
+	}
+	fclose(file);
+	fprintf(stderr, "%lu records\n", count);
+	return 0;
+}
@@ -3,9 +3,14 @@
 #include "OVR_CAPI_GL.h"
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
-#include <thread>
-#include <mutex>
-#include <condition_variable>
+#include "TripleBuffer.h"
+#include "StereoSource.h"
+#include "StereoRectification.h"
+#include "LatencyHistogram.h"
+#include "PoseHistory.h"
+#include "LatencyHarness.h"
+#include "CaptureGraph.h"
+#include "QualityController.h"
 
 using namespace cv;
 using namespace std;
@@ -17,29 +22,218 @@ struct EyeArgs {
 	ovrGLTexture textures;
 };
 
+// A stereo pair waiting for upload.  The cropped pixels of each eye live
+// in a slot of that eye's streaming uploader.
+struct StereoFrame {
+	int uploadSlots[2] = { -1, -1 };
+	FrameFormat formats[2];
+	YuvLayout layouts[2];
+	// head orientation when each image was captured
+	glm::quat orientations[2];
+	double captureTimes[2];
+	double dequeueTimes[2];
+	double decodeTimes[2];
+};
+
+// Stages of the video path, from the camera to the display, whose
+// latencies are tracked for every image
+enum LatencyStage {
+	// driver timestamp to dequeue
+	STAGE_DRIVER,
+	// dequeue to decoded, including the wait for a decode thread
+	STAGE_DECODE,
+	// decoded to upload issued: pairing and waiting for the renderer
+	STAGE_HANDOVER,
+	// upload issued until the GPU has copied the image, to within a frame
+	STAGE_UPLOAD,
+	// upload issued to ovrHmd_EndFrame
+	STAGE_RENDER,
+	// ovrHmd_EndFrame to the predicted scanout of the eye
+	STAGE_SCANOUT,
+	// driver timestamp to predicted scanout
+	STAGE_TOTAL,
+	STAGE_COUNT,
+};
+
+static const char * LATENCY_STAGE_NAMES[STAGE_COUNT] = {
+	"driver", "decode", "handover", "upload", "render", "scanout", "total",
+};
+
+// Lets a camera write its frames directly into the slots of a streaming
+// uploader, i.e. into memory the GPU reads from
+class UploadFrameSink : public FrameSink {
+	gl::StreamingUploaderPtr uploader;
+	size_t stride;
+
+public:
+	UploadFrameSink(gl::StreamingUploaderPtr uploader, size_t stride)
+		: uploader(uploader), stride(stride) {
+	}
+
+	bool acquire(FrameTarget & target) {
+		target.slot = uploader->acquire();
+		if (target.slot < 0) {
+			return false;
+		}
+		target.data = (unsigned char *)uploader->data(target.slot);
+		target.stride = stride;
+		target.size = uploader->getSlotSize();
+		return true;
+	}
+
+	void release(const FrameTarget & target) {
+		uploader->release(target.slot);
+	}
+};
+
+// A camera shown on a quad fixed to the head, e.g. a rear view.  It has
+// its own capture thread, decode threads and upload slots, so it can't
+// hold up the stereo pair.
+struct OverlayStream {
+	CaptureNode node;
+	gl::StreamingUploaderPtr uploader;
+	unique_ptr<UploadFrameSink> sink;
+	// destroyed before the uploader and sink they write to, the camera
+	// before the pool it submits to
+	unique_ptr<DecodePool> pool;
+	unique_ptr<CameraCapture> camera;
+	// upload slot of the newest frame, -1 if none
+	TripleBuffer<int> frames;
+	gl::Texture2dPtr texture;
+	gl::GeometryPtr quad;
+	bool hasImage = false;
+	std::atomic<unsigned long> deliveredCount{ 0 };
+};
+
 class HelloRift : public RiftGlfwApp {
 protected:
-#define CAM_IMAGE_WIDTH 1280.f
-#define CAM_IMAGE_HEIGHT 720.f
-#define RENDER_IMAGE_WIDTH 900.f
-#define RENDER_IMAGE_HEIGHT 720.f
+// Path to a CaptureGraph file describing the cameras.  Without one, the
+// stereo pair is set up from the CAM_ defaults below and there are no
+// overlays.
+#define CAPTURE_GRAPH_ENV "IRE_CAPTURE_GRAPH"
+#define CAM_IMAGE_WIDTH 1280
+#define CAM_IMAGE_HEIGHT 720
+// The displayed part of the camera image
+#define CAM_IMAGE_CROP_X 189
+#define CAM_IMAGE_CROP_WIDTH 900
+// Frames per eye that can be in decode, pairing, hand-over or upload at once
+#define CAM_UPLOAD_SLOTS 8
+// Frames per overlay that can be in decode, hand-over or upload at once
+#define OVERLAY_UPLOAD_SLOTS 4
+#define CAM_LEFT_DEVICE 701
+#define CAM_RIGHT_DEVICE 700
+// Maximum capture time difference of the two images of a stereo pair
+#define CAM_MAX_SKEW_SECONDS 0.015
+// Decode the camera frames to YUV planes, which are converted to RGB by
+// the shader.  Cameras that can't deliver them fall back to BGR.
+// FRAME_BGRA decodes to RGB on the CPU, but uploads faster than BGR.
+#define CAM_FRAME_FORMAT FRAME_YUV
+// Threads decoding the frames of both cameras, and the compressed frames
+// that may wait for them
+#define CAM_DECODE_THREADS 3
+#define CAM_DECODE_QUEUE 6
+// Driver buffers per camera.  Grabs always skip to the newest frame, so
+// more buffers only keep the camera from dropping frames while we're busy.
+#define CAM_DRIVER_BUFFERS 3
+// Selects where the stereo pairs come from, the cameras by default:
+//   live[:LEFT,RIGHT]              cameras with the given device indices
+//   pattern[:WIDTHxHEIGHT@FPS]     generated test pattern
+//   file:LEFT,RIGHT                recorded videos or image sequences
+//   session:PATH[,SECONDS]         a recorded session, see SessionRecorder,
+//                                  from the given time on
+// A "-flat" suffix on pattern, file or session produces pairs as fast as
+// they are consumed instead of at their frame rate, for benchmarks.
+#define STEREO_SOURCE_ENV "IRE_STEREO_SOURCE"
+// Path to record the compressed camera frames and head poses to, see
+// SessionRecorder.  Only the cameras can be recorded.
+#define RECORD_SESSION_ENV "IRE_RECORD_SESSION"
+// Path to the stereo calibration (see StereoRectification) the images are
+// undistorted and rectified with
+#define CAM_CALIBRATION_ENV "IRE_STEREO_CALIBRATION"
+// Texture unit of the undistortion lookup, after the YUV planes
+#define REMAP_TEXTURE_UNIT 3
+#define PATTERN_FPS 60.0
+// Seconds to measure the latency from capture to render for, with the
+// images flashing as LatencyHarness describes, before printing the result
+// and exiting.  The pattern source flashes by itself, other sources have
+// to play a recording of it.  Reprojection is turned off meanwhile.
+#define LATENCY_HARNESS_ENV "IRE_LATENCY_HARNESS"
+#define LATENCY_FLASH_PERIOD 0.5
+// Pick up the camera images just before the eyes are rendered rather than
+// at the start of the frame.  The wait leaves the measured render time of
+// both eyes plus this margin before the timewarp point.
+#define LATE_LATCH_MARGIN_SECONDS 0.002
+// Seconds the eyes are assumed to take before the first measurement
+#define LATE_LATCH_INITIAL_BUDGET 0.004
+// Age of the camera images at scanout to hold by decoding less when the
+// machine can't keep up with the cameras
+#define TARGET_FRAME_AGE 0.05
 #define M_PI 3.14159265358979323846
 
 	bool				terminateApp = false;
 	gl::ProgramPtr		texturedPtr;
+	gl::ProgramPtr		texturedYuvPtr;
+	gl::ProgramPtr		texturedRemapPtr;
 	gl::GeometryPtr     quadGeom;
+	CaptureGraph		captureGraph;
+	vector<unique_ptr<OverlayStream>> overlays;
 	gl::Texture2dPtr	imageTextures[2];
+	// Y, Cb and Cr planes of YUV frames
+	gl::Texture2dRedPtr	yuvTextures[2][3];
+	// what the textures of each eye currently hold
+	FrameFormat			imageFormats[2];
+	YuvLayout			imageLayouts[2];
+	glm::quat			imageOrientations[2];
+	// head orientations recorded every frame, to look up those at capture
+	PoseHistory			poseHistory;
+	// turn the images by the head rotation since they were captured
+	bool				reprojectImages = true;
+	// where to sample the images to undistort and rectify them, if the
+	// cameras are calibrated
+	gl::Texture2dRg32fPtr remapTextures[2];
+	bool				remapImages = false;
+	gl::StreamingUploaderPtr imageUploaders[2];
+	unique_ptr<UploadFrameSink> imageSinks[2];
 	EyeArgs				perEyeArgs[2];
-	IplImage			*perEyeWriteImage[2];
-	IplImage			*perEyeReadImage[2];
-	mutex				camMutex;
-	condition_variable	camFinishCondition;
-	volatile bool		camFinish;
-	condition_variable	drawFinishCondition;
-	volatile bool		drawFinish;
+	TripleBuffer<StereoFrame> stereoFrames;
+	unique_ptr<SessionRecorder> recorder;
+	unique_ptr<StereoSource> stereoSource;
+	int					pairCount = 0;
+	long				pairCountStart = 0;
+	// pairs the renderer never picked up, because a newer one replaced them
+	std::atomic<unsigned long> unshownPairs{ 0 };
+	// wait for the newest pair until shortly before the timewarp point
+	bool				lateLatch = true;
+	// smoothed time from latching a pair to submitting both eyes
+	double				latchBudget = LATE_LATCH_INITIAL_BUDGET;
+	// capture times of what the textures of each eye currently hold
+	double				imageCaptureTimes[2] = { 0, 0 };
+	// how old the images are when the display shows them
+	double				scanoutAgeSum = 0;
+	double				scanoutAgeMax = 0;
+	int					scanoutAgeCount = 0;
+	int					renderedFrames = 0;
+	int					repeatedFrames = 0;
+	long				scanoutStatsStart = 0;
+	// steps the quality of the live cameras to hold the frame age, if
+	// the source supports it
+	unique_ptr<QualityController> qualityController;
+	bool				adaptiveQuality = true;
+	// latencies since the start, in seconds
+	LatencyHistogram	latencies[STAGE_COUNT];
+	// passes once the GPU has copied the last pair out of its upload slots
+	gl::Fence			uploadFence;
+	double				uploadIssuedTime = 0;
+	unique_ptr<LatencyHarness> latencyHarness;
+	double				harnessEndTime = 0;
 
 public:
 	~HelloRift() {
+		stereoSource.reset();
+		overlays.clear();
+		dumpLatencies();
+		// after the source, which records to it
+		recorder.reset();
 		ovrHmd_Destroy(hmd);
 	}
 
@@ -49,7 +243,20 @@ public:
 		typedef std::shared_ptr < gl::Texture<GL_TEXTURE_2D> >
 			TexturePtr;
 		texturedPtr = GlUtils::getProgram(Resource::SHADERS_TEXTURED_VS, Resource::SHADERS_TEXTURED_FS);
-		quadGeom = GlUtils::getQuadGeometry(RENDER_IMAGE_WIDTH / RENDER_IMAGE_HEIGHT, 3.f);
+		texturedYuvPtr = GlUtils::getProgram(Resource::SHADERS_TEXTURED_VS, Resource::SHADERS_TEXTUREDYUV_FS);
+		texturedYuvPtr->use();
+		texturedYuvPtr->setUniform("LumaSampler", 0);
+		texturedYuvPtr->setUniform("CbSampler", 1);
+		texturedYuvPtr->setUniform("CrSampler", 2);
+		texturedYuvPtr->setUniform("RemapSampler", REMAP_TEXTURE_UNIT);
+		texturedRemapPtr = GlUtils::getProgram(Resource::SHADERS_TEXTURED_VS, Resource::SHADERS_TEXTUREDREMAP_FS);
+		texturedRemapPtr->use();
+		texturedRemapPtr->setUniform("sampler", 0);
+		texturedRemapPtr->setUniform("RemapSampler", REMAP_TEXTURE_UNIT);
+		gl::Program::clear();
+		loadCaptureGraph();
+		const Rect crop = imageCrop();
+		quadGeom = GlUtils::getQuadGeometry((float)crop.width / crop.height, 3.f);
 		GlfwApp::initGl();
 		ovrFovPort eyeFovPorts[2];
 
@@ -67,10 +274,32 @@ public:
 			imageTextures[eye]->bind();
 			imageTextures[eye]->parameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 			imageTextures[eye]->parameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, RENDER_IMAGE_WIDTH, RENDER_IMAGE_HEIGHT, 0, GL_BGR, GL_UNSIGNED_BYTE, 0x0000);
+			if (FRAME_BGRA != eyeNode().format) {
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, crop.width, crop.height, 0, GL_BGR, GL_UNSIGNED_BYTE, 0x0000);
+			} else if (Texture::hasStorage()) {
+				imageTextures[eye]->storage2d(glm::uvec2(crop.width, crop.height));
+			} else {
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, crop.width, crop.height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0x0000);
+			}
+			imageFormats[eye] = FRAME_BGR;
+
+			// the planes are allocated once the first YUV frame tells us
+			// about the chroma subsampling
+			for (int plane = 0; plane < 3; ++plane) {
+				gl::Texture2dRedPtr & texture = yuvTextures[eye][plane];
+				texture = gl::Texture2dRedPtr(new gl::Texture2dRed());
+				texture->bind();
+				texture->parameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+				texture->parameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+				texture->parameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+				texture->parameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			}
+			gl::Texture2d::unbind();
 
-			perEyeReadImage[eye] = cvCreateImage(cvSize(CAM_IMAGE_WIDTH, CAM_IMAGE_HEIGHT), 8, 3);
-			perEyeWriteImage[eye] = cvCreateImage(cvSize(CAM_IMAGE_WIDTH, CAM_IMAGE_HEIGHT), 8, 3);
+			// YUV planes take no more than packed BGR
+			size_t stride = packedStride(eyeNode().format, crop.width);
+			imageUploaders[eye] = gl::StreamingUploaderPtr(new gl::StreamingUploader(stride * crop.height, CAM_UPLOAD_SLOTS));
+			imageSinks[eye] = unique_ptr<UploadFrameSink>(new UploadFrameSink(imageUploaders[eye], stride));
 
 			eyeArgs.framebuffer.init(Rift::fromOvr(eyeTextureHeader.TextureSize));
 			eyeArgs.textures.OGL.TexId = eyeArgs.framebuffer.color->texture;
@@ -103,73 +332,484 @@ public:
 				ovrMatrix4f_Projection(eyeFovPorts[eye], 0.01, 100, true));
 		});
 
-		thread cameraThread;
-		cameraThread = thread(&HelloRift::updateCameraImages, this);
+		initRemapTextures();
+		startStereoSource();
+		startOverlays();
+	}
 
-		cameraThread.detach();
+	void loadCaptureGraph() {
+		const char * graphPath = getenv(CAPTURE_GRAPH_ENV);
+		if (graphPath && captureGraph.load(graphPath)) {
+			return;
+		}
+		if (graphPath) {
+			SAY_ERR("Using the default cameras");
+		}
+		captureGraph = CaptureGraph();
+		captureGraph.setMaxSkewSeconds(CAM_MAX_SKEW_SECONDS);
+		for_each_eye([&](ovrEyeType eye){
+			CaptureNode node;
+			node.name = ovrEye_Left == eye ? "left" : "right";
+			node.device = ovrEye_Left == eye ? CAM_LEFT_DEVICE : CAM_RIGHT_DEVICE;
+			node.target = ovrEye_Left == eye ? CaptureNode::LEFT_EYE : CaptureNode::RIGHT_EYE;
+			node.size = glm::uvec2(CAM_IMAGE_WIDTH, CAM_IMAGE_HEIGHT);
+			node.crop = Rect(CAM_IMAGE_CROP_X, 0, CAM_IMAGE_CROP_WIDTH, CAM_IMAGE_HEIGHT);
+			node.format = CAM_FRAME_FORMAT;
+			node.decodeThreads = CAM_DECODE_THREADS;
+			node.decodeQueue = CAM_DECODE_QUEUE;
+			node.driverBuffers = CAM_DRIVER_BUFFERS;
+			captureGraph.add(node);
+		});
 	}
 
-	void updateCameraImages() {
-		CvCapture* camLeft = cvCaptureFromCAM(701);
-		cvSetCaptureProperty(camLeft, CV_CAP_PROP_FOURCC, CV_FOURCC('M', 'J', 'P', 'G'));
-		cvSetCaptureProperty(camLeft, CV_CAP_PROP_FRAME_WIDTH, CAM_IMAGE_WIDTH);
-		cvSetCaptureProperty(camLeft, CV_CAP_PROP_FRAME_HEIGHT, CAM_IMAGE_HEIGHT);
-
-		CvCapture* camRight = cvCaptureFromCAM(700);
-		cvSetCaptureProperty(camRight, CV_CAP_PROP_FOURCC, CV_FOURCC('M', 'J', 'P', 'G'));
-		cvSetCaptureProperty(camRight, CV_CAP_PROP_FRAME_WIDTH, CAM_IMAGE_WIDTH);
-		cvSetCaptureProperty(camRight, CV_CAP_PROP_FRAME_HEIGHT, CAM_IMAGE_HEIGHT);
-
-		IplImage *imageLeft;
-		IplImage *imageRight;
-		float         fps = 0.f;
-		int framecount = 0;
-		long start = Platform::elapsedMillis();
-
-		while (!terminateApp) {
-			// wait on draw thread
-				{
-					unique_lock<mutex> lck(camMutex);
-					while (!drawFinish && !terminateApp) { drawFinishCondition.wait(lck); }
+	// The camera of the left eye, the right one has the same size and crop
+	const CaptureNode & eyeNode(ovrEyeType eye = ovrEye_Left) const {
+		return *captureGraph.findEye(eye);
+	}
+
+	// The part of the camera images that is displayed
+	Rect imageCrop() const {
+		return eyeNode().getCrop();
+	}
+
+	// Builds the undistortion and rectification lookups once, the shaders
+	// apply them while drawing the images
+	void initRemapTextures() {
+		const char * calibrationPath = getenv(CAM_CALIBRATION_ENV);
+		if (!calibrationPath) {
+			return;
+		}
+		StereoRectification rectification;
+		Mat lookup[2];
+		if (!rectification.load(calibrationPath) ||
+			!rectification.buildLookup(eyeNode().size, imageCrop(), lookup)) {
+			SAY_ERR("Showing the camera images without undistortion");
+			return;
+		}
+		for_each_eye([&](ovrEyeType eye){
+			gl::Texture2dRg32fPtr & texture = remapTextures[eye];
+			texture = gl::Texture2dRg32fPtr(new gl::Texture2dRg32f());
+			texture->bind();
+			texture->parameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			texture->parameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			texture->parameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			texture->parameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			texture->image2d(glm::uvec2(lookup[eye].cols, lookup[eye].rows), lookup[eye].data, 0, GL_RG, GL_FLOAT);
+		});
+		gl::Texture2d::unbind();
+		remapImages = true;
+	}
+
+	StereoSource * createStereoSource(const std::string & spec) {
+		// only the displayed part of each image is ever decoded into the
+		// upload slots
+		const Rect crop = imageCrop();
+
+		std::string kind = spec.substr(0, spec.find(':'));
+		std::string args = spec.find(':') == std::string::npos ? "" : spec.substr(spec.find(':') + 1);
+		bool flat = kind.size() > 5 && kind.substr(kind.size() - 5) == "-flat";
+		if (flat) {
+			kind = kind.substr(0, kind.size() - 5);
+		}
+
+		if (kind == "pattern") {
+			unsigned int width = eyeNode().size.x, height = eyeNode().size.y;
+			double fps = PATTERN_FPS;
+			if (!args.empty()) {
+				sscanf(args.c_str(), "%ux%u@%lf", &width, &height, &fps);
+			}
+			PatternStereoSource * source = new PatternStereoSource(glm::uvec2(width, height), fps, crop);
+			source->setRealtime(!flat);
+			source->setFormat(eyeNode().format);
+			if (latencyHarness) {
+				source->setFlashPeriod(LATENCY_FLASH_PERIOD);
+			}
+			return source;
+		}
+
+		if (kind == "file") {
+			size_t comma = args.find(',');
+			if (comma == std::string::npos) {
+				SAY_ERR("Expected " STEREO_SOURCE_ENV "=file:LEFT,RIGHT");
+				return nullptr;
+			}
+			FileStereoSource * source = new FileStereoSource(args.substr(0, comma), args.substr(comma + 1), crop);
+			if (!source->isOpen()) {
+				delete source;
+				return nullptr;
+			}
+			source->setRealtime(!flat);
+			source->setFormat(eyeNode().format);
+			return source;
+		}
+
+		if (kind == "session") {
+			size_t comma = args.rfind(',');
+			double startTime = 0;
+			if (comma != std::string::npos && 1 == sscanf(args.c_str() + comma + 1, "%lf", &startTime)) {
+				args = args.substr(0, comma);
+			}
+			SessionStereoSource * source = new SessionStereoSource(args, crop, CAM_MAX_SKEW_SECONDS);
+			if (!source->isOpen()) {
+				delete source;
+				return nullptr;
+			}
+			source->setStartTime(startTime);
+			source->setRealtime(!flat);
+			source->setFormat(eyeNode().format);
+			return source;
+		}
+
+		if (kind != "live") {
+			SAY_ERR("Unknown stereo source %s, using the cameras", spec.c_str());
+		}
+		// the eyes share the decode threads of the left camera's node
+		const CaptureNode & node = eyeNode();
+		LiveStereoSource::Config config;
+		for_each_eye([&](ovrEyeType eye){
+			config.devices[eye] = eyeNode(eye).device;
+			config.captureCpus[eye] = eyeNode(eye).captureCpus;
+			const vector<int> & cpus = eyeNode(eye).decodeCpus;
+			for (size_t i = 0; i < cpus.size(); ++i) {
+				if (std::find(config.decodeCpus.begin(), config.decodeCpus.end(), cpus[i]) == config.decodeCpus.end()) {
+					config.decodeCpus.push_back(cpus[i]);
 				}
+			}
+		});
+		if (!args.empty()) {
+			sscanf(args.c_str(), "%d,%d", &config.devices[ovrEye_Left], &config.devices[ovrEye_Right]);
+		}
+		config.size = node.size;
+		config.crop = crop;
+		config.format = node.format;
+		config.maxSkewSeconds = captureGraph.getMaxSkewSeconds();
+		config.decodeThreads = node.decodeThreads;
+		config.decodeQueue = node.decodeQueue;
+		config.driverBuffers = node.driverBuffers;
+		config.decodeBudgetSeconds = node.budgetSeconds;
+		LiveStereoSource * source = new LiveStereoSource(config);
+		source->setRecorder(recorder.get());
+		return source;
+	}
+
+	void startStereoSource() {
+		const char * recordPath = getenv(RECORD_SESSION_ENV);
+		if (recordPath) {
+			recorder = unique_ptr<SessionRecorder>(new SessionRecorder(recordPath));
+			if (!recorder->isOpen()) {
+				recorder.reset();
+			}
+		}
 
-			imageLeft = cvQueryFrame(camLeft);
-			if (imageLeft) {
-				memcpy(perEyeWriteImage[0]->imageData, imageLeft->imageData, CAM_IMAGE_HEIGHT * CAM_IMAGE_WIDTH * 3);
+		const char * harnessSeconds = getenv(LATENCY_HARNESS_ENV);
+		if (harnessSeconds) {
+			latencyHarness = unique_ptr<LatencyHarness>(new LatencyHarness());
+			harnessEndTime = ovr_GetTimeInSeconds() + atof(harnessSeconds);
+			reprojectImages = false;
+			SAY("Measuring the latency for %s seconds", harnessSeconds);
+		}
+
+		const char * spec = getenv(STEREO_SOURCE_ENV);
+		stereoSource = unique_ptr<StereoSource>(createStereoSource(spec ? spec : "live"));
+		if (!stereoSource) {
+			return;
+		}
+
+		if (stereoSource->setQuality(StreamQuality())) {
+			qualityController = unique_ptr<QualityController>(
+				new QualityController(TARGET_FRAME_AGE, FRAME_YUV == eyeNode().format));
+		}
+
+		pairCountStart = Platform::elapsedMillis();
+		for_each_eye([&](ovrEyeType eye){
+			stereoSource->setSink(eye, imageSinks[eye].get());
+		});
+		stereoSource->start([&](CapturedFrame & left, CapturedFrame & right){
+			updateCameraImages(left, right);
+		});
+	}
+
+	void startOverlays() {
+		const vector<CaptureNode> & nodes = captureGraph.getNodes();
+		for (size_t i = 0; i < nodes.size(); ++i) {
+			if (CaptureNode::OVERLAY == nodes[i].target) {
+				startOverlay(nodes[i]);
+			}
+		}
+	}
+
+	void startOverlay(const CaptureNode & node) {
+		const Rect crop = node.getCrop();
+		OverlayStream * overlay = new OverlayStream();
+		overlays.push_back(unique_ptr<OverlayStream>(overlay));
+		overlay->node = node;
+		if (FRAME_BGR != node.format) {
+			SAY_ERR("Overlay %s can only show BGR frames", node.name.c_str());
+			overlay->node.format = FRAME_BGR;
+		}
+		overlay->uploader = gl::StreamingUploaderPtr(new gl::StreamingUploader((size_t)crop.area() * 3, OVERLAY_UPLOAD_SLOTS));
+		overlay->sink = unique_ptr<UploadFrameSink>(new UploadFrameSink(overlay->uploader, (size_t)crop.width * 3));
+		overlay->frames.forEachSlot([](int & slot){
+			slot = -1;
+		});
+
+		overlay->texture = gl::Texture2dPtr(new gl::Texture2d());
+		overlay->texture->bind();
+		overlay->texture->parameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		overlay->texture->parameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, crop.width, crop.height, 0, GL_BGR, GL_UNSIGNED_BYTE, 0x0000);
+		gl::Texture2d::unbind();
+		glm::vec2 extent(node.width / 2, node.width * crop.height / crop.width / 2);
+		overlay->quad = GlUtils::getQuadGeometry(-extent, extent);
+
+		overlay->pool = unique_ptr<DecodePool>(new DecodePool(node.decodeThreads, node.decodeQueue));
+		overlay->pool->setBudget(node.budgetSeconds);
+		if (!node.decodeCpus.empty() && !overlay->pool->setAffinity(node.decodeCpus)) {
+			SAY_ERR("Unable to pin the decode threads of overlay %s", node.name.c_str());
+		}
+		CameraCapture * camera = new CameraCapture(node.device, node.size, crop);
+		overlay->camera = unique_ptr<CameraCapture>(camera);
+		if (!camera->isOpen()) {
+			SAY_ERR("Unable to open overlay %s", node.name.c_str());
+			return;
+		}
+		camera->setSink(overlay->sink.get());
+		camera->setFormat(FRAME_BGR);
+		camera->setDecodePool(overlay->pool.get());
+		camera->setLatestFrameOnly(true);
+		camera->setBufferCount(node.driverBuffers);
+		camera->setAffinity(node.captureCpus);
+		camera->start([=](CapturedFrame & frame){
+			overlay->frames.writeSlot() = frame.target.slot;
+			// like the stereo pairs, a frame the renderer missed is
+			// given back
+			if (overlay->frames.publish() && overlay->frames.writeSlot() >= 0) {
+				overlay->uploader->release(overlay->frames.writeSlot());
+				overlay->frames.writeSlot() = -1;
 			}
-			else{
-				SAY("Didn't get image of left cam");
+			++overlay->deliveredCount;
+		});
+	}
+
+	void uploadOverlays() {
+		for (size_t i = 0; i < overlays.size(); ++i) {
+			OverlayStream & overlay = *overlays[i];
+			overlay.uploader->recycle();
+			if (!overlay.frames.fetch() || overlay.frames.readSlot() < 0) {
+				continue;
 			}
+			const Rect crop = overlay.node.getCrop();
+			int slot = overlay.frames.readSlot();
+			overlay.uploader->bind(slot);
+			overlay.texture->bind();
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, crop.width, crop.height, GL_BGR, GL_UNSIGNED_BYTE, gl::StreamingUploader::offset(0));
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			gl::StreamingUploader::unbind();
+			overlay.uploader->retire(slot);
+			overlay.frames.readSlot() = -1;
+			overlay.hasImage = true;
+		}
+		gl::Texture2d::unbind();
+	}
 
-			imageRight = cvQueryFrame(camRight);
-			if (imageRight) {
-				memcpy(perEyeWriteImage[1]->imageData, imageRight->imageData, CAM_IMAGE_HEIGHT * CAM_IMAGE_WIDTH * 3);
+	void renderOverlays() {
+		gl::MatrixStack & mv = gl::Stacks::modelview();
+		for (size_t i = 0; i < overlays.size(); ++i) {
+			OverlayStream & overlay = *overlays[i];
+			if (!overlay.hasImage) {
+				continue;
 			}
-			else {
-				SAY("Didn't get image of right cam");
+			mv.withPush([&]{
+				mv.translate(overlay.node.position);
+				mv.rotate(overlay.node.rotation * DEGREES_TO_RADIANS, glm::vec3(0, 0, 1));
+				overlay.texture->bind();
+				GlUtils::renderGeometry(overlay.quad, texturedPtr);
+			});
+		}
+		gl::Texture2d::unbind();
+	}
+
+	std::string describeOverlayStats() {
+		std::string result;
+		for (size_t i = 0; i < overlays.size(); ++i) {
+			OverlayStream & overlay = *overlays[i];
+			DecodePool::Stats stats = overlay.pool->getStats(true);
+			result += Platform::format("Overlay %s: %lu frames, decode %0.2f ms mean, %0.2f ms max, "
+				"over budget %lu, overflowed %lu, stale %lu, no upload slot %lu\n",
+				overlay.node.name.c_str(), overlay.deliveredCount.exchange(0),
+				stats.meanDecodeMillis, stats.maxDecodeMillis, stats.overBudget,
+				stats.overflowed, stats.stale, stats.skipped);
+		}
+		return result;
+	}
+
+	// Called by the stereo source on one of its threads, e.g. whenever both
+	// cameras delivered a frame within the skew window
+	void updateCameraImages(CapturedFrame & left, CapturedFrame & right) {
+		if (terminateApp) {
+			imageSinks[ovrEye_Left]->release(left.target);
+			imageSinks[ovrEye_Right]->release(right.target);
+			return;
+		}
+
+		if (latencyHarness) {
+			latencyHarness->captured(LatencyHarness::sampleCode(left), left.captureTime);
+		}
+
+		// the pixels are already in the upload slots, only hand them on
+		StereoFrame & frame = stereoFrames.writeSlot();
+		frame.uploadSlots[ovrEye_Left] = left.target.slot;
+		frame.uploadSlots[ovrEye_Right] = right.target.slot;
+		frame.formats[ovrEye_Left] = left.format;
+		frame.formats[ovrEye_Right] = right.format;
+		frame.layouts[ovrEye_Left] = left.yuv;
+		frame.layouts[ovrEye_Right] = right.yuv;
+		frame.orientations[ovrEye_Left] = headOrientationAt(left.captureTime);
+		frame.orientations[ovrEye_Right] = headOrientationAt(right.captureTime);
+		frame.captureTimes[ovrEye_Left] = left.captureTime;
+		frame.captureTimes[ovrEye_Right] = right.captureTime;
+		frame.dequeueTimes[ovrEye_Left] = left.dequeueTime;
+		frame.dequeueTimes[ovrEye_Right] = right.dequeueTime;
+		frame.decodeTimes[ovrEye_Left] = left.decodeTime;
+		frame.decodeTimes[ovrEye_Right] = right.decodeTime;
+
+		// hand the pair to the renderer, it never waits on us.  If the
+		// renderer didn't pick up the previous pair, we get its slots back.
+		if (stereoFrames.publish()) {
+			releaseUploadSlots(stereoFrames.writeSlot());
+			++unshownPairs;
+		}
+
+		long now = Platform::elapsedMillis();
+		++pairCount;
+		if ((now - pairCountStart) >= 2000) {
+			float elapsed = (now - pairCountStart) / 1000.f;
+			float fps = (float)pairCount / elapsed;
+			SAY("FPS cams: %0.2f (%s)\n", fps, stereoSource->describeStats().c_str());
+			if (recorder) {
+				SAY("Recorded %0.1f MB, dropped %lu records\n",
+					recorder->getWrittenBytes() / (1024.0 * 1024.0), recorder->getDroppedCount());
 			}
+			pairCountStart = now;
+			pairCount = 0;
+		}
+	}
+
+	// The cameras follow the head, so this is where they were looking.
+	// Capture times are in the past, between the samples draw() keeps.
+	// Only outside of those, the SDK extrapolates from its newest sample.
+	glm::quat headOrientationAt(double time) {
+		glm::quat orientation;
+		if (poseHistory.orientationAt(time, orientation)) {
+			return orientation;
+		}
+		ovrSensorState sensorState = ovrHmd_GetSensorState(hmd, time);
+		return Rift::fromOvr(sensorState.Predicted.Pose.Orientation);
+	}
 
-			long now = Platform::elapsedMillis();
-			++framecount;
-			if ((now - start) >= 2000) {
-				float elapsed = (now - start) / 1000.f;
-				fps = (float)framecount / elapsed;
-				SAY("FPS cams: %0.2f\n", fps);
-				start = now;
-				framecount = 0;
+	void releaseUploadSlots(StereoFrame & frame) {
+		for_each_eye([&](ovrEyeType eye){
+			if (frame.uploadSlots[eye] >= 0) {
+				imageUploaders[eye]->release(frame.uploadSlots[eye]);
+				frame.uploadSlots[eye] = -1;
 			}
+		});
+	}
 
-			{
-				unique_lock<mutex> lck(camMutex);
-				drawFinish = false;
-				camFinish = true;
-				camFinishCondition.notify_all();
+	// Issues the copies of a new stereo pair from its upload slots into the
+	// eye textures.  The GPU does the transfer asynchronously.
+	void uploadCameraImages(const StereoFrame & frame) {
+		uploadIssuedTime = ovr_GetTimeInSeconds();
+		for_each_eye([&](ovrEyeType eye){
+			latencies[STAGE_DRIVER].add(frame.dequeueTimes[eye] - frame.captureTimes[eye]);
+			latencies[STAGE_DECODE].add(frame.decodeTimes[eye] - frame.dequeueTimes[eye]);
+			latencies[STAGE_HANDOVER].add(uploadIssuedTime - frame.decodeTimes[eye]);
+
+			int slot = frame.uploadSlots[eye];
+			imageUploaders[eye]->bind(slot);
+			if (FRAME_YUV == frame.formats[eye]) {
+				uploadYuvPlanes(eye, frame.layouts[eye]);
+			} else if (FRAME_BGRA == frame.formats[eye]) {
+				// whole words in aligned rows, which the GPU can copy
+				// straight out of the slot
+				const Rect crop = imageCrop();
+				imageTextures[eye]->bind();
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(packedStride(FRAME_BGRA, crop.width) / 4));
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, crop.width, crop.height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, gl::StreamingUploader::offset(0));
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			} else {
+				const Rect crop = imageCrop();
+				imageTextures[eye]->bind();
+				// rows are packed, whatever the width of the crop
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, crop.width, crop.height, GL_BGR, GL_UNSIGNED_BYTE, gl::StreamingUploader::offset(0));
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 			}
+			gl::StreamingUploader::unbind();
+			imageUploaders[eye]->retire(slot);
+			imageFormats[eye] = frame.formats[eye];
+			imageOrientations[eye] = frame.orientations[eye];
+			imageCaptureTimes[eye] = frame.captureTimes[eye];
+		});
+		gl::Texture2d::unbind();
+		uploadFence.set();
+	}
+
+	// Only polled, so the upload latency is accurate to the time between
+	// two polls
+	void checkUploadFence() {
+		if (uploadFence.isSet() && uploadFence.signaled()) {
+			latencies[STAGE_UPLOAD].add(ovr_GetTimeInSeconds() - uploadIssuedTime);
+			uploadFence.clear();
+		}
+	}
+
+	// Reads back the middle of the rendered eye image, which waits for the
+	// GPU to finish it
+	void checkLatencyHarness(const EyeArgs & eyeArgs) {
+		ovrSizei size = eyeArgs.textures.OGL.Header.TextureSize;
+		unsigned char pixel[3];
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(size.w / 2, size.h / 2, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, pixel);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		double now = ovr_GetTimeInSeconds();
+		latencyHarness->rendered(LatencyHarness::codeOf((pixel[0] + pixel[1] + pixel[2]) / 3), now);
 
+		if (now > harnessEndTime && !glfwWindowShouldClose(window)) {
+			SAY("Latency harness: %s", latencyHarness->describe().c_str());
+			glfwSetWindowShouldClose(window, 1);
 		}
+	}
+
+	void dumpLatencies() {
+		SAY("Latencies in ms per eye image:");
+		for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+			SAY("  %-9s %s", LATENCY_STAGE_NAMES[stage], latencies[stage].describe().c_str());
+		}
+	}
+
+	// Copies the Y, Cb and Cr planes out of the bound upload slot, one byte
+	// per texel.  The colour conversion happens in the shader.
+	void uploadYuvPlanes(ovrEyeType eye, const YuvLayout & layout) {
+		YuvLayout & current = imageLayouts[eye];
+		bool resize = FRAME_YUV != imageFormats[eye] ||
+			current.lumaSize != layout.lumaSize ||
+			current.chromaSize != layout.chromaSize;
+		current = layout;
 
-		cvReleaseCapture(&camLeft);
-		cvReleaseCapture(&camRight);
+		// chroma rows have odd widths when the crop isn't aligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int plane = 0; plane < 3; ++plane) {
+			glm::uvec2 size = (0 == plane) ? layout.lumaSize : layout.chromaSize;
+			yuvTextures[eye][plane]->bind();
+			if (resize) {
+				yuvTextures[eye][plane]->image2d(size, nullptr, 0, GL_RED);
+			}
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size.x, size.y, GL_RED, GL_UNSIGNED_BYTE,
+				gl::StreamingUploader::offset(layout.planeOffset(plane)));
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 	}
 
 
@@ -179,41 +819,42 @@ public:
 		gl::Stacks::modelview().top() = glm::lookAt(EYE, LOOKAT, GlUtils::UP);
 	}
 
+	// Frames are paced by the display: the buffer swap waits for vsync, and
+	// the SDK predicts when this frame will be scanned out.  Rendering the
+	// video is cheap, so most of the frame would be spent waiting for the
+	// swap.  Waiting before picking up the images instead lets a newer
+	// pair arrive and shortens the time from capture to photons.
 	void draw() {
 		static int frameIndex = 0;
-		ovrHmd_BeginFrame(hmd, frameIndex++);
-		short textureSwitch = 0;// frameIndex % 2;
-
-		// wait for camera thread
-		{
-			unique_lock<mutex> lck(camMutex);
-
-			while (!camFinish){
-				camFinishCondition.wait(lck);
-			}
+		ovrFrameTiming timing = ovrHmd_BeginFrame(hmd, frameIndex++);
+		ovrSensorState sensorState = ovrHmd_GetSensorState(hmd, ovr_GetTimeInSeconds());
+		poseHistory.add(sensorState.Recorded.TimeInSeconds, Rift::fromOvr(sensorState.Recorded.Pose.Orientation));
+		if (recorder) {
+			recorder->addPose(sensorState.Recorded.TimeInSeconds, sensorState.Recorded);
 		}
+		short textureSwitch = 0;// frameIndex % 2;
 
-		// swap image pointers
-		for (int i = 0; i < 2; ++i)
-		{
-			IplImage* tempImage = perEyeReadImage[i];
-			perEyeReadImage[i] = perEyeWriteImage[i];
-			perEyeWriteImage[i] = tempImage;
+		// pick up the newest stereo pair, if the cameras delivered one since
+		// the last frame.  Otherwise keep showing the current textures.
+		for_each_eye([&](ovrEyeType eye){
+			imageUploaders[eye]->recycle();
+		});
+		checkUploadFence();
+		if (lateLatch && !terminateApp) {
+			ovr_WaitTillTime(timing.TimewarpPointSeconds - latchBudget - LATE_LATCH_MARGIN_SECONDS);
 		}
-
-		// notify camera thread to resume
-		{
-			unique_lock<mutex> lck(camMutex);
-			camFinish = false;
-			drawFinish = true;
-			drawFinishCondition.notify_all();
+		double latchTime = ovr_GetTimeInSeconds();
+		bool newPair = stereoFrames.fetch();
+		if (newPair) {
+			uploadCameraImages(stereoFrames.readSlot());
 		}
+		uploadOverlays();
 
 		for (int i = 0; i < 2; ++i)
 		{
 			ovrEyeType eye = hmdDesc.EyeRenderOrder[i];
 
-			if (perEyeReadImage[eye] && !terminateApp) {
+			if (!terminateApp) {
 				EyeArgs & eyeArgs = perEyeArgs[eye];
 				gl::Stacks::projection().top() = eyeArgs.projection;
 				gl::MatrixStack & mv = gl::Stacks::modelview();
@@ -222,6 +863,13 @@ public:
 				ovrPosef renderPose = ovrHmd_BeginEyeRender(hmd, eye);
 				mv.withPush([&]{
 					glClear(GL_DEPTH_BUFFER_BIT);
+					if (reprojectImages) {
+						// The image shows the world from the head orientation at
+						// capture time.  Turn it by the rotation from there to the
+						// orientation it will be displayed at, around the eye.
+						glm::quat delta = glm::inverse(Rift::fromOvr(renderPose.Orientation)) * imageOrientations[eye];
+						mv.preMultiply(glm::mat4_cast(delta));
+					}
 					//GlUtils::renderFloorGrid(glm::mat4());
 					//GlUtils::renderSkybox(Resource::IMAGES_SKY_CITY_XNEG_PNG);
 
@@ -235,25 +883,97 @@ public:
 					mv.scale(1);
 					mv.rotate(M_PI, glm::vec3(0, 1, 0));
 
-					// only load necessary part of image
-					glPixelStorei(GL_UNPACK_ROW_LENGTH, CAM_IMAGE_WIDTH);
-					glPixelStorei(GL_UNPACK_SKIP_PIXELS, 189);
-
-					// bind and load camera image
-					imageTextures[eye]->bind();
-					glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, RENDER_IMAGE_WIDTH, RENDER_IMAGE_HEIGHT, GL_BGR, GL_UNSIGNED_BYTE, perEyeReadImage[eye]->imageData);
-
-					glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-					glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
-
-					GlUtils::renderGeometry(quadGeom, texturedPtr);
+					// bind camera image
+					if (remapImages) {
+						glActiveTexture(GL_TEXTURE0 + REMAP_TEXTURE_UNIT);
+						remapTextures[eye]->bind();
+						glActiveTexture(GL_TEXTURE0);
+					}
+					if (FRAME_YUV == imageFormats[eye]) {
+						const YuvLayout & layout = imageLayouts[eye];
+						for (int plane = 2; plane >= 0; --plane) {
+							glActiveTexture(GL_TEXTURE0 + plane);
+							yuvTextures[eye][plane]->bind();
+						}
+						texturedYuvPtr->use();
+						texturedYuvPtr->setUniform("ChromaScale", layout.chromaScale);
+						texturedYuvPtr->setUniform("ChromaOffset", layout.chromaOffset);
+						texturedYuvPtr->setUniform("Remap", remapImages);
+						GlUtils::renderGeometry(quadGeom, texturedYuvPtr);
+					} else {
+						imageTextures[eye]->bind();
+						GlUtils::renderGeometry(quadGeom, remapImages ? texturedRemapPtr : texturedPtr);
+					}
 				});
+				// fixed to the head, so neither reprojected nor turned
+				// like the eye cameras
+				renderOverlays();
 
+				if (latencyHarness && 0 == i) {
+					checkLatencyHarness(eyeArgs);
+				}
 				ovrHmd_EndEyeRender(hmd, eye, renderPose, &perEyeArgs[eye].textures.Texture);
 			}
 			//eyeArgs.framebuffer.deactivate();
 		};
+
+		// a frame that runs late moves the budget up quickly, the average
+		// only follows slowly when rendering gets faster
+		double renderSeconds = ovr_GetTimeInSeconds() - latchTime;
+		double weight = renderSeconds > latchBudget ? 0.5 : 0.05;
+		latchBudget += (renderSeconds - latchBudget) * weight;
 		ovrHmd_EndFrame(hmd);
+		checkUploadFence();
+		if (newPair) {
+			double endFrameTime = ovr_GetTimeInSeconds();
+			for_each_eye([&](ovrEyeType eye){
+				latencies[STAGE_RENDER].add(endFrameTime - uploadIssuedTime);
+				latencies[STAGE_SCANOUT].add(timing.EyeScanoutSeconds[eye] - endFrameTime);
+				latencies[STAGE_TOTAL].add(timing.EyeScanoutSeconds[eye] - imageCaptureTimes[eye]);
+			});
+		}
+		updateScanoutStats(timing, newPair);
+	}
+
+	void updateScanoutStats(const ovrFrameTiming & timing, bool newPair) {
+		++renderedFrames;
+		if (!newPair) {
+			++repeatedFrames;
+		}
+		for_each_eye([&](ovrEyeType eye){
+			if (imageCaptureTimes[eye] > 0) {
+				double age = timing.EyeScanoutSeconds[eye] - imageCaptureTimes[eye];
+				scanoutAgeSum += age;
+				scanoutAgeMax = std::max(scanoutAgeMax, age);
+				++scanoutAgeCount;
+				if (qualityController && adaptiveQuality &&
+					qualityController->addFrameAge(age, timing.EyeScanoutSeconds[eye])) {
+					stereoSource->setQuality(qualityController->getQuality());
+					SAY("Cameras %s", qualityController->describe().c_str());
+				}
+			}
+		});
+
+		long now = Platform::elapsedMillis();
+		if ((now - scanoutStatsStart) < 2000) {
+			return;
+		}
+		if (scanoutAgeCount) {
+			SAY("Frame age at scanout: %0.1f ms mean, %0.1f ms max, latch budget %0.1f ms%s\n"
+				"Rendered %d frames, %d repeated an image, %lu pairs never shown\n",
+				scanoutAgeSum / scanoutAgeCount * 1000.0, scanoutAgeMax * 1000.0,
+				latchBudget * 1000.0, lateLatch ? "" : " (not latching late)",
+				renderedFrames, repeatedFrames, unshownPairs.exchange(0));
+		}
+		if (!overlays.empty()) {
+			SAY("%s", describeOverlayStats().c_str());
+		}
+		scanoutAgeSum = 0;
+		scanoutAgeMax = 0;
+		scanoutAgeCount = 0;
+		renderedFrames = 0;
+		repeatedFrames = 0;
+		scanoutStatsStart = now;
 	}
 
 	void onKey(int key, int scancode, int action, int mods) {
@@ -268,6 +988,33 @@ public:
 		case GLFW_KEY_R:
 			ovrHmd_ResetSensor(hmd);
 			break;
+		case GLFW_KEY_P:
+			reprojectImages = !reprojectImages;
+			SAY("Reprojection %s", reprojectImages ? "on" : "off");
+			break;
+		case GLFW_KEY_H:
+			dumpLatencies();
+			break;
+		case GLFW_KEY_L:
+			lateLatch = !lateLatch;
+			SAY("Late latching %s", lateLatch ? "on" : "off");
+			break;
+		case GLFW_KEY_Q:
+			// full quality while it's off
+			if (qualityController) {
+				adaptiveQuality = !adaptiveQuality;
+				qualityController->reset();
+				stereoSource->setQuality(qualityController->getQuality());
+				SAY("Adaptive camera quality %s", adaptiveQuality ? "on" : "off");
+			}
+			break;
+		case GLFW_KEY_U:
+			// only once there is a calibration
+			if (remapTextures[ovrEye_Left]) {
+				remapImages = !remapImages;
+				SAY("Undistortion %s", remapImages ? "on" : "off");
+			}
+			break;
 
 		case GLFW_KEY_ESCAPE:
 			terminateApp = true;
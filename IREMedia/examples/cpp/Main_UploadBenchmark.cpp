@@ -0,0 +1,130 @@
+#include "Common.h"
+#include <chrono>
+#include <opencv2/opencv.hpp>
+#include "StereoCapture.h"
+#include "LatencyHistogram.h"
+#include "PixelKernels.h"
+
+using namespace cv;
+using namespace std;
+
+// Compares the ways a decoded camera frame can get into an eye texture:
+// packed BGR rows into a GL_RGB texture, the way the live video did it,
+// against aligned BGRA rows into immutable GL_RGBA8 storage.  Every frame
+// is written into a slot of a streaming uploader just like the decode
+// threads do it, and then copied into the texture from there.
+//
+// Prints, per path and in milliseconds, the CPU time for writing the
+// frame into the slot, the CPU time the driver spends in glTexSubImage2D,
+// the GPU time of the copy and the time until the copy is done.
+
+// the size and crop of the camera images of the live video
+#define IMAGE_WIDTH 1280
+#define IMAGE_HEIGHT 720
+#define IMAGE_CROP_X 189
+#define IMAGE_CROP_WIDTH 900
+#define UPLOAD_SLOTS 8
+#define WARMUP_FRAMES 60
+#define FRAMES 1000
+
+static double now() {
+	return chrono::duration<double>(chrono::high_resolution_clock::now().time_since_epoch()).count();
+}
+
+class UploadBenchmark : public GlfwApp {
+	Mat decoded;
+
+public:
+	void createRenderingTarget() {
+		glfwWindowHint(GLFW_VISIBLE, 0);
+		createWindow(64, 64);
+	}
+
+	int run() {
+		createRenderingTarget();
+		initGl();
+		decoded = Mat(IMAGE_HEIGHT, IMAGE_WIDTH, CV_8UC3);
+		randu(decoded, Scalar::all(0), Scalar::all(255));
+		SAY("Uploading %d frames of %dx%d pixels, pixel kernels using %s",
+			FRAMES, IMAGE_CROP_WIDTH, IMAGE_HEIGHT, PixelKernels::getInstructionSet());
+		SAY("%s", glGetString(GL_RENDERER));
+		benchmark(FRAME_BGR);
+		benchmark(FRAME_BGRA);
+		glfwDestroyWindow(window);
+		return 0;
+	}
+
+	void benchmark(FrameFormat format) {
+		const Rect crop(IMAGE_CROP_X, 0, IMAGE_CROP_WIDTH, IMAGE_HEIGHT);
+		const size_t stride = packedStride(format, crop.width);
+		gl::StreamingUploader uploader(stride * crop.height, UPLOAD_SLOTS);
+		gl::TimeQuery query;
+		gl::Texture2d texture;
+		texture.bind();
+		texture.parameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		texture.parameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		if (FRAME_BGRA != format) {
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, crop.width, crop.height, 0, GL_BGR, GL_UNSIGNED_BYTE, 0x0000);
+		} else if (gl::Texture2d::hasStorage()) {
+			texture.storage2d(glm::uvec2(crop.width, crop.height));
+		} else {
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, crop.width, crop.height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0x0000);
+		}
+
+		LatencyHistogram fill, submit, gpu, total;
+		for (int i = 0; i < WARMUP_FRAMES + FRAMES; ++i) {
+			uploader.recycle();
+			CapturedFrame frame;
+			frame.target.slot = uploader.acquire();
+			if (frame.target.slot < 0) {
+				FAIL("No free upload slot");
+			}
+			frame.target.data = (unsigned char *)uploader.data(frame.target.slot);
+			frame.target.stride = stride;
+			frame.target.size = uploader.getSlotSize();
+			frame.format = format;
+
+			double start = now();
+			frame.store(decoded(crop));
+			double stored = now();
+
+			uploader.bind(frame.target.slot);
+			query.begin();
+			if (FRAME_BGRA == format) {
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(stride / 4));
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, crop.width, crop.height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, gl::StreamingUploader::offset(0));
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			} else {
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, crop.width, crop.height, GL_BGR, GL_UNSIGNED_BYTE, gl::StreamingUploader::offset(0));
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			}
+			gl::TimeQuery::end();
+			double submitted = now();
+			gl::StreamingUploader::unbind();
+			uploader.retire(frame.target.slot);
+			glFinish();
+			double done = now();
+
+			if (i >= WARMUP_FRAMES) {
+				fill.add(stored - start);
+				submit.add(submitted - stored);
+				gpu.add(query.getResult() / 1e9);
+				total.add(done - stored);
+			}
+		}
+		gl::Texture2d::unbind();
+		GL_CHECK_ERROR;
+
+		SAY("%s, %u bytes per row:\n"
+			"  write slot  %s\n"
+			"  submit      %s\n"
+			"  GPU copy    %s\n"
+			"  until done  %s",
+			FRAME_BGRA == format ? "BGRA into immutable RGBA8" : "BGR into RGB", (unsigned)stride,
+			fill.describe().c_str(), submit.describe().c_str(),
+			gpu.describe().c_str(), total.describe().c_str());
+	}
+};
+
+RUN_APP(UploadBenchmark);
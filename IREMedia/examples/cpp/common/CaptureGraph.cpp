@@ -0,0 +1,136 @@
+#include "Common.h"
+#include "CaptureGraph.h"
+
+#ifdef HAVE_OPENCV
+
+#include <fstream>
+#include <json/json.h>
+
+static std::vector<int> readInts(const Json::Value & value) {
+  std::vector<int> result;
+  if (value.isArray()) {
+    for (Json::UInt i = 0; i < value.size(); ++i) {
+      result.push_back(value[i].asInt());
+    }
+  }
+  return result;
+}
+
+static bool readNode(const Json::Value & value, CaptureNode & node) {
+  node.name = value.get("name", "").asString();
+  if (!value.isMember("device")) {
+    SAY_ERR("Camera %s has no device", node.name.c_str());
+    return false;
+  }
+  node.device = value["device"].asInt();
+
+  std::vector<int> size = readInts(value["size"]);
+  if (2 == size.size()) {
+    node.size = glm::uvec2(size[0], size[1]);
+  }
+  std::vector<int> crop = readInts(value["crop"]);
+  if (4 == crop.size()) {
+    node.crop = cv::Rect(crop[0], crop[1], crop[2], crop[3]);
+  }
+  if ((node.getCrop() & cv::Rect(0, 0, node.size.x, node.size.y)) != node.getCrop()) {
+    SAY_ERR("The crop of camera %s is outside its image", node.name.c_str());
+    return false;
+  }
+
+  std::string format = value.get("format", "bgr").asString();
+  if ("yuv" == format) {
+    node.format = FRAME_YUV;
+  } else if ("bgr" == format) {
+    node.format = FRAME_BGR;
+  } else if ("bgra" == format) {
+    node.format = FRAME_BGRA;
+  } else {
+    SAY_ERR("Camera %s has unknown format %s", node.name.c_str(), format.c_str());
+    return false;
+  }
+
+  std::string target = value.get("target", "overlay").asString();
+  if ("left" == target) {
+    node.target = CaptureNode::LEFT_EYE;
+  } else if ("right" == target) {
+    node.target = CaptureNode::RIGHT_EYE;
+  } else if ("overlay" == target) {
+    node.target = CaptureNode::OVERLAY;
+  } else {
+    SAY_ERR("Camera %s has unknown target %s", node.name.c_str(), target.c_str());
+    return false;
+  }
+
+  node.decodeThreads = value.get("decodeThreads", (Json::UInt)node.decodeThreads).asUInt();
+  node.decodeQueue = value.get("decodeQueue", (Json::UInt)node.decodeQueue).asUInt();
+  node.driverBuffers = value.get("driverBuffers", node.driverBuffers).asInt();
+  node.captureCpus = readInts(value["captureCpus"]);
+  node.decodeCpus = readInts(value["decodeCpus"]);
+  node.budgetSeconds = value.get("budgetMillis", 0.0).asDouble() / 1000.0;
+
+  const Json::Value & position = value["position"];
+  if (position.isArray() && 3 == position.size()) {
+    node.position = glm::vec3(position[0u].asFloat(), position[1u].asFloat(), position[2u].asFloat());
+  }
+  node.width = value.get("width", node.width).asFloat();
+  node.rotation = value.get("rotation", node.rotation).asFloat();
+  return true;
+}
+
+bool CaptureGraph::load(const std::string & path) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    SAY_ERR("Unable to open capture graph %s", path.c_str());
+    return false;
+  }
+  Json::Value root;
+  Json::Reader reader;
+  if (!reader.parse(in, root)) {
+    SAY_ERR("Unable to parse capture graph %s: %s", path.c_str(),
+      reader.getFormattedErrorMessages().c_str());
+    return false;
+  }
+
+  nodes.clear();
+  maxSkewSeconds = root.get("maxSkewSeconds", maxSkewSeconds).asDouble();
+  const Json::Value & cameras = root["cameras"];
+  for (Json::UInt i = 0; i < cameras.size(); ++i) {
+    CaptureNode node;
+    if (!readNode(cameras[i], node)) {
+      nodes.clear();
+      return false;
+    }
+    nodes.push_back(node);
+  }
+  if (!validate()) {
+    nodes.clear();
+    return false;
+  }
+  return true;
+}
+
+bool CaptureGraph::validate() const {
+  const CaptureNode * left = findEye(ovrEye_Left);
+  const CaptureNode * right = findEye(ovrEye_Right);
+  if (!left || !right) {
+    SAY_ERR("The capture graph needs a left and a right camera");
+    return false;
+  }
+  if (left->size != right->size || left->format != right->format || left->getCrop() != right->getCrop()) {
+    SAY_ERR("The left and right camera need the same size, format and crop");
+    return false;
+  }
+  return true;
+}
+
+const CaptureNode * CaptureGraph::findEye(ovrEyeType eye) const {
+  CaptureNode::Target target = ovrEye_Left == eye ? CaptureNode::LEFT_EYE : CaptureNode::RIGHT_EYE;
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    if (target == nodes[i].target) {
+      return &nodes[i];
+    }
+  }
+  return nullptr;
+}
+
+#endif
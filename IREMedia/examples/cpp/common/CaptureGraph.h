@@ -0,0 +1,97 @@
+#pragma once
+
+#ifdef HAVE_OPENCV
+
+#include <string>
+#include <vector>
+#include "StereoCapture.h"
+
+/**
+ * The cameras of a setup and where their images go, read from a JSON
+ * file, e.g.
+ *
+ *   {
+ *     "maxSkewSeconds": 0.015,
+ *     "cameras": [
+ *       { "name": "left", "device": 701, "size": [1280, 720],
+ *         "format": "yuv", "crop": [189, 0, 900, 720], "target": "left",
+ *         "decodeThreads": 3, "captureCpus": [2], "decodeCpus": [3, 4, 5],
+ *         "budgetMillis": 12 },
+ *       { "name": "right", "device": 700, ... "target": "right" },
+ *       { "name": "rear", "device": 2, "size": [640, 480], "format": "bgr",
+ *         "target": "overlay", "position": [0.9, -0.6, 0.2], "width": 0.5,
+ *         "rotation": 0 }
+ *     ]
+ *   }
+ *
+ * Every camera is a stream with its own capture thread, decode threads and
+ * upload slots, except that the two eyes share theirs, since their frames
+ * are only useful as a pair.  Both eyes need the same size, format and
+ * crop.  Omitted values fall back to the defaults of CaptureNode.
+ */
+struct CaptureNode {
+  enum Target {
+    LEFT_EYE,
+    RIGHT_EYE,
+    // drawn on a quad in front of both eyes, fixed to the head
+    OVERLAY,
+  };
+
+  std::string name;
+  int device{ 0 };
+  glm::uvec2 size{ 640, 480 };
+  FrameFormat format{ FRAME_BGR };
+  // all of the image if empty
+  cv::Rect crop;
+  Target target{ OVERLAY };
+  size_t decodeThreads{ 1 };
+  size_t decodeQueue{ 4 };
+  int driverBuffers{ 3 };
+  // CPUs the threads of the stream may run on, any if empty
+  std::vector<int> captureCpus;
+  std::vector<int> decodeCpus;
+  // decode time per frame, zero for no budget
+  double budgetSeconds{ 0 };
+  // placement of overlays in head space: center, width and rotation
+  // around the view axis in degrees
+  glm::vec3 position{ 0, 0, 0 };
+  float width{ 1 };
+  float rotation{ 0 };
+
+  // The crop, or all of the image
+  cv::Rect getCrop() const {
+    return crop.area() ? crop : cv::Rect(0, 0, size.x, size.y);
+  }
+};
+
+class CaptureGraph {
+public:
+  bool load(const std::string & path);
+
+  void add(const CaptureNode & node) {
+    nodes.push_back(node);
+  }
+
+  const std::vector<CaptureNode> & getNodes() const {
+    return nodes;
+  }
+
+  // The camera of an eye, or nullptr
+  const CaptureNode * findEye(ovrEyeType eye) const;
+
+  double getMaxSkewSeconds() const {
+    return maxSkewSeconds;
+  }
+
+  void setMaxSkewSeconds(double seconds) {
+    maxSkewSeconds = seconds;
+  }
+
+private:
+  bool validate() const;
+
+  std::vector<CaptureNode> nodes;
+  double maxSkewSeconds{ 0.015 };
+};
+
+#endif
@@ -22,6 +22,7 @@
 #ifdef WIN32
 #include <Windows.h>
 #else
+#include <pthread.h>
 #include <sys/time.h>
 #include <unistd.h>
 #endif
@@ -51,6 +52,29 @@ float Platform::elapsedSeconds() {
   return (float)elapsedMillis() / 1000.0f;
 }
 
+bool Platform::setThreadAffinity(std::thread & thread, const std::vector<int> & cpus) {
+  if (cpus.empty() || !thread.joinable()) {
+    return false;
+  }
+#ifdef WIN32
+  DWORD_PTR mask = 0;
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    mask |= (DWORD_PTR)1 << cpus[i];
+  }
+  return 0 != SetThreadAffinityMask((HANDLE)thread.native_handle(), mask);
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    CPU_SET(cpus[i], &set);
+  }
+  return 0 == pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+  // OS X only takes affinity hints, not worth it
+  return false;
+#endif
+}
+
 static const size_t BUFFER_SIZE = 8192;
 
 void Platform::fail(const char * file, int line, const char * message, ...) {
@@ -40,6 +40,8 @@
 #include <array>
 #include <map>
 #include <unordered_map>
+#include <thread>
+#include <vector>
 #include <stdint.h>
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -60,6 +62,7 @@
 #include <GlFrameBuffer.h>
 #include <GlStacks.h>
 #include <GlQuery.h>
+#include <GlStreaming.h>
 #include <GlShaders.h>
 #include <GlGeometry.h>
 #include <GlLighting.h>
@@ -92,6 +95,9 @@ public:
     static std::string format(const char * formatString, ...);
     static std::string getResourceData(Resource resource);
     static std::string replaceAll(const std::string & in, const std::string & from, const std::string & to);
+    // Restricts the thread to the given CPUs.  Returns false if that isn't
+    // supported here or the CPUs don't exist.
+    static bool setThreadAffinity(std::thread & thread, const std::vector<int> & cpus);
 };
 
 #ifndef PI
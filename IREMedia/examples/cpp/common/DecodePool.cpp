@@ -0,0 +1,242 @@
+#include "Common.h"
+#include "DecodePool.h"
+
+#ifdef HAVE_OPENCV
+
+FrameDecoder::FrameDecoder() {
+#ifdef HAVE_JPEG
+  yuvDecoder = std::unique_ptr<JpegYuvDecoder>(new JpegYuvDecoder());
+#endif
+}
+
+FrameDecoder::~FrameDecoder() {
+}
+
+#ifdef HAVE_JPEG
+bool FrameDecoder::supports(FrameFormat /*format*/) {
+  return true;
+}
+#else
+bool FrameDecoder::supports(FrameFormat format) {
+  return FRAME_YUV != format;
+}
+#endif
+
+bool FrameDecoder::decode(const unsigned char * data, size_t length,
+    const cv::Rect & crop, FrameFormat format, CapturedFrame & frame,
+    int scale) {
+  frame.format = format;
+
+#ifdef HAVE_JPEG
+  if (FRAME_YUV == format) {
+    FrameTarget & target = frame.target;
+    cv::Mat owned;
+    unsigned char * planes = target.data;
+    size_t capacity = target.size;
+    if (!planes) {
+      capacity = crop.area() * 3;
+      owned.create(1, (int)capacity, CV_8UC1);
+      planes = owned.data;
+    }
+    if (!yuvDecoder->decode(data, length, crop, planes, capacity, frame.yuv, scale)) {
+      return false;
+    }
+    frame.image = target.data ? cv::Mat(1, (int)frame.yuv.size(), CV_8UC1, planes) : owned;
+    return true;
+  }
+#else
+  // only YUV frames can be scaled
+  (void)scale;
+#endif
+
+  if (FRAME_BGR != format && FRAME_BGRA != format) {
+    return false;
+  }
+  // only the rows and columns of the crop are decoded, a crop outside of
+  // the image gives an empty one
+  cv::Mat image = cv::imdecode(cv::Mat(1, (int)length, CV_8UC1, (void *)data), 1, crop, &decoded);
+  if (image.empty()) {
+    return false;
+  }
+  // BGRA is expanded while the crop is copied out
+  frame.store(image);
+  return true;
+}
+
+DecodePool::DecodePool(size_t threadCount, size_t queueCapacity)
+  : queueCapacity(std::max<size_t>(queueCapacity, 1)) {
+  threadCount = std::max<size_t>(threadCount, 1);
+  for (size_t i = 0; i < threadCount; ++i) {
+    workers.push_back(std::thread(&DecodePool::run, this));
+  }
+}
+
+DecodePool::~DecodePool() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  ready.notify_all();
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i].join();
+  }
+}
+
+bool DecodePool::setAffinity(const std::vector<int> & cpus) {
+  bool result = true;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    result = Platform::setThreadAffinity(workers[i], cpus) && result;
+  }
+  return result;
+}
+
+void DecodePool::setDecodeScale(int source, int scale) {
+  std::unique_lock<std::mutex> lock(mutex);
+  sources[source]->decodeScale = scale;
+}
+
+int DecodePool::addSource(const Source & source) {
+  std::unique_lock<std::mutex> lock(mutex);
+  SourceState * state = new SourceState();
+  state->id = (int)sources.size();
+  state->source = source;
+  sources.push_back(std::unique_ptr<SourceState>(state));
+  return (int)sources.size() - 1;
+}
+
+DecodePool::Buffer DecodePool::takeBuffer() {
+  std::unique_lock<std::mutex> lock(mutex);
+  Buffer result;
+  if (!spare.empty()) {
+    result.swap(spare.back());
+    spare.pop_back();
+  }
+  return result;
+}
+
+void DecodePool::recycle(Buffer & buffer) {
+  // Every frame in flight holds one buffer, so this stays small
+  buffer.clear();
+  spare.push_back(Buffer());
+  spare.back().swap(buffer);
+}
+
+void DecodePool::submit(int source, Buffer & data, double captureTime, double dequeueTime) {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (queue.size() >= queueCapacity) {
+      // Prefer dropping an older frame of the same camera, so the other
+      // one doesn't lose its half of the next stereo pair
+      auto victim = queue.begin();
+      for (auto itr = queue.begin(); itr != queue.end(); ++itr) {
+        if (itr->state->id == source) {
+          victim = itr;
+          break;
+        }
+      }
+      recycle(victim->data);
+      queue.erase(victim);
+      ++stats.overflowed;
+    }
+
+    Job job;
+    job.state = sources[source].get();
+    job.sequence = ++job.state->submitted;
+    job.captureTime = captureTime;
+    job.dequeueTime = dequeueTime;
+    job.data.swap(data);
+    queue.push_back(std::move(job));
+    stats.maxQueueDepth = std::max(stats.maxQueueDepth, queue.size());
+  }
+  ready.notify_one();
+}
+
+DecodePool::Stats DecodePool::getStats(bool reset) {
+  std::unique_lock<std::mutex> lock(mutex);
+  Stats result = stats;
+  result.queueDepth = queue.size();
+  if (decodeCount) {
+    result.meanDecodeMillis = decodeSeconds * 1000.0 / decodeCount;
+  }
+  if (reset) {
+    stats.maxQueueDepth = queue.size();
+    stats.maxDecodeMillis = 0;
+    decodeSeconds = 0;
+    decodeCount = 0;
+  }
+  return result;
+}
+
+void DecodePool::run() {
+  FrameDecoder decoder;
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      ready.wait(lock, [&]{
+        return stopping || !queue.empty();
+      });
+      if (stopping) {
+        return;
+      }
+      job = std::move(queue.front());
+      queue.pop_front();
+    }
+    decode(decoder, job);
+    std::unique_lock<std::mutex> lock(mutex);
+    recycle(job.data);
+  }
+}
+
+void DecodePool::decode(FrameDecoder & decoder, Job & job) {
+  SourceState & state = *job.state;
+  const Source & source = state.source;
+
+  CapturedFrame frame;
+  frame.captureTime = job.captureTime;
+  frame.dequeueTime = job.dequeueTime;
+  frame.sequence = job.sequence;
+  if (source.sink && !source.sink->acquire(frame.target)) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ++stats.skipped;
+    return;
+  }
+
+  double start = ovr_GetTimeInSeconds();
+  bool decoded = decoder.decode(job.data.data(), job.data.size(),
+    source.crop, source.format, frame, state.decodeScale);
+  frame.decodeTime = ovr_GetTimeInSeconds();
+  double elapsed = frame.decodeTime - start;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (decoded) {
+      ++stats.decoded;
+      ++decodeCount;
+      decodeSeconds += elapsed;
+      stats.maxDecodeMillis = std::max(stats.maxDecodeMillis, elapsed * 1000.0);
+      if (budgetSeconds > 0 && elapsed > budgetSeconds) {
+        ++stats.overBudget;
+      }
+    } else {
+      ++stats.failed;
+    }
+  }
+
+  std::unique_lock<std::mutex> deliverLock(state.deliverMutex);
+  if (!decoded || job.sequence < state.delivered) {
+    if (!decoded) {
+      SAY("Unable to decode frame %lu of source %d", job.sequence, state.id);
+    } else {
+      std::unique_lock<std::mutex> lock(mutex);
+      ++stats.stale;
+    }
+    if (source.sink) {
+      source.sink->release(frame.target);
+    }
+    return;
+  }
+  state.delivered = job.sequence;
+  source.callback(frame);
+}
+
+#endif
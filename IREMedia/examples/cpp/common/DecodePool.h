@@ -0,0 +1,157 @@
+#pragma once
+
+#ifdef HAVE_OPENCV
+
+#include "StereoCapture.h"
+#include <condition_variable>
+#include <memory>
+#include <vector>
+
+/**
+ * Turns compressed (MJPEG) camera frames into images of a given format,
+ * cropped to a region.  Keeps per-thread decoder state, so every thread
+ * needs its own instance.
+ */
+class FrameDecoder {
+public:
+  FrameDecoder();
+  virtual ~FrameDecoder();
+
+  // Whether frames can be decoded to the format in this build
+  static bool supports(FrameFormat format);
+
+  // Decodes the crop region into the frame's target memory, or into a
+  // newly allocated image if the frame has no target.  Not thread safe,
+  // every thread needs a decoder of its own.
+  bool decode(const unsigned char * data, size_t length,
+    const cv::Rect & crop, FrameFormat format, CapturedFrame & frame,
+    int scale = 1);
+
+private:
+#ifdef HAVE_JPEG
+  std::unique_ptr<JpegYuvDecoder> yuvDecoder;
+#endif
+  // BGR crops, reused for every frame
+  cv::Mat decoded;
+};
+
+/**
+ * Decodes compressed frames of one or more cameras on a pool of worker
+ * threads, so that the capture threads only dequeue buffers from the
+ * driver.
+ *
+ * Frames wait on a bounded queue.  If it is full, the oldest waiting frame
+ * is dropped, since the newest one is what we want to show.  Frames of a
+ * camera are delivered in capture order.  A frame that finishes decoding
+ * after a newer frame of the same camera was delivered is stale and dropped
+ * as well, nobody waits for a slow decode.
+ *
+ * The callback of a camera is invoked on a worker thread, but never on two
+ * threads at once.
+ */
+class DecodePool {
+public:
+  typedef std::function<void(CapturedFrame & frame)> Callback;
+  typedef std::vector<unsigned char> Buffer;
+
+  struct Source {
+    cv::Rect crop;
+    FrameFormat format{ FRAME_BGR };
+    // optional, see CameraCapture::setSink()
+    FrameSink * sink{ nullptr };
+    Callback callback;
+  };
+
+  struct Stats {
+    unsigned long decoded{ 0 };
+    // dropped because the queue was full
+    unsigned long overflowed{ 0 };
+    // finished after a newer frame of the camera
+    unsigned long stale{ 0 };
+    // the sink had no memory for the frame
+    unsigned long skipped{ 0 };
+    unsigned long failed{ 0 };
+    // decoded, but slower than the budget
+    unsigned long overBudget{ 0 };
+    size_t queueDepth{ 0 };
+    size_t maxQueueDepth{ 0 };
+    double meanDecodeMillis{ 0 };
+    double maxDecodeMillis{ 0 };
+  };
+
+  DecodePool(size_t threadCount, size_t queueCapacity = 8);
+  virtual ~DecodePool();
+
+  // Registers a camera and returns the id its frames are submitted with.
+  // Must be called before any frame is submitted.
+  int addSource(const Source & source);
+
+  // An empty buffer for the next compressed frame, recycled from frames
+  // decoded earlier where possible
+  Buffer takeBuffer();
+
+  // Runs the worker threads on the given CPUs only
+  bool setAffinity(const std::vector<int> & cpus);
+
+  // Decodes taking longer are counted as over budget.  Zero means no
+  // budget.
+  void setBudget(double seconds) {
+    std::unique_lock<std::mutex> lock(mutex);
+    budgetSeconds = seconds;
+  }
+
+  // Decodes the frames of the source at a fraction of the resolution
+  // from now on, see StreamQuality
+  void setDecodeScale(int source, int scale);
+
+  // Queues a compressed frame for decoding, taking over its buffer
+  void submit(int source, Buffer & data, double captureTime, double dequeueTime);
+
+  // The counters are totals, decode times and the maximum queue depth
+  // cover the time since the last reset.
+  Stats getStats(bool reset = false);
+
+  size_t getThreadCount() const {
+    return workers.size();
+  }
+
+private:
+  struct SourceState {
+    int id;
+    Source source;
+    unsigned long submitted{ 0 };
+    unsigned long delivered{ 0 };
+    std::atomic<int> decodeScale{ 1 };
+    std::mutex deliverMutex;
+  };
+
+  struct Job {
+    // looked up on submit, so workers never touch the source list while
+    // another camera is added
+    SourceState * state;
+    unsigned long sequence;
+    double captureTime;
+    double dequeueTime;
+    Buffer data;
+  };
+
+  void run();
+  void decode(FrameDecoder & decoder, Job & job);
+  void recycle(Buffer & buffer);
+
+  const size_t queueCapacity;
+  std::vector<std::unique_ptr<SourceState>> sources;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<Job> queue;
+  std::vector<Buffer> spare;
+  bool stopping{ false };
+  Stats stats;
+  double budgetSeconds{ 0 };
+  // decode times since the last reset
+  double decodeSeconds{ 0 };
+  unsigned long decodeCount{ 0 };
+};
+
+#endif
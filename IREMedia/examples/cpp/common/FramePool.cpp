@@ -0,0 +1,195 @@
+#include "Common.h"
+#include "FramePool.h"
+
+#ifdef HAVE_OPENCV
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <cstdlib>
+#endif
+
+// Transparent huge pages on Linux come in this size
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static size_t roundUp(size_t size, size_t multiple) {
+  return (size + multiple - 1) / multiple * multiple;
+}
+
+FramePool::FramePool(size_t frameSize, size_t stride, size_t frameCount, bool hugePages)
+  : frameSize(frameSize), stride(stride), frameCount(std::max<size_t>(frameCount, 1)),
+    slotSize(roundUp(std::max<size_t>(frameSize, 1), FRAME_POOL_ALIGNMENT)),
+    wantHugePages(hugePages), refcounts(this->frameCount, 0), allocator(*this) {
+  allocateBlock();
+  freeSlots.reserve(this->frameCount);
+  for (size_t i = this->frameCount; i > 0; --i) {
+    freeSlots.push_back((int)i - 1);
+  }
+  stats.frameCount = this->frameCount;
+  stats.hugePages = this->hugePages;
+}
+
+FramePool::~FramePool() {
+  freeBlock();
+}
+
+void FramePool::allocateBlock() {
+  blockSize = slotSize * frameCount;
+#ifdef WIN32
+  // Large pages need the "lock pages in memory" privilege, without it
+  // the allocation fails and we fall back to normal pages
+  SIZE_T largePage = wantHugePages ? GetLargePageMinimum() : 0;
+  if (largePage) {
+    size_t size = roundUp(blockSize, largePage);
+    block = (unsigned char *)VirtualAlloc(NULL, size,
+      MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if (block) {
+      blockSize = size;
+      hugePages = mapped = true;
+    }
+  }
+  if (!block) {
+    block = (unsigned char *)_aligned_malloc(blockSize, FRAME_POOL_ALIGNMENT);
+  }
+#else
+#ifdef MAP_HUGETLB
+  // Pages reserved by the admin (vm.nr_hugepages) first ...
+  if (wantHugePages) {
+    size_t size = roundUp(blockSize, HUGE_PAGE_SIZE);
+    void * memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (MAP_FAILED != memory) {
+      block = (unsigned char *)memory;
+      blockSize = size;
+      hugePages = mapped = true;
+    }
+  }
+#endif
+  if (!block) {
+    void * memory = nullptr;
+    size_t alignment = wantHugePages ? HUGE_PAGE_SIZE : FRAME_POOL_ALIGNMENT;
+    if (0 == posix_memalign(&memory, alignment, blockSize)) {
+      block = (unsigned char *)memory;
+    }
+#ifdef MADV_HUGEPAGE
+    // ... then transparent ones, which the kernel may or may not give us
+    if (block && wantHugePages) {
+      hugePages = 0 == madvise(block, blockSize, MADV_HUGEPAGE);
+    }
+#endif
+  }
+#endif
+  if (!block) {
+    FAIL("Unable to allocate %u frames of %u bytes", (unsigned)frameCount, (unsigned)frameSize);
+  }
+  // fault all pages in now rather than on the first frames
+  memset(block, 0, blockSize);
+}
+
+void FramePool::freeBlock() {
+  if (!block) {
+    return;
+  }
+#ifdef WIN32
+  if (mapped) {
+    VirtualFree(block, 0, MEM_RELEASE);
+  } else {
+    _aligned_free(block);
+  }
+#else
+  if (mapped) {
+    munmap(block, blockSize);
+  } else {
+    ::free(block);
+  }
+#endif
+  block = nullptr;
+}
+
+bool FramePool::acquire(FrameTarget & target) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (freeSlots.empty()) {
+    ++stats.exhausted;
+    return false;
+  }
+  int slot = freeSlots.back();
+  freeSlots.pop_back();
+  refcounts[slot] = 1;
+  ++stats.inUse;
+  stats.maxInUse = std::max(stats.maxInUse, stats.inUse);
+
+  target.slot = slot;
+  target.data = block + slot * slotSize;
+  target.stride = stride;
+  target.size = frameSize;
+  return true;
+}
+
+void FramePool::release(const FrameTarget & target) {
+  if (target.slot >= 0 && 1 == CV_XADD(&refcounts[target.slot], -1)) {
+    giveBack(target.slot);
+  }
+}
+
+void FramePool::retain(const FrameTarget & target) {
+  if (target.slot >= 0) {
+    CV_XADD(&refcounts[target.slot], 1);
+  }
+}
+
+void FramePool::adopt(CapturedFrame & frame) {
+  cv::Mat & image = frame.image;
+  if (frame.target.slot < 0) {
+    return;
+  }
+  if (image.refcount || image.datastart != frame.target.data) {
+    // the image got memory of its own, the buffer isn't needed
+    release(frame.target);
+    frame.target.slot = -1;
+    return;
+  }
+  image.refcount = &refcounts[frame.target.slot];
+  image.allocator = &allocator;
+  // the target no longer holds the reference, releasing it does nothing
+  frame.target.slot = -1;
+}
+
+void FramePool::giveBack(int slot) {
+  std::unique_lock<std::mutex> lock(mutex);
+  freeSlots.push_back(slot);
+  --stats.inUse;
+}
+
+FramePool::Stats FramePool::getStats(bool reset) {
+  std::unique_lock<std::mutex> lock(mutex);
+  Stats result = stats;
+  if (reset) {
+    stats.maxInUse = stats.inUse;
+  }
+  return result;
+}
+
+void FramePool::Allocator::allocate(int dims, const int * sizes, int type, int *& refcount,
+    uchar *& datastart, uchar *& data, size_t * step) {
+  // Only reached if an adopted image is create()d with another size,
+  // which gets plain memory like any other cv::Mat
+  size_t total = CV_ELEM_SIZE(type);
+  for (int i = dims - 1; i >= 0; --i) {
+    step[i] = total;
+    total *= sizes[i];
+  }
+  total = cv::alignSize(total, (int)sizeof(*refcount));
+  datastart = data = (uchar *)cv::fastMalloc(total + sizeof(*refcount));
+  refcount = (int *)(data + total);
+  *refcount = 1;
+}
+
+void FramePool::Allocator::deallocate(int * refcount, uchar * datastart, uchar * /*data*/) {
+  int * first = &pool.refcounts[0];
+  if (refcount >= first && refcount < first + pool.refcounts.size()) {
+    pool.giveBack((int)(refcount - first));
+  } else {
+    cv::fastFree(datastart);
+  }
+}
+
+#endif
@@ -0,0 +1,107 @@
+#pragma once
+
+#ifdef HAVE_OPENCV
+
+#include <mutex>
+#include <vector>
+#include "StereoCapture.h"
+
+// Buffers of a FramePool start at multiples of this many bytes
+static const size_t FRAME_POOL_ALIGNMENT = 64;
+
+/**
+ * A fixed number of equally sized frame buffers in host memory, allocated
+ * once, for streams whose frames aren't written straight into upload
+ * slots.  Handing the buffers out as a FrameSink means a stream in steady
+ * state allocates nothing per frame.
+ *
+ * Every buffer starts at a multiple of FRAME_POOL_ALIGNMENT bytes, and
+ * all of them live in one block that can be put on huge pages, so SIMD
+ * kernels and the TLB both have an easy time.  The block is touched
+ * once up front, so no frame pays for faulting its pages in.
+ *
+ * Buffers are reference counted.  acquire() hands out a buffer holding
+ * one reference, retain() adds one and release() drops one, the last
+ * one returning the buffer to the pool.  adopt() hands the reference
+ * of a frame to its image instead, so that the buffer comes back once
+ * the last copy of the cv::Mat is gone, without anybody calling
+ * release().
+ *
+ * When all buffers are in use, acquire() fails, which capture and decode
+ * count as frames skipped for lack of memory: that's the back-pressure
+ * of a consumer that holds on to its frames for too long.
+ *
+ * All methods may be called from any thread.  The pool has to outlive
+ * the frames it handed out.
+ */
+class FramePool : public FrameSink {
+public:
+  struct Stats {
+    size_t frameCount{ 0 };
+    size_t inUse{ 0 };
+    size_t maxInUse{ 0 };
+    // acquire() found no free buffer
+    unsigned long exhausted{ 0 };
+    bool hugePages{ false };
+  };
+
+  // Frames of frameSize bytes each, with rows of the given stride
+  FramePool(size_t frameSize, size_t stride, size_t frameCount, bool hugePages = false);
+  virtual ~FramePool();
+
+  bool acquire(FrameTarget & target);
+  void release(const FrameTarget & target);
+  void retain(const FrameTarget & target);
+
+  // Moves the reference the frame holds from its target to its image.
+  // An image that isn't a header over the target memory doesn't need
+  // the buffer, which is released right away.
+  void adopt(CapturedFrame & frame);
+
+  // The maximum of buffers in use covers the time since the last reset
+  Stats getStats(bool reset = false);
+
+  size_t getFrameSize() const {
+    return frameSize;
+  }
+
+private:
+  // Returns buffers to the pool when the last cv::Mat referencing one is
+  // released.  Never allocates, images only ever get their memory from
+  // adopt().
+  class Allocator : public cv::MatAllocator {
+  public:
+    Allocator(FramePool & pool) : pool(pool) {
+    }
+    void allocate(int dims, const int * sizes, int type, int *& refcount,
+      uchar *& datastart, uchar *& data, size_t * step);
+    void deallocate(int * refcount, uchar * datastart, uchar * data);
+  private:
+    FramePool & pool;
+  };
+
+  void giveBack(int slot);
+  void allocateBlock();
+  void freeBlock();
+
+  const size_t frameSize;
+  const size_t stride;
+  const size_t frameCount;
+  // frameSize rounded up to the alignment
+  const size_t slotSize;
+  bool wantHugePages;
+  bool hugePages{ false };
+  // by mmap() or VirtualAlloc() rather than an aligned malloc
+  bool mapped{ false };
+  unsigned char * block{ nullptr };
+  size_t blockSize{ 0 };
+  // plain ints, cv::Mat updates them with CV_XADD
+  std::vector<int> refcounts;
+  Allocator allocator;
+  std::mutex mutex;
+  // indices of the free buffers, reserved up front
+  std::vector<int> freeSlots;
+  Stats stats;
+};
+
+#endif
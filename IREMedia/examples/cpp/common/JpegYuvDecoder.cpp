@@ -0,0 +1,275 @@
+#include "Common.h"
+#include "JpegYuvDecoder.h"
+
+#ifdef HAVE_OPENCV
+
+#ifdef HAVE_JPEG
+#include <cstdio>
+#include <csetjmp>
+
+#ifdef WIN32
+#define XMD_H // prevent redefinition of INT32
+#undef FAR
+#endif
+
+extern "C" {
+#include <jpeglib.h>
+}
+#endif
+
+YuvLayout YuvLayout::forCrop(const cv::Rect & crop, const glm::uvec2 & subsampling) {
+  YuvLayout result;
+  result.subsampling = subsampling;
+  result.lumaSize = glm::uvec2(crop.width, crop.height);
+  glm::uvec2 start(crop.x, crop.y);
+  glm::uvec2 end = start + result.lumaSize;
+  glm::uvec2 chromaStart = start / subsampling;
+  glm::uvec2 chromaEnd = (end + subsampling - glm::uvec2(1)) / subsampling;
+  result.chromaSize = chromaEnd - chromaStart;
+  glm::vec2 chromaSize(result.chromaSize);
+  result.chromaScale = glm::vec2(result.lumaSize) / glm::vec2(subsampling) / chromaSize;
+  result.chromaOffset = (glm::vec2(start) / glm::vec2(subsampling) - glm::vec2(chromaStart)) / chromaSize;
+  return result;
+}
+
+#ifdef HAVE_JPEG
+
+// Size of the blocks a component is decoded in, after scaling
+#if JPEG_LIB_VERSION >= 70
+#define SCALED_BLOCK_WIDTH(component) ((component).DCT_h_scaled_size)
+#define SCALED_BLOCK_HEIGHT(component) ((component).DCT_v_scaled_size)
+#else
+#define SCALED_BLOCK_WIDTH(component) ((component).DCT_scaled_size)
+#define SCALED_BLOCK_HEIGHT(component) ((component).DCT_scaled_size)
+#endif
+
+namespace {
+  // Huffman tables MJPEG frames leave out, see the AVI1 / ODML spec.  Each
+  // table is a class / id byte, 16 code counts and the symbols.
+  const unsigned char MJPEG_HUFFMAN_TABLES[] = {
+    0x00, 0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x0b, 0x01, 0x00, 0x03, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+    0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x10, 0x00,
+    0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00,
+    0x00, 0x01, 0x7d, 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21,
+    0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81,
+    0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24,
+    0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25,
+    0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a,
+    0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56,
+    0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86,
+    0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99,
+    0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3,
+    0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6,
+    0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9,
+    0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1,
+    0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0x11, 0x00, 0x02,
+    0x01, 0x02, 0x04, 0x04, 0x03, 0x04, 0x07, 0x05, 0x04, 0x04, 0x00, 0x01,
+    0x02, 0x77, 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06,
+    0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14,
+    0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62,
+    0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19,
+    0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a,
+    0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56,
+    0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85,
+    0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+    0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2,
+    0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
+    0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2,
+    0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
+  };
+
+  void loadMjpegHuffmanTables(j_decompress_ptr cinfo) {
+    const unsigned char * table = MJPEG_HUFFMAN_TABLES;
+    const unsigned char * end = table + sizeof(MJPEG_HUFFMAN_TABLES);
+    while (table < end) {
+      int index = *table++;
+      JHUFF_TBL ** tables = (index & 0x10) ? cinfo->ac_huff_tbl_ptrs : cinfo->dc_huff_tbl_ptrs;
+      JHUFF_TBL *& huffman = tables[index & 0x0f];
+      if (!huffman) {
+        huffman = jpeg_alloc_huff_table((j_common_ptr)cinfo);
+      }
+      huffman->bits[0] = 0;
+      int count = 0;
+      for (int i = 1; i <= 16; ++i) {
+        huffman->bits[i] = *table++;
+        count += huffman->bits[i];
+      }
+      memcpy(huffman->huffval, table, count);
+      table += count;
+    }
+  }
+
+  void noop(j_decompress_ptr) {
+  }
+
+  boolean endOfInput(j_decompress_ptr) {
+    // The whole frame is in memory, so there is nothing more to come
+    return FALSE;
+  }
+
+  void skipInput(j_decompress_ptr cinfo, long count) {
+    jpeg_source_mgr * source = cinfo->src;
+    size_t skip = std::min((size_t)std::max(count, 0L), source->bytes_in_buffer);
+    source->next_input_byte += skip;
+    source->bytes_in_buffer -= skip;
+  }
+}
+
+struct JpegYuvDecoder::State {
+  struct Error {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+  };
+
+  jpeg_decompress_struct cinfo;
+  Error error;
+  jpeg_source_mgr source;
+
+  static void errorExit(j_common_ptr cinfo) {
+    Error * error = (Error *)cinfo->err;
+    longjmp(error->jump, 1);
+  }
+};
+
+JpegYuvDecoder::JpegYuvDecoder() : state(new State) {
+  memset(state, 0, sizeof(State));
+  state->cinfo.err = jpeg_std_error(&state->error.pub);
+  state->error.pub.error_exit = State::errorExit;
+  jpeg_create_decompress(&state->cinfo);
+
+  jpeg_source_mgr & source = state->source;
+  source.init_source = noop;
+  source.fill_input_buffer = endOfInput;
+  source.skip_input_data = skipInput;
+  source.resync_to_restart = jpeg_resync_to_restart;
+  source.term_source = noop;
+  state->cinfo.src = &source;
+}
+
+JpegYuvDecoder::~JpegYuvDecoder() {
+  jpeg_destroy_decompress(&state->cinfo);
+  delete state;
+}
+
+bool JpegYuvDecoder::decode(const unsigned char * jpeg, size_t length,
+    const cv::Rect & crop, unsigned char * data, size_t capacity,
+    YuvLayout & layout, int scale) {
+  if (2 != scale && 4 != scale && 8 != scale) {
+    scale = 1;
+  }
+  jpeg_decompress_struct & cinfo = state->cinfo;
+  state->source.next_input_byte = jpeg;
+  state->source.bytes_in_buffer = length;
+
+  // Row pointers handed to libjpeg, one iMCU row of each component
+  JSAMPROW lumaPointers[2 * DCTSIZE];
+  JSAMPROW chromaPointers[2][DCTSIZE];
+  JSAMPARRAY planes[3] = { lumaPointers, chromaPointers[0], chromaPointers[1] };
+
+  // Nothing with a destructor may be created between here and the end
+  // of the decode, libjpeg errors longjmp back to this point
+  if (setjmp(state->error.jump)) {
+    jpeg_abort_decompress(&cinfo);
+    return false;
+  }
+
+  jpeg_read_header(&cinfo, TRUE);
+  if (!cinfo.ac_huff_tbl_ptrs[0] && !cinfo.ac_huff_tbl_ptrs[1] &&
+      !cinfo.dc_huff_tbl_ptrs[0] && !cinfo.dc_huff_tbl_ptrs[1]) {
+    loadMjpegHuffmanTables(&cinfo);
+  }
+
+  const jpeg_component_info * components = cinfo.comp_info;
+  glm::uvec2 subsampling(components[0].h_samp_factor, components[0].v_samp_factor);
+  bool supported = 3 == cinfo.num_components &&
+    JCS_YCbCr == cinfo.jpeg_color_space &&
+    subsampling.x <= 2 && subsampling.y <= 2;
+  for (int i = 1; i < 3 && supported; ++i) {
+    supported = 1 == components[i].h_samp_factor && 1 == components[i].v_samp_factor;
+  }
+  if (!supported) {
+    jpeg_abort_decompress(&cinfo);
+    return false;
+  }
+
+  cinfo.raw_data_out = TRUE;
+  cinfo.do_fancy_upsampling = FALSE;
+  cinfo.dct_method = JDCT_IFAST;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = scale;
+  jpeg_calc_output_dimensions(&cinfo);
+
+  // Scaling shrinks the blocks libjpeg outputs, from DCTSIZE pixels down
+  // to one.  Chroma blocks may shrink less, which upsamples them for free,
+  // so the planes can be less subsampled than the image.
+  const glm::uvec2 lumaBlock(SCALED_BLOCK_WIDTH(components[0]), SCALED_BLOCK_HEIGHT(components[0]));
+  const glm::uvec2 chromaBlock(SCALED_BLOCK_WIDTH(components[1]), SCALED_BLOCK_HEIGHT(components[1]));
+  subsampling = subsampling * lumaBlock / chromaBlock;
+
+  cv::Rect image(0, 0, cinfo.image_width, cinfo.image_height);
+  // everything from here on is in pixels of the scaled image
+  const cv::Rect scaled(crop.x / scale, crop.y / scale, crop.width / scale, crop.height / scale);
+  layout = YuvLayout::forCrop(scaled, subsampling);
+  if ((crop & image) != crop || !scaled.area() || layout.size() > capacity) {
+    jpeg_abort_decompress(&cinfo);
+    return false;
+  }
+  jpeg_start_decompress(&cinfo);
+
+  // libjpeg hands out whole iMCU rows, which are decoded into scratch
+  // rows small enough to stay in cache.  Only the cropped part of each
+  // row is copied to the output.
+  const int lumaRowCount = components[0].v_samp_factor * lumaBlock.y;
+  const int chromaRowCount = chromaBlock.y;
+  const size_t lumaStride = components[0].width_in_blocks * lumaBlock.x;
+  const size_t chromaStride = components[1].width_in_blocks * chromaBlock.x;
+  lumaRows.resize(lumaRowCount * lumaStride);
+  chromaRows.resize(2 * chromaRowCount * chromaStride);
+  for (int row = 0; row < lumaRowCount; ++row) {
+    lumaPointers[row] = &lumaRows[row * lumaStride];
+  }
+  for (int row = 0; row < chromaRowCount; ++row) {
+    chromaPointers[0][row] = &chromaRows[row * chromaStride];
+    chromaPointers[1][row] = &chromaRows[(chromaRowCount + row) * chromaStride];
+  }
+
+  const int cropEnd = scaled.y + scaled.height;
+  const int chromaX = scaled.x / subsampling.x;
+  const int chromaY = scaled.y / subsampling.y;
+  const int chromaEnd = chromaY + layout.chromaSize.y;
+  unsigned char * luma = data + layout.planeOffset(0);
+  while ((int)cinfo.output_scanline < cropEnd) {
+    int first = cinfo.output_scanline;
+    jpeg_read_raw_data(&cinfo, planes, lumaRowCount);
+
+    int last = std::min(first + lumaRowCount, cropEnd);
+    for (int y = std::max(first, scaled.y); y < last; ++y) {
+      memcpy(luma + (y - scaled.y) * layout.lumaSize.x,
+        lumaPointers[y - first] + scaled.x, layout.lumaSize.x);
+    }
+
+    int chromaFirst = first / subsampling.y;
+    int chromaLast = std::min(chromaFirst + chromaRowCount, chromaEnd);
+    for (int plane = 1; plane < 3; ++plane) {
+      unsigned char * chroma = data + layout.planeOffset(plane);
+      for (int y = std::max(chromaFirst, chromaY); y < chromaLast; ++y) {
+        memcpy(chroma + (y - chromaY) * layout.chromaSize.x,
+          chromaPointers[plane - 1][y - chromaFirst] + chromaX, layout.chromaSize.x);
+      }
+    }
+  }
+
+  // Rows below the crop are never decoded
+  jpeg_abort_decompress(&cinfo);
+  return true;
+}
+
+#endif
+
+#endif
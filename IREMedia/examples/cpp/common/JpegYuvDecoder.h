@@ -0,0 +1,81 @@
+#pragma once
+
+#ifdef HAVE_OPENCV
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * Describes where the planes of a cropped YCbCr image live in a single
+ * block of memory.  The Y plane comes first, followed by the Cb and the
+ * Cr plane, each of them tightly packed (stride == width).
+ *
+ * The chroma planes may be subsampled.  If the crop doesn't start on a
+ * chroma sample, the chroma planes start up to one sample early, so
+ * chromaScale / chromaOffset map texture coordinates of the Y plane to
+ * texture coordinates of the chroma planes.
+ */
+struct YuvLayout {
+  glm::uvec2 lumaSize;
+  glm::uvec2 chromaSize;
+  glm::uvec2 subsampling{ 1, 1 };
+  glm::vec2 chromaScale{ 1, 1 };
+  glm::vec2 chromaOffset{ 0, 0 };
+
+  size_t lumaBytes() const {
+    return (size_t)lumaSize.x * lumaSize.y;
+  }
+
+  size_t chromaBytes() const {
+    return (size_t)chromaSize.x * chromaSize.y;
+  }
+
+  size_t size() const {
+    return lumaBytes() + 2 * chromaBytes();
+  }
+
+  // Offset of plane 0 (Y), 1 (Cb) or 2 (Cr)
+  size_t planeOffset(int plane) const {
+    return 0 == plane ? 0 : lumaBytes() + (plane - 1) * chromaBytes();
+  }
+
+  static YuvLayout forCrop(const cv::Rect & crop, const glm::uvec2 & subsampling);
+};
+
+#ifdef HAVE_JPEG
+
+/**
+ * Decodes baseline YCbCr JPEGs (e.g. MJPEG camera frames) straight into
+ * Y, Cb and Cr planes, skipping libjpeg's upsampling and colour
+ * conversion.  Only the crop region is written to the output, and
+ * decoding stops after the last row of the crop.
+ *
+ * Supports chroma subsampled 4:2:0, 4:2:2 and unsubsampled 4:4:4 images,
+ * which covers what UVC cameras deliver.  Not thread safe, use one
+ * decoder per thread.
+ */
+class JpegYuvDecoder {
+public:
+  JpegYuvDecoder();
+  virtual ~JpegYuvDecoder();
+
+  // Decodes the crop region of the image into planes starting at data,
+  // as described by the returned layout.  Fails if the image isn't
+  // supported or the planes would exceed the given capacity.
+  //
+  // A scale of 2, 4 or 8 decodes at that fraction of the resolution,
+  // which libjpeg does in the DCT, so it is a lot faster.  The crop is
+  // still given in full resolution pixels.
+  bool decode(const unsigned char * jpeg, size_t length,
+    const cv::Rect & crop, unsigned char * data, size_t capacity,
+    YuvLayout & layout, int scale = 1);
+
+private:
+  struct State;
+  State * state;
+  std::vector<unsigned char> lumaRows;
+  std::vector<unsigned char> chromaRows;
+};
+
+#endif
+
+#endif
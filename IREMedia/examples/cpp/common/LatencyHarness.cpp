@@ -0,0 +1,61 @@
+#include "Common.h"
+#include "LatencyHarness.h"
+
+#ifdef HAVE_OPENCV
+
+int LatencyHarness::sampleCode(const CapturedFrame & frame) {
+  const cv::Mat & image = frame.image;
+  if (image.empty()) {
+    return 0;
+  }
+  if (FRAME_YUV == frame.format) {
+    // the Y plane comes first, one byte per pixel
+    const YuvLayout & layout = frame.yuv;
+    const unsigned char * luma = image.data + layout.planeOffset(0);
+    return codeOf(luma[(layout.lumaSize.y / 2) * layout.lumaSize.x + layout.lumaSize.x / 2]);
+  }
+  // BGR or BGRA
+  const unsigned char * pixel = image.ptr(image.rows / 2) + (image.cols / 2) * image.channels();
+  return codeOf((pixel[0] + pixel[1] + pixel[2]) / 3);
+}
+
+void LatencyHarness::captured(int code, double captureTime) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (code == lastCaptured) {
+    return;
+  }
+  lastCaptured = code;
+  if (!code) {
+    return;
+  }
+  if (pending[code]) {
+    ++missedCount;
+  }
+  onsets[code] = captureTime;
+  pending[code] = true;
+}
+
+void LatencyHarness::rendered(int code, double renderTime) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (code == lastRendered) {
+    return;
+  }
+  lastRendered = code;
+  if (!code) {
+    return;
+  }
+  if (!pending[code]) {
+    ++unmatchedCount;
+    return;
+  }
+  latencies.add(renderTime - onsets[code]);
+  pending[code] = false;
+}
+
+std::string LatencyHarness::describe() {
+  std::unique_lock<std::mutex> lock(mutex);
+  return Platform::format("capture to render %s ms, %lu flashes missed, %lu unmatched",
+    latencies.describe().c_str(), missedCount, unmatchedCount);
+}
+
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+
+#ifdef HAVE_OPENCV
+
+#include <mutex>
+#include "StereoCapture.h"
+#include "LatencyHistogram.h"
+
+/**
+ * Measures the latency from capture to render with flashes, the way a
+ * photodiode on the screen would, but with the camera images themselves.
+ *
+ * The stereo source shows a black image that flashes to one of a few gray
+ * levels now and then, the level coding which flash it is.  The harness
+ * samples the middle of every captured image and of the rendered eye
+ * image, and pairs the start of each flash on both ends.  Gray levels
+ * survive JPEG compression and YUV conversion, so this works with any
+ * source: the pattern source, a recording of it, or a virtual camera
+ * (e.g. v4l2loopback) fed with one.
+ *
+ * Flashes must be further apart than the latency, so that one has been
+ * rendered before the next one with the same code starts.
+ */
+class LatencyHarness {
+public:
+  // Codes 1 to CODES are flashes, 0 is black
+  static const int CODES = 3;
+
+  static unsigned char levelOf(int code) {
+    return (unsigned char)(code * 255 / CODES);
+  }
+
+  static int codeOf(int luma) {
+    int code = (luma * CODES + 127) / 255;
+    return std::min(std::max(code, 0), CODES);
+  }
+
+  // The code at the middle of a captured image
+  static int sampleCode(const CapturedFrame & frame);
+
+  // Called with the code of every captured image
+  void captured(int code, double captureTime);
+
+  // Called with the code of every rendered image
+  void rendered(int code, double renderTime);
+
+  const LatencyHistogram & getLatencies() const {
+    return latencies;
+  }
+
+  std::string describe();
+
+private:
+  std::mutex mutex;
+  int lastCaptured{ 0 };
+  int lastRendered{ 0 };
+  // when each code's latest flash was captured, if it wasn't rendered yet
+  double onsets[CODES + 1];
+  bool pending[CODES + 1] = {};
+  // flashes captured but never rendered, e.g. because they were too short
+  unsigned long missedCount{ 0 };
+  // flashes rendered that weren't seen being captured
+  unsigned long unmatchedCount{ 0 };
+  LatencyHistogram latencies;
+};
+
+#endif
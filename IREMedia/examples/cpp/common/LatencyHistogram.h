@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * A histogram of durations that any number of threads can add to without
+ * locking, e.g. the time a pipeline stage took for every frame.
+ *
+ * Durations are counted in microseconds, in buckets that double in width
+ * every octave with eight linear buckets per octave, so percentiles are
+ * accurate to about 6% from 8 us up to 31 s.  Longer durations land in
+ * the last bucket, the one of 31 to 33 s (2^25 us).
+ *
+ * Reading while other threads add gives a slightly inconsistent snapshot,
+ * which doesn't matter for statistics.
+ */
+class LatencyHistogram {
+  enum {
+    SUB_BITS = 3,
+    SUB_BUCKETS = 1 << SUB_BITS,
+    MAX_OCTAVE = 24,
+    BUCKETS = (MAX_OCTAVE - SUB_BITS + 2) * SUB_BUCKETS,
+  };
+
+  std::atomic<uint32_t> buckets[BUCKETS];
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> totalMicros;
+  std::atomic<uint64_t> maxMicros;
+
+  static size_t bucketOf(uint64_t micros) {
+    if (micros < SUB_BUCKETS) {
+      return (size_t)micros;
+    }
+    int octave = 0;
+    while (octave < 63 && (micros >> (octave + 1))) {
+      ++octave;
+    }
+    if (octave > MAX_OCTAVE) {
+      return BUCKETS - 1;
+    }
+    size_t sub = (size_t)(micros >> (octave - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (octave - SUB_BITS + 1) * SUB_BUCKETS + sub;
+  }
+
+  // smallest duration counted in the bucket
+  static uint64_t lowerBound(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+      return bucket;
+    }
+    int octave = (int)(bucket / SUB_BUCKETS) - 1 + SUB_BITS;
+    return (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << (octave - SUB_BITS);
+  }
+
+public:
+  LatencyHistogram() {
+    reset();
+  }
+
+  void add(double seconds) {
+    uint64_t micros = seconds > 0 ? (uint64_t)(seconds * 1e6) : 0;
+    buckets[bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    totalMicros.fetch_add(micros, std::memory_order_relaxed);
+    uint64_t previous = maxMicros.load(std::memory_order_relaxed);
+    while (micros > previous &&
+      !maxMicros.compare_exchange_weak(previous, micros, std::memory_order_relaxed)) {
+    }
+  }
+
+  void reset() {
+    for (int i = 0; i < BUCKETS; ++i) {
+      buckets[i] = 0;
+    }
+    count = 0;
+    totalMicros = 0;
+    maxMicros = 0;
+  }
+
+  uint64_t getCount() const {
+    return count;
+  }
+
+  double getMean() const {
+    uint64_t n = count;
+    return n ? totalMicros / (double)n / 1e6 : 0;
+  }
+
+  double getMax() const {
+    return maxMicros / 1e6;
+  }
+
+  // The duration in seconds that the given fraction (0 to 1) of the
+  // samples didn't exceed, as the middle of its bucket
+  double getPercentile(double fraction) const {
+    uint64_t n = count;
+    if (!n) {
+      return 0;
+    }
+    uint64_t rank = (uint64_t)(fraction * n);
+    if (rank >= n) {
+      rank = n - 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      seen += buckets[i].load(std::memory_order_relaxed);
+      if (seen > rank) {
+        if (BUCKETS - 1 == i) {
+          return getMax();
+        }
+        return (lowerBound(i) + lowerBound(i + 1)) / 2.0 / 1e6;
+      }
+    }
+    return getMax();
+  }
+
+  // One line with the count, mean, median, p99 and max in milliseconds
+  std::string describe() const {
+    return Platform::format("n %8llu  mean %7.2f  p50 %7.2f  p99 %7.2f  max %7.2f",
+      (unsigned long long)getCount(), getMean() * 1000.0,
+      getPercentile(0.5) * 1000.0, getPercentile(0.99) * 1000.0,
+      getMax() * 1000.0);
+  }
+};
@@ -0,0 +1,223 @@
+#include "Common.h"
+#include "PixelKernels.h"
+
+#include <cstring>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PIXEL_KERNELS_NEON
+#include <arm_neon.h>
+#elif defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXEL_KERNELS_SSSE3
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SSSE3_TARGET
+#else
+// only these functions may use SSSE3, the rest has to run on any x86
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#endif
+#endif
+
+void PixelKernels::swapRedBlueScalar(const unsigned char * src, unsigned char * dst, size_t pixels) {
+  for (size_t i = 0; i < pixels; ++i, src += 3, dst += 3) {
+    unsigned char blue = src[0];
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = blue;
+  }
+}
+
+void PixelKernels::bgrToBgraScalar(const unsigned char * src, unsigned char * dst, size_t pixels,
+  unsigned char alpha) {
+  for (size_t i = 0; i < pixels; ++i, src += 3, dst += 4) {
+    dst[0] = src[0];
+    dst[1] = src[1];
+    dst[2] = src[2];
+    dst[3] = alpha;
+  }
+}
+
+#ifdef PIXEL_KERNELS_NEON
+
+static void swapRedBlueNeon(const unsigned char * src, unsigned char * dst, size_t pixels) {
+  size_t i = 0;
+  for (; i + 16 <= pixels; i += 16) {
+    uint8x16x3_t bgr = vld3q_u8(src + i * 3);
+    uint8x16_t blue = bgr.val[0];
+    bgr.val[0] = bgr.val[2];
+    bgr.val[2] = blue;
+    vst3q_u8(dst + i * 3, bgr);
+  }
+  PixelKernels::swapRedBlueScalar(src + i * 3, dst + i * 3, pixels - i);
+}
+
+static void bgrToBgraNeon(const unsigned char * src, unsigned char * dst, size_t pixels,
+  unsigned char alpha) {
+  uint8x16x4_t bgra;
+  bgra.val[3] = vdupq_n_u8(alpha);
+  size_t i = 0;
+  for (; i + 16 <= pixels; i += 16) {
+    uint8x16x3_t bgr = vld3q_u8(src + i * 3);
+    bgra.val[0] = bgr.val[0];
+    bgra.val[1] = bgr.val[1];
+    bgra.val[2] = bgr.val[2];
+    vst4q_u8(dst + i * 4, bgra);
+  }
+  PixelKernels::bgrToBgraScalar(src + i * 3, dst + i * 4, pixels - i, alpha);
+}
+
+#endif
+
+#ifdef PIXEL_KERNELS_SSSE3
+
+// Sixteen pixels of three bytes fill three registers, and a pixel may
+// straddle two of them.  Every output register is put together from
+// shuffles of the input registers it takes bytes from, with masks saying
+// which byte of that input goes where, if any.
+typedef unsigned char ShuffleMasks[3][16];
+
+static void buildMasks(const int * sourceOf, int outputs, ShuffleMasks * masks) {
+  for (int out = 0; out < outputs; ++out) {
+    for (int in = 0; in < 3; ++in) {
+      for (int i = 0; i < 16; ++i) {
+        int source = sourceOf[out * 16 + i];
+        masks[out][in][i] = (source >= 0 && source / 16 == in) ? (unsigned char)(source % 16) : 0x80;
+      }
+    }
+  }
+}
+
+static ShuffleMasks swapMasks[3];
+static ShuffleMasks expandMasks[4];
+
+static void buildAllMasks() {
+  int sourceOf[64];
+  for (int i = 0; i < 48; ++i) {
+    int channel = i % 3;
+    sourceOf[i] = i - channel + 2 - channel;
+  }
+  buildMasks(sourceOf, 3, swapMasks);
+  for (int i = 0; i < 64; ++i) {
+    int channel = i % 4;
+    sourceOf[i] = (3 == channel) ? -1 : (i / 4) * 3 + channel;
+  }
+  buildMasks(sourceOf, 4, expandMasks);
+}
+
+static bool hasSsse3() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  return 0 != (info[2] & (1 << 9));
+#else
+  return 0 != __builtin_cpu_supports("ssse3");
+#endif
+}
+
+SSSE3_TARGET static __m128i gather(const ShuffleMasks & masks, const __m128i in[3]) {
+  __m128i result = _mm_setzero_si128();
+  for (int i = 0; i < 3; ++i) {
+    result = _mm_or_si128(result,
+      _mm_shuffle_epi8(in[i], _mm_loadu_si128((const __m128i *)masks[i])));
+  }
+  return result;
+}
+
+SSSE3_TARGET static void swapRedBlueSsse3(const unsigned char * src, unsigned char * dst, size_t pixels) {
+  size_t i = 0;
+  for (; i + 16 <= pixels; i += 16) {
+    const __m128i * from = (const __m128i *)(src + i * 3);
+    __m128i * to = (__m128i *)(dst + i * 3);
+    // all loaded before anything is stored, for working in place
+    __m128i in[3] = { _mm_loadu_si128(from), _mm_loadu_si128(from + 1), _mm_loadu_si128(from + 2) };
+    for (int out = 0; out < 3; ++out) {
+      _mm_storeu_si128(to + out, gather(swapMasks[out], in));
+    }
+  }
+  PixelKernels::swapRedBlueScalar(src + i * 3, dst + i * 3, pixels - i);
+}
+
+SSSE3_TARGET static void bgrToBgraSsse3(const unsigned char * src, unsigned char * dst, size_t pixels,
+  unsigned char alpha) {
+  const __m128i alphas = _mm_set1_epi32((int)((unsigned)alpha << 24));
+  size_t i = 0;
+  for (; i + 16 <= pixels; i += 16) {
+    const __m128i * from = (const __m128i *)(src + i * 3);
+    __m128i * to = (__m128i *)(dst + i * 4);
+    __m128i in[3] = { _mm_loadu_si128(from), _mm_loadu_si128(from + 1), _mm_loadu_si128(from + 2) };
+    for (int out = 0; out < 4; ++out) {
+      _mm_storeu_si128(to + out, _mm_or_si128(gather(expandMasks[out], in), alphas));
+    }
+  }
+  PixelKernels::bgrToBgraScalar(src + i * 3, dst + i * 4, pixels - i, alpha);
+}
+
+#endif
+
+struct Kernels {
+  void (*swapRedBlue)(const unsigned char * src, unsigned char * dst, size_t pixels);
+  void (*bgrToBgra)(const unsigned char * src, unsigned char * dst, size_t pixels, unsigned char alpha);
+  const char * instructionSet;
+};
+
+static Kernels selectKernels() {
+  Kernels result = { PixelKernels::swapRedBlueScalar, PixelKernels::bgrToBgraScalar, "none" };
+#if defined(PIXEL_KERNELS_NEON)
+  result.swapRedBlue = swapRedBlueNeon;
+  result.bgrToBgra = bgrToBgraNeon;
+  result.instructionSet = "NEON";
+#elif defined(PIXEL_KERNELS_SSSE3)
+  if (hasSsse3()) {
+    buildAllMasks();
+    result.swapRedBlue = swapRedBlueSsse3;
+    result.bgrToBgra = bgrToBgraSsse3;
+    result.instructionSet = "SSSE3";
+  }
+#endif
+  return result;
+}
+
+// Picked before main() runs, so capture threads never race to do it
+static const Kernels kernels = selectKernels();
+
+void PixelKernels::copy(const unsigned char * src, unsigned char * dst, size_t bytes) {
+  // the C library already copies with the widest vectors the CPU has
+  memcpy(dst, src, bytes);
+}
+
+void PixelKernels::flipRows(const unsigned char * src, size_t srcStride,
+  unsigned char * dst, size_t dstStride, size_t rowBytes, size_t rows) {
+  for (size_t row = 0; row < rows; ++row) {
+    memcpy(dst + row * dstStride, src + (rows - 1 - row) * srcStride, rowBytes);
+  }
+}
+
+void PixelKernels::swapRedBlue(const unsigned char * src, unsigned char * dst, size_t pixels) {
+  kernels.swapRedBlue(src, dst, pixels);
+}
+
+void PixelKernels::bgrToBgra(const unsigned char * src, unsigned char * dst, size_t pixels,
+  unsigned char alpha) {
+  kernels.bgrToBgra(src, dst, pixels, alpha);
+}
+
+void PixelKernels::cropFlip(const unsigned char * src, size_t srcStride,
+  unsigned char * dst, size_t dstStride, int x, int y, int width, int height,
+  int pixelBytes, bool flip, bool swapRedBlue) {
+  bool swap = swapRedBlue && 3 == pixelBytes;
+  size_t rowBytes = (size_t)width * pixelBytes;
+  for (int row = 0; row < height; ++row) {
+    int sourceRow = flip ? y + height - 1 - row : y + row;
+    const unsigned char * from = src + sourceRow * srcStride + (size_t)x * pixelBytes;
+    unsigned char * to = dst + row * dstStride;
+    if (swap) {
+      kernels.swapRedBlue(from, to, width);
+    } else {
+      memcpy(to, from, rowBytes);
+    }
+  }
+}
+
+const char * PixelKernels::getInstructionSet() {
+  return kernels.instructionSet;
+}
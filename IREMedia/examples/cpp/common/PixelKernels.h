@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * The pixel shuffling the capture paths do on every frame: copies, flips,
+ * swapping red and blue and adding alpha.  Kernels with SSSE3 or NEON are
+ * picked at startup where the CPU has them, with plain C++ as fallback,
+ * so all of this works on any compiler and architecture.
+ *
+ * Pixels are tightly packed bytes.  Strides are in bytes and may be
+ * larger than a row.
+ */
+class PixelKernels {
+public:
+  static void copy(const unsigned char * src, unsigned char * dst, size_t bytes);
+
+  // Copies rows in reverse order, the last row of the source becoming
+  // the first of the destination
+  static void flipRows(const unsigned char * src, size_t srcStride,
+    unsigned char * dst, size_t dstStride, size_t rowBytes, size_t rows);
+
+  // BGR to RGB or back, three bytes per pixel.  Works in place.
+  static void swapRedBlue(const unsigned char * src, unsigned char * dst, size_t pixels);
+
+  // Three byte pixels to four, the fourth being alpha.  Doesn't work in
+  // place.
+  static void bgrToBgra(const unsigned char * src, unsigned char * dst, size_t pixels,
+    unsigned char alpha = 255);
+
+  // Copies the width x height region at x, y of the source in one pass,
+  // optionally flipped vertically and, with three byte pixels, with red
+  // and blue swapped
+  static void cropFlip(const unsigned char * src, size_t srcStride,
+    unsigned char * dst, size_t dstStride, int x, int y, int width, int height,
+    int pixelBytes, bool flip, bool swapRedBlue);
+
+  // The instruction set the kernels use on this CPU, for the log
+  static const char * getInstructionSet();
+
+  // The plain C++ versions, which the vector ones have to match
+  static void swapRedBlueScalar(const unsigned char * src, unsigned char * dst, size_t pixels);
+  static void bgrToBgraScalar(const unsigned char * src, unsigned char * dst, size_t pixels,
+    unsigned char alpha = 255);
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <mutex>
+#include <glm/gtc/quaternion.hpp>
+
+/**
+ * The head orientations the sensor recorded over the last second or so,
+ * for looking up where the head pointed at a time in the past, e.g. when
+ * a camera frame was captured.  Such a time lies between two samples,
+ * which are interpolated.  The SDK would instead extrapolate back from
+ * its newest sample with the angular velocity of now, which is wrong just
+ * when the head starts or stops turning.
+ *
+ * One thread adds samples, any thread may look them up.
+ */
+class PoseHistory {
+  enum {
+    CAPACITY = 128,
+  };
+
+  mutable std::mutex mutex;
+  double times[CAPACITY];
+  glm::quat orientations[CAPACITY];
+  // index of the newest sample
+  size_t newest{ 0 };
+  size_t count{ 0 };
+
+public:
+  // Samples older than the newest one are ignored
+  void add(double time, const glm::quat & orientation) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (count && time <= times[newest]) {
+      return;
+    }
+    newest = (newest + 1) % CAPACITY;
+    times[newest] = time;
+    orientations[newest] = orientation;
+    count = std::min<size_t>(count + 1, CAPACITY);
+  }
+
+  // False if the time isn't between the oldest and the newest sample
+  bool orientationAt(double time, glm::quat & orientation) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!count || time > times[newest]) {
+      return false;
+    }
+    // the times asked for are recent, so search back from the newest
+    size_t after = newest;
+    for (size_t i = 1; i < count; ++i) {
+      size_t before = (newest + CAPACITY - i) % CAPACITY;
+      if (times[before] <= time) {
+        float fraction = (float)((time - times[before]) / (times[after] - times[before]));
+        orientation = glm::slerp(orientations[before], orientations[after], fraction);
+        return true;
+      }
+      after = before;
+    }
+    if (time == times[after]) {
+      orientation = orientations[after];
+      return true;
+    }
+    return false;
+  }
+};
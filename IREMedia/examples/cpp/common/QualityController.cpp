@@ -0,0 +1,74 @@
+#include "Common.h"
+#include "QualityController.h"
+
+#ifdef HAVE_OPENCV
+
+QualityController::QualityController(double targetSeconds, bool scalable, double windowSeconds)
+  : targetSeconds(targetSeconds), windowSeconds(windowSeconds) {
+  levels.push_back(StreamQuality(1, 1));
+  if (scalable) {
+    levels.push_back(StreamQuality(2, 1));
+    levels.push_back(StreamQuality(4, 1));
+    levels.push_back(StreamQuality(4, 2));
+    levels.push_back(StreamQuality(8, 2));
+  } else {
+    levels.push_back(StreamQuality(1, 2));
+    levels.push_back(StreamQuality(1, 3));
+  }
+}
+
+bool QualityController::addFrameAge(double age, double now) {
+  if (windowStart <= 0) {
+    windowStart = now;
+  }
+  ages.add(age);
+  if (now - windowStart < windowSeconds) {
+    return false;
+  }
+
+  lastAge = ages.getPercentile(0.9);
+  ages.reset();
+  windowStart = now;
+  if (settling) {
+    settling = false;
+    return false;
+  }
+
+  size_t wanted = level;
+  if (lastAge > targetSeconds * 1.25) {
+    goodWindows = 0;
+    if (level + 1 < levels.size()) {
+      wanted = level + 1;
+    }
+  } else if (lastAge < targetSeconds * 0.75) {
+    if (++goodWindows >= RECOVERY_WINDOWS && level > 0) {
+      wanted = level - 1;
+    }
+  } else {
+    goodWindows = 0;
+  }
+  if (wanted == level) {
+    return false;
+  }
+  level = wanted;
+  goodWindows = 0;
+  settling = true;
+  return true;
+}
+
+void QualityController::reset() {
+  level = 0;
+  ages.reset();
+  windowStart = 0;
+  lastAge = 0;
+  settling = false;
+  goodWindows = 0;
+}
+
+std::string QualityController::describe() const {
+  const StreamQuality & quality = getQuality();
+  return Platform::format("decoding at 1/%d resolution, one pair in %d (frame age p90 %0.1f ms, target %0.1f ms)",
+    quality.decodeScale, quality.frameDecimation, lastAge * 1000.0, targetSeconds * 1000.0);
+}
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+
+#ifdef HAVE_OPENCV
+
+#include <vector>
+#include "StereoSource.h"
+#include "LatencyHistogram.h"
+
+/**
+ * Keeps the age of the camera images at the display near a target by
+ * stepping the quality of a stereo source down when the pipeline can't
+ * keep up, and back up once there is room again.
+ *
+ * The ages are judged a window at a time by their 90th percentile.  A
+ * window well over the target steps down right away, it takes a few well
+ * below the target in a row to step up, so the quality doesn't flap at
+ * the edge.  The window after a step is ignored, the pipeline still being
+ * full of frames from before.
+ *
+ * The levels first decode at a lower resolution, which costs the least
+ * sharpness for the time saved, and only then skip pairs.  Sources that
+ * can't scale (BGR frames) only skip pairs.
+ */
+class QualityController {
+public:
+  QualityController(double targetSeconds, bool scalable, double windowSeconds = 1.0);
+
+  // Called with the age of every image the display shows, and the time
+  // it's shown at.  Returns true if the quality changed.
+  bool addFrameAge(double age, double now);
+
+  // Back to full quality, e.g. when the controller is turned off
+  void reset();
+
+  const StreamQuality & getQuality() const {
+    return levels[level];
+  }
+
+  double getTargetSeconds() const {
+    return targetSeconds;
+  }
+
+  // A line about the current quality and why it was chosen, for the log
+  std::string describe() const;
+
+private:
+  // windows below the target it takes to step up
+  static const int RECOVERY_WINDOWS = 3;
+
+  const double targetSeconds;
+  const double windowSeconds;
+  std::vector<StreamQuality> levels;
+  size_t level{ 0 };
+  LatencyHistogram ages;
+  double windowStart{ 0 };
+  // age of the last complete window
+  double lastAge{ 0 };
+  bool settling{ false };
+  int goodWindows{ 0 };
+};
+
+#endif
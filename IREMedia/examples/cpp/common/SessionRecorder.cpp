@@ -0,0 +1,359 @@
+#include "Common.h"
+#include "SessionRecorder.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static size_t padded(size_t size) {
+  return (size + 7) & ~(size_t)7;
+}
+
+SessionRecorder::SessionRecorder(const std::string & path, size_t chunkSize, size_t maxPendingChunks)
+  : chunkSize(chunkSize), maxPendingChunks(std::max<size_t>(maxPendingChunks, 1)),
+  droppedCount(0), writtenBytes(0) {
+  file = fopen(path.c_str(), "wb");
+  if (!file) {
+    SAY_ERR("Unable to open %s for recording", path.c_str());
+    return;
+  }
+  // chunks are large enough, don't copy them through stdio's buffer
+  setvbuf(file, nullptr, _IONBF, 0);
+
+  SessionFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SESSION_FILE_MAGIC, sizeof(header.magic));
+  header.version = 1;
+  if (1 != fwrite(&header, sizeof(header), 1, file)) {
+    SAY_ERR("Unable to write to %s", path.c_str());
+    fclose(file);
+    file = nullptr;
+    return;
+  }
+  fileOffset = sizeof(header);
+
+  writer = std::thread(&SessionRecorder::run, this);
+}
+
+SessionRecorder::~SessionRecorder() {
+  close();
+}
+
+void SessionRecorder::addFrame(int camera, double time, const unsigned char * data, size_t size) {
+  add(SESSION_FRAME, camera, time, data, size);
+}
+
+void SessionRecorder::addPose(double time, const ovrPoseStatef & pose) {
+  SessionPose record;
+  memset(&record, 0, sizeof(record));
+  record.orientation[0] = pose.Pose.Orientation.x;
+  record.orientation[1] = pose.Pose.Orientation.y;
+  record.orientation[2] = pose.Pose.Orientation.z;
+  record.orientation[3] = pose.Pose.Orientation.w;
+  record.position[0] = pose.Pose.Position.x;
+  record.position[1] = pose.Pose.Position.y;
+  record.position[2] = pose.Pose.Position.z;
+  record.angularVelocity[0] = pose.AngularVelocity.x;
+  record.angularVelocity[1] = pose.AngularVelocity.y;
+  record.angularVelocity[2] = pose.AngularVelocity.z;
+  record.linearVelocity[0] = pose.LinearVelocity.x;
+  record.linearVelocity[1] = pose.LinearVelocity.y;
+  record.linearVelocity[2] = pose.LinearVelocity.z;
+  record.sampleTime = pose.TimeInSeconds;
+  add(SESSION_POSE, 0, time, &record, sizeof(record));
+}
+
+void SessionRecorder::add(uint32_t type, uint32_t stream, double time,
+    const void * payload, size_t size) {
+  size_t recordSize = sizeof(SessionRecordHeader) + padded(size);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!file || closing) {
+    return;
+  }
+  if (failed) {
+    ++droppedCount;
+    return;
+  }
+  if (!current.data.empty() && current.entry.recordCount &&
+      current.data.size() + recordSize > chunkSize) {
+    if (pending.size() >= maxPendingChunks) {
+      // the disk can't keep up, rather lose records than block the caller
+      ++droppedCount;
+      return;
+    }
+    finishChunk();
+  }
+  if (current.data.empty()) {
+    startChunk();
+  }
+
+  SessionRecordHeader header;
+  memset(&header, 0, sizeof(header));
+  header.type = type;
+  header.stream = stream;
+  header.time = time;
+  header.size = (uint32_t)size;
+
+  std::vector<unsigned char> & data = current.data;
+  size_t offset = data.size();
+  data.resize(offset + recordSize);
+  memcpy(&data[offset], &header, sizeof(header));
+  if (size) {
+    memcpy(&data[offset + sizeof(header)], payload, size);
+    memset(&data[offset + sizeof(header)] + size, 0, padded(size) - size);
+  }
+
+  SessionIndexEntry & entry = current.entry;
+  if (0 == entry.recordCount) {
+    entry.firstTime = time;
+    entry.lastTime = time;
+  }
+  entry.firstTime = std::min(entry.firstTime, time);
+  entry.lastTime = std::max(entry.lastTime, time);
+  ++entry.recordCount;
+}
+
+// Called with the mutex held
+void SessionRecorder::startChunk() {
+  if (!spare.empty()) {
+    current.data.swap(spare.back());
+    spare.pop_back();
+  }
+  current.data.reserve(chunkSize);
+  current.data.resize(sizeof(SessionChunkHeader));
+  memset(&current.entry, 0, sizeof(current.entry));
+}
+
+// Called with the mutex held
+void SessionRecorder::finishChunk() {
+  pending.push_back(Chunk());
+  pending.back().data.swap(current.data);
+  pending.back().entry = current.entry;
+  memset(&current.entry, 0, sizeof(current.entry));
+  ready.notify_one();
+}
+
+void SessionRecorder::run() {
+  while (true) {
+    Chunk chunk;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      ready.wait(lock, [&]{
+        return closing || !pending.empty();
+      });
+      if (pending.empty()) {
+        return;
+      }
+      chunk.data.swap(pending.front().data);
+      chunk.entry = pending.front().entry;
+      pending.pop_front();
+    }
+
+    SessionChunkHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SESSION_CHUNK_MAGIC;
+    header.recordCount = chunk.entry.recordCount;
+    header.size = chunk.data.size() - sizeof(header);
+    header.firstTime = chunk.entry.firstTime;
+    header.lastTime = chunk.entry.lastTime;
+    memcpy(&chunk.data[0], &header, sizeof(header));
+
+    if (1 != fwrite(&chunk.data[0], chunk.data.size(), 1, file)) {
+      // part of the chunk may be on disk, so nothing after it would be
+      // where the index says
+      SAY_ERR("Unable to write session chunk, recording stopped");
+      std::unique_lock<std::mutex> lock(mutex);
+      failed = true;
+      unsigned long lost = chunk.entry.recordCount + current.entry.recordCount;
+      for (size_t i = 0; i < pending.size(); ++i) {
+        lost += pending[i].entry.recordCount;
+      }
+      droppedCount += lost;
+      pending.clear();
+      current.data.clear();
+      memset(&current.entry, 0, sizeof(current.entry));
+      return;
+    }
+    chunk.entry.offset = fileOffset;
+    index.push_back(chunk.entry);
+    fileOffset += chunk.data.size();
+    writtenBytes += chunk.data.size();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    chunk.data.clear();
+    spare.push_back(std::vector<unsigned char>());
+    spare.back().swap(chunk.data);
+  }
+}
+
+void SessionRecorder::close() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!file || closing) {
+      return;
+    }
+    if (current.entry.recordCount) {
+      finishChunk();
+    }
+    closing = true;
+  }
+  ready.notify_all();
+  writer.join();
+
+  if (failed) {
+    fclose(file);
+    file = nullptr;
+    return;
+  }
+
+  SessionFileFooter footer;
+  memset(&footer, 0, sizeof(footer));
+  footer.indexOffset = fileOffset;
+  footer.chunkCount = index.size();
+  memcpy(footer.magic, SESSION_INDEX_MAGIC, sizeof(footer.magic));
+  if (!index.empty()) {
+    fwrite(&index[0], sizeof(SessionIndexEntry), index.size(), file);
+  }
+  fwrite(&footer, sizeof(footer), 1, file);
+  fclose(file);
+  file = nullptr;
+}
+
+SessionReader::SessionReader(const std::string & path) {
+#ifdef WIN32
+  fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+    OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+  if (INVALID_HANDLE_VALUE == fileHandle) {
+    SAY_ERR("Unable to open %s", path.c_str());
+    return;
+  }
+  LARGE_INTEGER fileSize;
+  GetFileSizeEx(fileHandle, &fileSize);
+  size = (size_t)fileSize.QuadPart;
+  mapping = CreateFileMapping(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping) {
+    base = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  }
+#else
+  fileHandle = open(path.c_str(), O_RDONLY);
+  if (-1 == fileHandle) {
+    SAY_ERR("Unable to open %s", path.c_str());
+    return;
+  }
+  struct stat status;
+  fstat(fileHandle, &status);
+  size = (size_t)status.st_size;
+  void * mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fileHandle, 0);
+  if (MAP_FAILED != mapped) {
+    base = (const unsigned char *)mapped;
+  }
+#endif
+  if (!base) {
+    SAY_ERR("Unable to map %s", path.c_str());
+    return;
+  }
+
+  const SessionFileHeader * header = (const SessionFileHeader *)base;
+  if (size < sizeof(SessionFileHeader) || 0 != memcmp(header->magic, SESSION_FILE_MAGIC, sizeof(header->magic))) {
+    SAY_ERR("%s is no session file", path.c_str());
+    return;
+  }
+
+  // files cut off mid-write end anywhere, so copy rather than cast
+  SessionFileFooter footer;
+  memset(&footer, 0, sizeof(footer));
+  if (size >= sizeof(SessionFileHeader) + sizeof(SessionFileFooter)) {
+    memcpy(&footer, base + size - sizeof(SessionFileFooter), sizeof(footer));
+  }
+  if (0 == memcmp(footer.magic, SESSION_INDEX_MAGIC, sizeof(footer.magic)) &&
+      footer.indexOffset + footer.chunkCount * sizeof(SessionIndexEntry) <= size - sizeof(SessionFileFooter)) {
+    const SessionIndexEntry * entries = (const SessionIndexEntry *)(base + footer.indexOffset);
+    chunks.assign(entries, entries + footer.chunkCount);
+  } else {
+    // the recording wasn't closed, find the complete chunks
+    scanChunks();
+  }
+  valid = true;
+}
+
+SessionReader::~SessionReader() {
+#ifdef WIN32
+  if (base) {
+    UnmapViewOfFile(base);
+  }
+  if (mapping) {
+    CloseHandle(mapping);
+  }
+  if (INVALID_HANDLE_VALUE != fileHandle) {
+    CloseHandle(fileHandle);
+  }
+#else
+  if (base) {
+    munmap((void *)base, size);
+  }
+  if (-1 != fileHandle) {
+    ::close(fileHandle);
+  }
+#endif
+}
+
+void SessionReader::scanChunks() {
+  uint64_t offset = sizeof(SessionFileHeader);
+  while (offset + sizeof(SessionChunkHeader) <= size) {
+    const SessionChunkHeader * header = (const SessionChunkHeader *)(base + offset);
+    uint64_t end = offset + sizeof(SessionChunkHeader) + header->size;
+    if (SESSION_CHUNK_MAGIC != header->magic || end > size) {
+      break;
+    }
+    SessionIndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = offset;
+    entry.firstTime = header->firstTime;
+    entry.lastTime = header->lastTime;
+    entry.recordCount = header->recordCount;
+    chunks.push_back(entry);
+    offset = end;
+  }
+}
+
+size_t SessionReader::findChunk(double time) const {
+  auto itr = std::upper_bound(chunks.begin(), chunks.end(), time,
+    [](double time, const SessionIndexEntry & entry){
+      return time < entry.firstTime;
+    });
+  return itr == chunks.begin() ? 0 : (itr - chunks.begin()) - 1;
+}
+
+bool SessionReader::forEachRecord(size_t chunk, std::function<bool(const Record &)> visitor) const {
+  if (chunk >= chunks.size()) {
+    return false;
+  }
+  const SessionChunkHeader * header = (const SessionChunkHeader *)(base + chunks[chunk].offset);
+  uint64_t offset = chunks[chunk].offset + sizeof(SessionChunkHeader);
+  uint64_t end = offset + header->size;
+  for (uint32_t i = 0; i < header->recordCount; ++i) {
+    if (offset + sizeof(SessionRecordHeader) > end) {
+      return false;
+    }
+    const SessionRecordHeader * recordHeader = (const SessionRecordHeader *)(base + offset);
+    offset += sizeof(SessionRecordHeader);
+    if (offset + recordHeader->size > end) {
+      return false;
+    }
+    Record record;
+    record.type = (SessionRecordType)recordHeader->type;
+    record.stream = recordHeader->stream;
+    record.time = recordHeader->time;
+    record.data = base + offset;
+    record.size = recordHeader->size;
+    if (!visitor(record)) {
+      return true;
+    }
+    offset += padded(recordHeader->size);
+  }
+  return true;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Session files hold the compressed camera frames and head poses of a
+ * session, so it can be replayed later.  All values are little endian,
+ * every structure and record is 8 byte aligned.
+ *
+ *   SessionFileHeader
+ *   chunk 0: SessionChunkHeader, records
+ *   chunk 1: ...
+ *   index: one SessionIndexEntry per chunk
+ *   SessionFileFooter
+ *
+ * A record is a SessionRecordHeader followed by its payload, padded to
+ * 8 bytes.  Chunks are written in one piece, so a file that wasn't closed
+ * properly (and has no index) is still readable up to its last complete
+ * chunk.
+ */
+#define SESSION_FILE_MAGIC "IRESESS1"
+#define SESSION_INDEX_MAGIC "IREINDEX"
+#define SESSION_CHUNK_MAGIC 0x4b4e4843 // "CHNK"
+
+enum SessionRecordType {
+  // compressed (MJPEG) frame of the camera given by the stream
+  SESSION_FRAME = 1,
+  // a SessionPose
+  SESSION_POSE = 2,
+};
+
+struct SessionFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct SessionChunkHeader {
+  uint32_t magic;
+  uint32_t recordCount;
+  // bytes of records following the header
+  uint64_t size;
+  double firstTime;
+  double lastTime;
+};
+
+struct SessionRecordHeader {
+  uint32_t type;
+  uint32_t stream;
+  // ovr_GetTimeInSeconds() of the capture or sample
+  double time;
+  // payload bytes, without padding
+  uint32_t size;
+  uint32_t reserved;
+};
+
+struct SessionIndexEntry {
+  // file offset of the chunk header
+  uint64_t offset;
+  double firstTime;
+  double lastTime;
+  uint32_t recordCount;
+  uint32_t reserved;
+};
+
+struct SessionFileFooter {
+  uint64_t indexOffset;
+  uint64_t chunkCount;
+  char magic[8];
+};
+
+// Payload of SESSION_POSE records, the sensor's recorded head pose
+struct SessionPose {
+  float orientation[4]; // x, y, z, w
+  float position[3];
+  float angularVelocity[3];
+  float linearVelocity[3];
+  float reserved;
+  double sampleTime;
+};
+
+/**
+ * Records a session from any number of threads without making them wait
+ * for the disk.  Records are copied into a chunk in memory, full chunks
+ * are written by a background thread in a single write each.  If the disk
+ * falls behind and too many chunks are waiting, new records are dropped.
+ * A failed write ends the recording, since the offsets of anything after
+ * it would be unknown: later records are dropped and the file gets no
+ * index, leaving it readable up to the last complete chunk.
+ */
+class SessionRecorder {
+public:
+  SessionRecorder(const std::string & path, size_t chunkSize = 8 << 20, size_t maxPendingChunks = 16);
+  virtual ~SessionRecorder();
+
+  bool isOpen() const {
+    return nullptr != file;
+  }
+
+  void addFrame(int camera, double time, const unsigned char * data, size_t size);
+  void addPose(double time, const ovrPoseStatef & pose);
+
+  // Writes the remaining records and the index.  Called by the destructor.
+  void close();
+
+  unsigned long getDroppedCount() const {
+    return droppedCount;
+  }
+
+  uint64_t getWrittenBytes() const {
+    return writtenBytes;
+  }
+
+private:
+  struct Chunk {
+    std::vector<unsigned char> data;
+    SessionIndexEntry entry;
+  };
+
+  void add(uint32_t type, uint32_t stream, double time,
+    const void * payload, size_t size);
+  void startChunk();
+  void finishChunk();
+  void run();
+
+  FILE * file{ nullptr };
+  const size_t chunkSize;
+  const size_t maxPendingChunks;
+  std::mutex mutex;
+  std::condition_variable ready;
+  Chunk current;
+  std::deque<Chunk> pending;
+  std::vector<std::vector<unsigned char>> spare;
+  // only touched by the writer thread
+  std::vector<SessionIndexEntry> index;
+  uint64_t fileOffset{ 0 };
+  bool closing{ false };
+  // set by the writer thread under the mutex when a write failed
+  bool failed{ false };
+  std::thread writer;
+  std::atomic<unsigned long> droppedCount;
+  std::atomic<uint64_t> writtenBytes;
+};
+
+/**
+ * Reads a session file by mapping it into memory, so jumping to any point
+ * in time only touches the pages of the chunk needed.
+ */
+class SessionReader {
+public:
+  struct Record {
+    SessionRecordType type;
+    int stream;
+    double time;
+    const unsigned char * data;
+    size_t size;
+  };
+
+  SessionReader(const std::string & path);
+  virtual ~SessionReader();
+
+  bool isOpen() const {
+    return valid;
+  }
+
+  size_t getChunkCount() const {
+    return chunks.size();
+  }
+
+  const SessionIndexEntry & getChunk(size_t chunk) const {
+    return chunks[chunk];
+  }
+
+  // The last chunk starting at or before the time
+  size_t findChunk(double time) const;
+
+  // Calls the visitor for every record of the chunk, until it returns false
+  bool forEachRecord(size_t chunk, std::function<bool(const Record &)> visitor) const;
+
+private:
+  void scanChunks();
+
+  const unsigned char * base{ nullptr };
+  size_t size{ 0 };
+  bool valid{ false };
+#ifdef WIN32
+  HANDLE fileHandle{ INVALID_HANDLE_VALUE };
+  HANDLE mapping{ nullptr };
+#else
+  int fileHandle{ -1 };
+#endif
+  std::vector<SessionIndexEntry> chunks;
+};
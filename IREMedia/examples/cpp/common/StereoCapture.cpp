@@ -0,0 +1,363 @@
+#include "Common.h"
+#include "StereoCapture.h"
+#include "DecodePool.h"
+#include "PixelKernels.h"
+#include "FramePool.h"
+
+#ifdef HAVE_OPENCV
+
+// Properties of the bundled highgui's V4L backend (CV_CAP_PROP_ROI_*,
+// CV_CAP_PROP_BUFFERSIZE, ...), which other OpenCV builds reject
+enum {
+  CAP_PROP_BUFFERSIZE = 38,
+  CAP_PROP_ROI_X = 1100,
+  CAP_PROP_ROI_Y = 1101,
+  CAP_PROP_ROI_WIDTH = 1102,
+  CAP_PROP_ROI_HEIGHT = 1103,
+  CAP_PROP_LATEST_FRAME = 1104,
+  CAP_PROP_FRAME_AGE_MSEC = 1105,
+};
+
+void CapturedFrame::store(const cv::Mat & bgr) {
+  if (FRAME_BGRA == format && CV_8UC3 == bgr.type()) {
+    image = target.data ? cv::Mat(bgr.rows, bgr.cols, CV_8UC4, target.data, target.stride) :
+      cv::Mat(bgr.rows, bgr.cols, CV_8UC4);
+    for (int row = 0; row < bgr.rows; ++row) {
+      PixelKernels::bgrToBgra(bgr.ptr(row), image.ptr(row), bgr.cols);
+    }
+    return;
+  }
+  format = FRAME_BGR;
+  if (target.data) {
+    image = cv::Mat(bgr.rows, bgr.cols, bgr.type(), target.data, target.stride);
+    bgr.copyTo(image);
+  } else {
+    image = bgr.clone();
+  }
+}
+
+CameraCapture::CameraCapture(int device, const glm::uvec2 & size)
+  : device(device), crop(0, 0, size.x, size.y), droppedCount(0), running(false) {
+  open(size);
+}
+
+CameraCapture::CameraCapture(int device, const glm::uvec2 & size, const cv::Rect & crop)
+  : device(device), crop(crop), droppedCount(0), running(false) {
+  open(size);
+}
+
+void CameraCapture::open(const glm::uvec2 & size) {
+  capture = cvCaptureFromCAM(device);
+  if (!capture) {
+    SAY_ERR("Unable to open camera %d", device);
+    return;
+  }
+  cvSetCaptureProperty(capture, CV_CAP_PROP_FOURCC, CV_FOURCC('M', 'J', 'P', 'G'));
+  cvSetCaptureProperty(capture, CV_CAP_PROP_FRAME_WIDTH, size.x);
+  cvSetCaptureProperty(capture, CV_CAP_PROP_FRAME_HEIGHT, size.y);
+
+  // Backends that support it only decode the crop, and retrieve images
+  // of its size
+  cvSetCaptureProperty(capture, CAP_PROP_ROI_X, crop.x);
+  cvSetCaptureProperty(capture, CAP_PROP_ROI_Y, crop.y);
+  cvSetCaptureProperty(capture, CAP_PROP_ROI_WIDTH, crop.width);
+  cvSetCaptureProperty(capture, CAP_PROP_ROI_HEIGHT, crop.height);
+
+  // Only ask for the age of every frame if the backend knows it
+  frameAge = cvGetCaptureProperty(capture, CAP_PROP_FRAME_AGE_MSEC) >= 0;
+}
+
+CameraCapture::~CameraCapture() {
+  stop();
+  if (capture) {
+    cvReleaseCapture(&capture);
+  }
+}
+
+bool CameraCapture::setBufferCount(int count) {
+  return capture && 0 != cvSetCaptureProperty(capture, CAP_PROP_BUFFERSIZE, count);
+}
+
+bool CameraCapture::setLatestFrameOnly(bool latest) {
+  return capture && 0 != cvSetCaptureProperty(capture, CAP_PROP_LATEST_FRAME, latest ? 1 : 0);
+}
+
+void CameraCapture::start(Callback callback) {
+  if (running || !capture) {
+    return;
+  }
+  this->callback = callback;
+
+  // Decoding ourselves, on this thread or in the pool, needs the frames
+  // as they come from the camera
+  bool compressed = false;
+  if (FrameDecoder::supports(format) && (pool || compressedCallback || FRAME_YUV == format)) {
+    compressed = 0 != cvSetCaptureProperty(capture, CV_CAP_PROP_CONVERT_RGB, 0);
+  }
+  if (!compressed && FRAME_YUV == format) {
+    SAY_ERR("Camera %d can't deliver YUV frames, using BGR", device);
+    format = FRAME_BGR;
+  }
+  if (!compressed && pool) {
+    SAY_ERR("Camera %d can't deliver compressed frames, decoding on the capture thread", device);
+    pool = nullptr;
+  }
+
+  if (!sink) {
+    // YUV planes take no more than packed BGR
+    size_t stride = packedStride(format, crop.width);
+    ownPool = std::unique_ptr<FramePool>(new FramePool(stride * crop.height, stride, poolFrames, poolHugePages));
+    sink = ownPool.get();
+    FramePool * frames = ownPool.get();
+    Callback consumer = callback;
+    this->callback = callback = [=](CapturedFrame & frame){
+      frames->adopt(frame);
+      consumer(frame);
+    };
+  }
+
+  if (pool) {
+    DecodePool::Source source;
+    source.crop = crop;
+    source.format = format;
+    source.sink = sink;
+    source.callback = callback;
+    poolSource = pool->addSource(source);
+  } else if (compressed) {
+    decoder = std::unique_ptr<FrameDecoder>(new FrameDecoder());
+  }
+  running = true;
+  thread = std::thread(&CameraCapture::run, this);
+  if (!cpus.empty() && !Platform::setThreadAffinity(thread, cpus)) {
+    SAY_ERR("Unable to pin the capture thread of camera %d", device);
+  }
+}
+
+void CameraCapture::stop() {
+  running = false;
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+void CameraCapture::run() {
+  CapturedFrame frame;
+  while (running) {
+    // Grabbing only dequeues the buffer from the driver, so this is
+    // the closest we get to the real capture time, unless the backend
+    // knows when the driver filled the buffer.  Decoding happens in the
+    // retrieve call.
+    if (!cvGrabFrame(capture)) {
+      SAY("Didn't get image of cam %d", device);
+      continue;
+    }
+    frame.dequeueTime = ovr_GetTimeInSeconds();
+    frame.captureTime = frame.dequeueTime;
+    if (frameAge) {
+      double age = cvGetCaptureProperty(capture, CAP_PROP_FRAME_AGE_MSEC);
+      if (age > 0 && age < 1000) {
+        frame.captureTime -= age / 1000.0;
+      }
+    }
+
+    // Compressed frames are only a header over the driver's buffer
+    IplImage * image = nullptr;
+    if (pool || decoder) {
+      image = cvRetrieveFrame(capture);
+      if (!image) {
+        SAY("Unable to retrieve image of cam %d", device);
+        continue;
+      }
+      if (compressedCallback) {
+        compressedCallback((const unsigned char *)image->imageData,
+          image->width, frame.captureTime);
+      }
+    }
+
+    if (frameFilter && !frameFilter(frame.captureTime)) {
+      continue;
+    }
+
+    if (pool) {
+      // Only copy the compressed frame out of the driver's buffer, the
+      // pool decodes it
+      DecodePool::Buffer data = pool->takeBuffer();
+      data.assign(image->imageData, image->imageData + image->width);
+      pool->submit(poolSource, data, frame.captureTime, frame.dequeueTime);
+      continue;
+    }
+
+    // Without memory to put it in, don't bother decoding the frame
+    if (sink && !sink->acquire(frame.target)) {
+      ++droppedCount;
+      continue;
+    }
+
+    if (!image) {
+      image = cvRetrieveFrame(capture);
+    }
+    if (!image || !convert(image, frame)) {
+      SAY("Unable to decode image of cam %d", device);
+      if (sink) {
+        sink->release(frame.target);
+      }
+      continue;
+    }
+    frame.decodeTime = ovr_GetTimeInSeconds();
+    ++frame.sequence;
+    callback(frame);
+    // the pixels are the consumer's now
+    frame.image.release();
+  }
+}
+
+void CameraCapture::setDecodeScale(int scale) {
+  decodeScale = scale;
+  // the pool is set up before the capture thread starts
+  if (pool && poolSource >= 0) {
+    pool->setDecodeScale(poolSource, scale);
+  }
+}
+
+// The retrieved image is owned by OpenCV and overwritten by the next grab.
+// Only the cropped region is copied out of it, either straight into the
+// sink's memory or into memory of our own.
+bool CameraCapture::convert(IplImage * image, CapturedFrame & frame) {
+  if (decoder) {
+    // the image is the compressed frame, a single row of bytes
+    return decoder->decode((const unsigned char *)image->imageData,
+      image->width, crop, format, frame, decodeScale);
+  }
+
+  // The backend may have cropped the image already
+  cv::Rect region = crop;
+  if (image->width == crop.width && image->height == crop.height) {
+    region = cv::Rect(0, 0, crop.width, crop.height);
+  }
+  if ((region & cv::Rect(0, 0, image->width, image->height)) != region) {
+    return false;
+  }
+  frame.format = FRAME_BGRA == format ? FRAME_BGRA : FRAME_BGR;
+  // Some backends deliver bottom-up images, which cv::Mat doesn't know
+  bool bottomUp = IPL_ORIGIN_BL == image->origin;
+  if (sink && FRAME_BGR == frame.format && IPL_DEPTH_8U == image->depth) {
+    frame.image = cv::Mat(crop.height, crop.width, CV_8UC(image->nChannels),
+      frame.target.data, frame.target.stride);
+    int top = bottomUp ? image->height - region.y - region.height : region.y;
+    PixelKernels::cropFlip((const unsigned char *)image->imageData, image->widthStep,
+      frame.target.data, frame.target.stride, region.x, top, region.width, region.height,
+      image->nChannels, bottomUp, false);
+    return true;
+  }
+  cv::Mat source = cv::Mat(image, false);
+  if (bottomUp) {
+    cv::Mat flipped;
+    cv::flip(source, flipped, 0);
+    source = flipped;
+  }
+  frame.store(source(region));
+  return true;
+}
+
+StereoPairer::StereoPairer(Callback callback, double maxSkewSeconds)
+  : callback(callback), maxSkew(maxSkewSeconds), pairCount(0) {
+  unmatchedCount[0] = 0;
+  unmatchedCount[1] = 0;
+}
+
+void StereoPairer::drop(ovrEyeType eye, CapturedFrame & frame) {
+  ++unmatchedCount[eye];
+  if (dropCallback) {
+    dropCallback(eye, frame);
+  }
+}
+
+void StereoPairer::dropStale(ovrEyeType eye, double before) {
+  std::deque<CapturedFrame> & queue = pending[eye];
+  while (!queue.empty() && queue.front().captureTime < before) {
+    drop(eye, queue.front());
+    queue.pop_front();
+  }
+}
+
+void StereoPairer::submit(ovrEyeType eye, CapturedFrame & frame) {
+  ovrEyeType otherEye = (ovrEye_Left == eye) ? ovrEye_Right : ovrEye_Left;
+  double skew = maxSkew;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  std::deque<CapturedFrame> & others = pending[otherEye];
+
+  // Nothing the other camera delivers from now on can be older than
+  // this frame, so anything it delivered before the window is lost
+  dropStale(otherEye, frame.captureTime - skew);
+
+  // Find the closest frame of the other camera within the window
+  auto best = others.end();
+  double bestDelta = skew;
+  for (auto itr = others.begin(); itr != others.end(); ++itr) {
+    double delta = std::abs(itr->captureTime - frame.captureTime);
+    if (delta <= bestDelta) {
+      best = itr;
+      bestDelta = delta;
+    }
+  }
+
+  if (best == others.end()) {
+    std::deque<CapturedFrame> & own = pending[eye];
+    own.push_back(frame);
+    while (own.size() > MAX_PENDING) {
+      drop(eye, own.front());
+      own.pop_front();
+    }
+    return;
+  }
+
+  // Pending frames of this camera are all older than the one that just
+  // matched, and frames of the other camera before the match will never
+  // be used either
+  std::deque<CapturedFrame> & own = pending[eye];
+  while (!own.empty()) {
+    drop(eye, own.front());
+    own.pop_front();
+  }
+  while (others.begin() != best) {
+    drop(otherEye, others.front());
+    others.pop_front();
+  }
+  CapturedFrame match = others.front();
+  others.pop_front();
+
+  ++pairCount;
+  if (ovrEye_Left == eye) {
+    callback(frame, match);
+  } else {
+    callback(match, frame);
+  }
+}
+
+bool PairDecimator::keep(ovrEyeType eye, double captureTime) {
+  std::unique_lock<std::mutex> lock(mutex);
+  long long index = lastIndex;
+  if (ovrEye_Left == eye) {
+    double delta = captureTime - lastTime;
+    if (lastTime > 0 && delta > 0) {
+      // frames lost by the driver still count
+      long long steps = interval > 0 ? std::max(std::llround(delta / interval), 1LL) : 1;
+      double measured = delta / steps;
+      interval = interval > 0 ? interval + (measured - interval) * 0.05 : measured;
+      index += steps;
+    }
+    lastTime = captureTime;
+    lastIndex = index;
+  } else if (interval > 0) {
+    index += std::llround((captureTime - lastTime) / interval);
+  }
+
+  int n = decimation;
+  if (n <= 1 || interval <= 0) {
+    return true;
+  }
+  return 0 == ((index % n) + n) % n;
+}
+
+#endif
@@ -0,0 +1,322 @@
+#pragma once
+
+#ifdef HAVE_OPENCV
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "JpegYuvDecoder.h"
+
+class DecodePool;
+class FrameDecoder;
+class FramePool;
+
+/**
+ * Memory supplied by the consumer of a camera for a single frame.  The
+ * slot is opaque to the capture code and lets the owner of the memory
+ * identify it when the frame is handed back.
+ */
+struct FrameTarget {
+  unsigned char * data{ nullptr };
+  size_t stride{ 0 };
+  // bytes available at data
+  size_t size{ 0 };
+  int slot{ -1 };
+};
+
+enum FrameFormat {
+  // packed 8 bit BGR pixels
+  FRAME_BGR,
+  // Y, Cb and Cr planes as described by a YuvLayout
+  FRAME_YUV,
+  // packed 8 bit BGRA pixels with opaque alpha, in rows of
+  // packedStride() bytes.  Costs a third more memory than BGR, but four
+  // byte pixels in aligned rows are what the GPU copies without help
+  // from the driver.
+  FRAME_BGRA,
+};
+
+// Rows of BGRA frames start at multiples of this many bytes
+static const size_t FRAME_ROW_ALIGNMENT = 64;
+
+// Bytes per row of BGR and BGRA frames
+inline size_t packedStride(FrameFormat format, int width) {
+  if (FRAME_BGRA == format) {
+    return ((size_t)width * 4 + FRAME_ROW_ALIGNMENT - 1) & ~(FRAME_ROW_ALIGNMENT - 1);
+  }
+  return (size_t)width * 3;
+}
+
+/**
+ * Hands out the memory captured frames are written to, so that the
+ * pixels land directly where they are consumed (e.g. a mapped upload
+ * buffer) instead of being copied there afterwards.
+ */
+class FrameSink {
+public:
+  virtual ~FrameSink() {
+  }
+
+  // Called on the capture thread before a frame is decoded.  Returning
+  // false skips the frame without decoding it.
+  virtual bool acquire(FrameTarget & target) = 0;
+
+  // Returns memory of a frame that won't be consumed after all
+  virtual void release(const FrameTarget & target) = 0;
+};
+
+/**
+ * A single camera image together with the moment it was captured.
+ * Timestamps come from ovr_GetTimeInSeconds(), so they share a clock
+ * with the Rift sensor and frame timing.
+ *
+ * If the capture has a sink, the image is a header over the target
+ * memory, otherwise it owns its pixels.  YUV frames are a single row of
+ * bytes holding all three planes.
+ */
+struct CapturedFrame {
+  cv::Mat image;
+  FrameFormat format{ FRAME_BGR };
+  YuvLayout yuv;
+  FrameTarget target;
+  double captureTime{ 0 };
+  // when the frame was taken from the driver, and when it was decoded.
+  // Without a driver timestamp, the capture time is the dequeue time.
+  double dequeueTime{ 0 };
+  double decodeTime{ 0 };
+  unsigned long sequence{ 0 };
+
+  // Stores a BGR image as the frame's BGR or BGRA image, in the target
+  // memory if there is one
+  void store(const cv::Mat & bgr);
+};
+
+/**
+ * Owns one OpenCV capture device and a worker thread that grabs and
+ * decodes frames from it as fast as the device delivers them, handing
+ * each one to a callback on the worker thread.
+ *
+ * Only the crop region of each image is delivered.
+ */
+class CameraCapture {
+public:
+  typedef std::function<void(CapturedFrame & frame)> Callback;
+  typedef std::function<void(const unsigned char * data, size_t size, double captureTime)> CompressedCallback;
+  typedef std::function<bool(double captureTime)> FrameFilter;
+
+  CameraCapture(int device, const glm::uvec2 & size);
+  CameraCapture(int device, const glm::uvec2 & size, const cv::Rect & crop);
+  virtual ~CameraCapture();
+
+  // Must be called before start().  The sink has to outlive the capture.
+  // Without a sink, frames land in a FramePool of the capture and own
+  // their pixels, i.e. the memory goes back to the pool once the last
+  // copy of the image is gone, which has to happen before the capture is
+  // destroyed.
+  void setSink(FrameSink * sink) {
+    this->sink = sink;
+  }
+
+  // Must be called before start().  The number of frames the pool of a
+  // capture without a sink holds, i.e. how many frames decode and the
+  // consumer may hold on to at once before frames are dropped.
+  void setPoolSize(size_t frames, bool hugePages = false) {
+    poolFrames = frames;
+    poolHugePages = hugePages;
+  }
+
+  // Must be called before start().  YUV frames need a capture backend
+  // that can hand out the undecoded MJPEG frames, and libjpeg.  Without
+  // them, the capture falls back to BGR frames.
+  void setFormat(FrameFormat format) {
+    this->format = format;
+  }
+
+  FrameFormat getFormat() const {
+    return format;
+  }
+
+  // Must be called before start().  Hands the compressed frames to the
+  // pool, which decodes them and invokes the callback on its threads.
+  // Backends that can't deliver compressed frames decode on the capture
+  // thread instead.  The pool has to outlive the capture.
+  void setDecodePool(DecodePool * pool) {
+    this->pool = pool;
+  }
+
+  // Must be called before start().  Hands every compressed frame to the
+  // callback on the capture thread before it's decoded, e.g. to record
+  // it.  Backends that can't deliver compressed frames never call it.
+  void setCompressedCallback(CompressedCallback callback) {
+    compressedCallback = callback;
+  }
+
+  // Must be called before start().  Fewer driver buffers mean fewer
+  // frames can queue up while we are busy.  Returns false if the backend
+  // doesn't support it.
+  bool setBufferCount(int count);
+
+  // Must be called before start().  Makes every grab skip to the newest
+  // frame the driver has, instead of the oldest.  Returns false if the
+  // backend doesn't support it.
+  bool setLatestFrameOnly(bool latest);
+
+  // Must be called before start().  Runs the capture thread on the given
+  // CPUs only.
+  void setAffinity(const std::vector<int> & cpus) {
+    this->cpus = cpus;
+  }
+
+  // Must be called before start().  Frames the filter returns false for
+  // are skipped before they are decoded, but after the compressed
+  // callback saw them.
+  void setFrameFilter(FrameFilter filter) {
+    frameFilter = filter;
+  }
+
+  // Decodes at 1/scale of the resolution (1, 2, 4 or 8) from the next
+  // frame on.  Only YUV frames can be scaled.  May be called at any time.
+  void setDecodeScale(int scale);
+
+  void start(Callback callback);
+  void stop();
+
+  // Frames skipped because the sink had no memory available
+  unsigned long getDroppedCount() const {
+    return droppedCount;
+  }
+
+  bool isOpen() const {
+    return nullptr != capture;
+  }
+
+  int getDevice() const {
+    return device;
+  }
+
+private:
+  void open(const glm::uvec2 & size);
+  void run();
+  bool convert(IplImage * image, CapturedFrame & frame);
+
+  const int device;
+  const cv::Rect crop;
+  CvCapture * capture{ nullptr };
+  // the backend reports how long ago the driver filled a frame's buffer
+  bool frameAge{ false };
+  FrameSink * sink{ nullptr };
+  // the sink if none was set
+  std::unique_ptr<FramePool> ownPool;
+  size_t poolFrames{ 8 };
+  bool poolHugePages{ false };
+  FrameFormat format{ FRAME_BGR };
+  // decodes compressed frames on the capture thread, if there's no pool
+  std::unique_ptr<FrameDecoder> decoder;
+  DecodePool * pool{ nullptr };
+  int poolSource{ -1 };
+  std::vector<int> cpus;
+  std::atomic<int> decodeScale{ 1 };
+  std::atomic<unsigned long> droppedCount;
+  Callback callback;
+  CompressedCallback compressedCallback;
+  FrameFilter frameFilter;
+  std::thread thread;
+  std::atomic<bool> running;
+};
+
+/**
+ * Matches frames coming in from a left and a right camera by capture
+ * time.  A left / right pair is emitted when the two timestamps are no
+ * more than the skew window apart.  Frames that can no longer be matched
+ * are dropped and counted.
+ *
+ * submit() may be called concurrently from both capture threads; the
+ * callbacks are invoked on whichever thread submitted the frame, but
+ * never on two threads at once.
+ */
+class StereoPairer {
+public:
+  typedef std::function<void(CapturedFrame & left, CapturedFrame & right)> Callback;
+  typedef std::function<void(ovrEyeType eye, CapturedFrame & frame)> DropCallback;
+
+  StereoPairer(Callback callback, double maxSkewSeconds = 0.015);
+
+  // Called for every frame that is discarded without being paired, so
+  // its memory can be returned to the sink it came from
+  void setDropCallback(DropCallback dropCallback) {
+    this->dropCallback = dropCallback;
+  }
+
+  void submit(ovrEyeType eye, CapturedFrame & frame);
+
+  void setMaxSkew(double seconds) {
+    maxSkew = seconds;
+  }
+
+  double getMaxSkew() const {
+    return maxSkew;
+  }
+
+  unsigned long getPairCount() const {
+    return pairCount;
+  }
+
+  unsigned long getUnmatchedCount(ovrEyeType eye) const {
+    return unmatchedCount[eye];
+  }
+
+private:
+  // Discards (and counts) pending frames of the eye captured before the
+  // given time, since they can't pair up with anything any more
+  void dropStale(ovrEyeType eye, double before);
+  void drop(ovrEyeType eye, CapturedFrame & frame);
+
+  static const size_t MAX_PENDING = 4;
+
+  Callback callback;
+  DropCallback dropCallback;
+  std::atomic<double> maxSkew;
+  std::mutex mutex;
+  std::deque<CapturedFrame> pending[2];
+  std::atomic<unsigned long> pairCount;
+  std::atomic<unsigned long> unmatchedCount[2];
+};
+
+/**
+ * Lets the cameras of a pair skip the same frames, so that the frames
+ * they keep still pair up.  Counting frames per camera wouldn't do, one
+ * camera dropping a frame would put the two out of step for good.
+ *
+ * Instead frames are numbered by their capture time on a grid of the
+ * frame interval, learned from the left camera, with the boundaries half
+ * way between frames.  Frames captured together get the same number as
+ * long as their skew is below half the interval.
+ */
+class PairDecimator {
+public:
+  // Keeps every n-th frame of both cameras, 1 keeps all
+  void setDecimation(int n) {
+    decimation = std::max(n, 1);
+  }
+
+  int getDecimation() const {
+    return decimation;
+  }
+
+  // Called with every frame of both cameras, before it's decoded
+  bool keep(ovrEyeType eye, double captureTime);
+
+private:
+  std::atomic<int> decimation{ 1 };
+  std::mutex mutex;
+  // capture time and number of the latest left frame
+  double lastTime{ 0 };
+  long long lastIndex{ 0 };
+  double interval{ 0 };
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "Common.h"
+#include "StereoRectification.h"
+
+#ifdef HAVE_OPENCV
+
+bool StereoRectification::load(const std::string & path) {
+  cv::FileStorage fs(path, cv::FileStorage::READ);
+  if (!fs.isOpened()) {
+    SAY_ERR("Unable to open stereo calibration %s", path.c_str());
+    return false;
+  }
+  fs["M1"] >> cameraMatrix[0];
+  fs["D1"] >> distortion[0];
+  fs["M2"] >> cameraMatrix[1];
+  fs["D2"] >> distortion[1];
+  fs["R"] >> rotation;
+  fs["T"] >> translation;
+  std::vector<int> size;
+  fs["image_size"] >> size;
+  if (2 == size.size()) {
+    calibratedSize = cv::Size(size[0], size[1]);
+  }
+
+  if (cameraMatrix[0].empty() || cameraMatrix[1].empty() || rotation.empty() || translation.empty()) {
+    SAY_ERR("Stereo calibration %s needs M1, D1, M2, D2, R and T", path.c_str());
+    cameraMatrix[0].release();
+    return false;
+  }
+  return true;
+}
+
+bool StereoRectification::buildLookup(const glm::uvec2 & imageSize, const cv::Rect & crop, cv::Mat lookup[2]) const {
+  if (!isLoaded()) {
+    return false;
+  }
+  cv::Size size(imageSize.x, imageSize.y);
+  if ((crop & cv::Rect(cv::Point(), size)) != crop) {
+    return false;
+  }
+
+  // The focal lengths and principal points scale with the resolution
+  cv::Mat intrinsics[2];
+  for (int i = 0; i < 2; ++i) {
+    cameraMatrix[i].convertTo(intrinsics[i], CV_64F);
+    if (calibratedSize.area() && calibratedSize != size) {
+      intrinsics[i].row(0) *= (double)size.width / calibratedSize.width;
+      intrinsics[i].row(1) *= (double)size.height / calibratedSize.height;
+    }
+  }
+
+  // Only keep valid pixels (alpha 0), a black border would be more
+  // distracting than losing the edges of the image
+  cv::Mat rectification[2], projection[2], disparityToDepth;
+  cv::stereoRectify(intrinsics[0], distortion[0], intrinsics[1], distortion[1], size,
+    rotation, translation, rectification[0], rectification[1],
+    projection[0], projection[1], disparityToDepth, cv::CALIB_ZERO_DISPARITY, 0);
+
+  for (int i = 0; i < 2; ++i) {
+    cv::Mat mapX, mapY;
+    cv::initUndistortRectifyMap(intrinsics[i], distortion[i], rectification[i],
+      projection[i], size, CV_32FC1, mapX, mapY);
+
+    // pixel coordinates of the raw image to texture coordinates of its
+    // crop, which is all that gets uploaded
+    lookup[i].create(crop.height, crop.width, CV_32FC2);
+    for (int y = 0; y < crop.height; ++y) {
+      const float * xs = mapX.ptr<float>(crop.y + y) + crop.x;
+      const float * ys = mapY.ptr<float>(crop.y + y) + crop.x;
+      cv::Vec2f * out = lookup[i].ptr<cv::Vec2f>(y);
+      for (int x = 0; x < crop.width; ++x) {
+        out[x][0] = (xs[x] - crop.x + 0.5f) / crop.width;
+        out[x][1] = (ys[x] - crop.y + 0.5f) / crop.height;
+      }
+    }
+  }
+  return true;
+}
+
+#endif
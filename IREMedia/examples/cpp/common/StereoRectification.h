@@ -0,0 +1,38 @@
+#pragma once
+
+#ifdef HAVE_OPENCV
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * Lens undistortion and stereo rectification of a calibrated camera pair,
+ * as lookup maps for the GPU.
+ *
+ * The calibration is read from a cv::FileStorage file holding the
+ * intrinsics M1, D1, M2, D2 and the extrinsics R, T of the right camera
+ * relative to the left one, as written by OpenCV's stereo_calib sample.
+ * An optional image_size (width, height) says what resolution it was made
+ * at, so it can be scaled to the capture resolution.
+ */
+class StereoRectification {
+public:
+  bool load(const std::string & path);
+
+  bool isLoaded() const {
+    return !cameraMatrix[0].empty();
+  }
+
+  // For every pixel of the crop of the rectified image, the texture
+  // coordinates in the crop of the raw image to sample, as CV_32FC2.
+  // Coordinates outside [0, 1] have no source pixel.
+  bool buildLookup(const glm::uvec2 & imageSize, const cv::Rect & crop, cv::Mat lookup[2]) const;
+
+private:
+  cv::Mat cameraMatrix[2];
+  cv::Mat distortion[2];
+  cv::Mat rotation;
+  cv::Mat translation;
+  cv::Size calibratedSize;
+};
+
+#endif
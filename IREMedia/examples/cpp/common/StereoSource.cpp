@@ -0,0 +1,405 @@
+#include "Common.h"
+#include "StereoSource.h"
+#include "LatencyHarness.h"
+
+#ifdef HAVE_OPENCV
+
+LiveStereoSource::LiveStereoSource(const Config & config)
+  : config(config) {
+}
+
+LiveStereoSource::~LiveStereoSource() {
+  stop();
+}
+
+void LiveStereoSource::start(Callback callback) {
+  if (pairer) {
+    return;
+  }
+  pairer = std::unique_ptr<StereoPairer>(new StereoPairer(callback, config.maxSkewSeconds));
+  pairer->setDropCallback([&](ovrEyeType eye, CapturedFrame & frame){
+    if (sinks[eye]) {
+      sinks[eye]->release(frame.target);
+    }
+  });
+  pool = std::unique_ptr<DecodePool>(new DecodePool(config.decodeThreads, config.decodeQueue));
+  pool->setBudget(config.decodeBudgetSeconds);
+  if (!config.decodeCpus.empty() && !pool->setAffinity(config.decodeCpus)) {
+    SAY_ERR("Unable to pin the decode threads");
+  }
+
+  for_each_eye([&](ovrEyeType eye){
+    CameraCapture * camera = new CameraCapture(config.devices[eye], config.size, config.crop);
+    cameras[eye] = std::unique_ptr<CameraCapture>(camera);
+    camera->setSink(sinks[eye]);
+    camera->setFormat(config.format);
+    camera->setDecodePool(pool.get());
+    camera->setAffinity(config.captureCpus[eye]);
+    camera->setDecodeScale(quality.decodeScale);
+    if (!camera->setLatestFrameOnly(true) || !camera->setBufferCount(config.driverBuffers)) {
+      SAY_ERR("Camera %d may deliver stale frames", config.devices[eye]);
+    }
+    if (recorder) {
+      SessionRecorder * target = recorder;
+      camera->setCompressedCallback([=](const unsigned char * data, size_t size, double captureTime){
+        target->addFrame(eye, captureTime, data, size);
+      });
+    }
+    // Recordings keep every frame, only the display is decimated
+    PairDecimator * gate = &decimator;
+    camera->setFrameFilter([=](double captureTime){
+      return gate->keep(eye, captureTime);
+    });
+    StereoPairer * target = pairer.get();
+    camera->start([=](CapturedFrame & frame){
+      target->submit(eye, frame);
+    });
+  });
+}
+
+void LiveStereoSource::stop() {
+  for_each_eye([&](ovrEyeType eye){
+    cameras[eye].reset();
+  });
+  // after the cameras, which submit to it
+  pool.reset();
+  pairer.reset();
+}
+
+bool LiveStereoSource::setQuality(const StreamQuality & quality) {
+  if (FRAME_YUV != config.format && 1 != quality.decodeScale) {
+    return false;
+  }
+  this->quality = quality;
+  decimator.setDecimation(quality.frameDecimation);
+  for_each_eye([&](ovrEyeType eye){
+    if (cameras[eye]) {
+      cameras[eye]->setDecodeScale(quality.decodeScale);
+    }
+  });
+  return true;
+}
+
+std::string LiveStereoSource::describeStats() {
+  if (!pairer) {
+    return std::string();
+  }
+  DecodePool::Stats stats = pool->getStats(true);
+  return Platform::format("unmatched left %lu, right %lu, no upload slot left %lu, right %lu\n"
+    "Decode: %0.2f ms mean, %0.2f ms max, over budget %lu, queue %u (max %u), overflowed %lu, stale %lu, no upload slot %lu",
+    pairer->getUnmatchedCount(ovrEye_Left),
+    pairer->getUnmatchedCount(ovrEye_Right),
+    cameras[ovrEye_Left]->getDroppedCount(),
+    cameras[ovrEye_Right]->getDroppedCount(),
+    stats.meanDecodeMillis, stats.maxDecodeMillis, stats.overBudget,
+    (unsigned)stats.queueDepth, (unsigned)stats.maxQueueDepth,
+    stats.overflowed, stats.stale, stats.skipped);
+}
+
+TimedStereoSource::TimedStereoSource(const cv::Rect & crop)
+  : crop(crop), running(false), producedCount(0), droppedCount(0) {
+}
+
+TimedStereoSource::~TimedStereoSource() {
+  stop();
+}
+
+void TimedStereoSource::start(Callback callback) {
+  if (running) {
+    return;
+  }
+  this->callback = callback;
+  running = true;
+  thread = std::thread(&TimedStereoSource::run, this);
+}
+
+void TimedStereoSource::stop() {
+  running = false;
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+std::string TimedStereoSource::describeStats() {
+  return Platform::format("produced %lu, no upload slot %lu times",
+    producedCount.exchange(0), droppedCount.exchange(0));
+}
+
+void TimedStereoSource::run() {
+  cv::Mat images[2];
+  CapturedFrame frames[2];
+  double startTime = ovr_GetTimeInSeconds();
+  unsigned long sequence = 0;
+  while (running) {
+    double time;
+    if (!next(images[0], images[1], time)) {
+      SAY("Stereo source ran out of frames");
+      running = false;
+      break;
+    }
+    ++producedCount;
+
+    if (realtime) {
+      double wait = startTime + time - ovr_GetTimeInSeconds();
+      if (wait > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds((long long)(wait * 1e6)));
+      }
+    }
+
+    // Flat out, a pair waits for memory rather than being dropped, so
+    // every pair gets through
+    ++sequence;
+    while (running && !deliver(images, frames, sequence)) {
+      ++droppedCount;
+      if (realtime) {
+        break;
+      }
+      Platform::sleepMillis(1);
+    }
+  }
+}
+
+bool TimedStereoSource::deliver(const cv::Mat images[2], CapturedFrame frames[2], unsigned long sequence) {
+  double captureTime = ovr_GetTimeInSeconds();
+  bool filled[2] = { false, false };
+  for_each_eye([&](ovrEyeType eye){
+    frames[eye].captureTime = captureTime;
+    frames[eye].dequeueTime = captureTime;
+    frames[eye].sequence = sequence;
+    filled[eye] = fill(eye, images[eye], frames[eye]);
+  });
+  if (filled[0] && filled[1]) {
+    callback(frames[0], frames[1]);
+    return true;
+  }
+  for_each_eye([&](ovrEyeType eye){
+    if (filled[eye] && sinks[eye]) {
+      sinks[eye]->release(frames[eye].target);
+    }
+  });
+  return false;
+}
+
+bool TimedStereoSource::fill(ovrEyeType eye, const cv::Mat & image, CapturedFrame & frame) {
+  if (image.empty() || CV_8UC3 != image.type()) {
+    return false;
+  }
+  cv::Mat source;
+  if (image.cols == crop.width && image.rows == crop.height) {
+    source = image;
+  } else if ((crop & cv::Rect(0, 0, image.cols, image.rows)) == crop) {
+    source = image(crop);
+  } else {
+    cv::resize(image, source, crop.size());
+  }
+
+  FrameSink * sink = sinks[eye];
+  if (sink && !sink->acquire(frame.target)) {
+    return false;
+  }
+  frame.format = format;
+  frame.store(source);
+  frame.decodeTime = ovr_GetTimeInSeconds();
+  return true;
+}
+
+FileStereoSource::FileStereoSource(const std::string & leftFile,
+    const std::string & rightFile, const cv::Rect & crop)
+  : TimedStereoSource(crop) {
+  names[0] = leftFile;
+  names[1] = rightFile;
+  for (int i = 0; i < 2; ++i) {
+    if (!files[i].open(names[i])) {
+      SAY_ERR("Unable to open %s", names[i].c_str());
+    }
+  }
+  // image sequences have no frame rate of their own
+  double fps = files[0].get(CV_CAP_PROP_FPS);
+  if (!(fps > 0 && fps < 1000)) {
+    fps = 30;
+  }
+  frameInterval = 1.0 / fps;
+}
+
+FileStereoSource::~FileStereoSource() {
+  stop();
+}
+
+bool FileStereoSource::read(cv::Mat & left, cv::Mat & right) {
+  return files[0].read(left) && files[1].read(right);
+}
+
+bool FileStereoSource::next(cv::Mat & left, cv::Mat & right, double & time) {
+  if (!isOpen()) {
+    return false;
+  }
+  if (!read(left, right)) {
+    // start over, seeking isn't supported by every backend
+    for (int i = 0; i < 2; ++i) {
+      files[i].release();
+      files[i].open(names[i]);
+    }
+    if (!read(left, right)) {
+      return false;
+    }
+  }
+  // the frames keep their spacing across loops
+  time = frameInterval * frameIndex++;
+  return true;
+}
+
+SessionStereoSource::SessionStereoSource(const std::string & path, const cv::Rect & crop, double maxSkewSeconds)
+  : TimedStereoSource(crop), reader(path), crop(crop), maxSkewSeconds(maxSkewSeconds) {
+  if (reader.isOpen() && !reader.getChunkCount()) {
+    SAY_ERR("%s holds no complete chunk", path.c_str());
+  }
+}
+
+SessionStereoSource::~SessionStereoSource() {
+  stop();
+}
+
+void SessionStereoSource::setStartTime(double seconds) {
+  if (!isOpen()) {
+    return;
+  }
+  startChunk = reader.findChunk(reader.getChunk(0).firstTime + seconds);
+  nextChunk = startChunk;
+}
+
+bool SessionStereoSource::readChunk() {
+  if (nextChunk >= reader.getChunkCount()) {
+    return false;
+  }
+  reader.forEachRecord(nextChunk++, [&](const SessionReader::Record & record){
+    if (SESSION_FRAME != record.type || record.stream < 0 || record.stream > 1) {
+      return true;
+    }
+    waiting[record.stream] = record;
+    isWaiting[record.stream] = true;
+    if (isWaiting[0] && isWaiting[1]) {
+      if (std::abs(waiting[0].time - waiting[1].time) <= maxSkewSeconds) {
+        Pair pair;
+        pair.frames[0] = waiting[0];
+        pair.frames[1] = waiting[1];
+        pairs.push_back(pair);
+        isWaiting[0] = isWaiting[1] = false;
+      } else {
+        // the older frame has missed its partner
+        isWaiting[waiting[0].time < waiting[1].time ? 0 : 1] = false;
+      }
+    }
+    return true;
+  });
+  return true;
+}
+
+bool SessionStereoSource::decode(const SessionReader::Record & record, cv::Mat & image) {
+  if (decoder.decode(record.data, record.size, crop, FRAME_BGR, decoded)) {
+    image = decoded.image;
+    return true;
+  }
+  // recorded at a size the crop doesn't fit, fill() scales the whole image
+  image = cv::imdecode(cv::Mat(1, (int)record.size, CV_8UC1, (void *)record.data), 1);
+  return !image.empty();
+}
+
+bool SessionStereoSource::next(cv::Mat & left, cv::Mat & right, double & time) {
+  if (!isOpen()) {
+    return false;
+  }
+  while (true) {
+    if (pairs.empty()) {
+      if (readChunk()) {
+        continue;
+      }
+      if (!producedThisPass) {
+        // a whole pass without a single pair to show
+        return false;
+      }
+      // start over, pairs don't reach across the loop
+      nextChunk = startChunk;
+      isWaiting[0] = isWaiting[1] = false;
+      producedThisPass = false;
+      rebase = true;
+      continue;
+    }
+
+    Pair pair = pairs.front();
+    pairs.pop_front();
+    if (!decode(pair.frames[0], left) || !decode(pair.frames[1], right)) {
+      continue;
+    }
+    producedThisPass = true;
+
+    double captureTime = std::max(pair.frames[0].time, pair.frames[1].time);
+    if (rebase) {
+      timeBase = (started ? lastTime + lastInterval : 0) - captureTime;
+      rebase = false;
+    }
+    time = captureTime + timeBase;
+    if (started && time > lastTime) {
+      lastInterval = time - lastTime;
+    }
+    lastTime = time;
+    started = true;
+    return true;
+  }
+}
+
+PatternStereoSource::PatternStereoSource(const glm::uvec2 & size, double fps, const cv::Rect & crop)
+  : TimedStereoSource(crop), size(size), fps(fps > 0 ? fps : 60) {
+}
+
+PatternStereoSource::~PatternStereoSource() {
+  stop();
+}
+
+bool PatternStereoSource::next(cv::Mat & left, cv::Mat & right, double & time) {
+  // a horizontal offset between the eyes puts the pattern behind the
+  // screen
+  int disparity = (int)size.x / 64;
+  draw(images[0], disparity);
+  draw(images[1], -disparity);
+  left = images[0];
+  right = images[1];
+  time = frameIndex / fps;
+  ++frameIndex;
+  return true;
+}
+
+void PatternStereoSource::draw(cv::Mat & image, int offset) {
+  image.create(size.y, size.x, CV_8UC3);
+
+  if (flashPeriod > 0) {
+    // a quarter of the period, long enough to be rendered at least once
+    double time = frameIndex / fps;
+    long flash = (long)(time / flashPeriod);
+    int code = 0;
+    if (time - flash * flashPeriod < flashPeriod / 4) {
+      code = 1 + flash % LatencyHarness::CODES;
+    }
+    unsigned char level = LatencyHarness::levelOf(code);
+    image.setTo(cv::Scalar(level, level, level));
+    return;
+  }
+
+  // a gradient scrolling down by one row per frame, so torn or stale
+  // frames stand out
+  int scroll = (int)(frameIndex % size.y);
+  for (int y = 0; y < image.rows; ++y) {
+    unsigned char shade = (unsigned char)((((y + scroll) % image.rows) * 255) / image.rows);
+    image.row(y).setTo(cv::Scalar(shade, 64, 255 - shade));
+  }
+
+  // a bar crossing the image once per second
+  int barWidth = std::max(image.cols / 32, 1);
+  int x = (int)(fmod(frameIndex / fps, 1.0) * image.cols) + offset;
+  cv::rectangle(image, cv::Rect(x, 0, barWidth, image.rows), cv::Scalar(255, 255, 255), CV_FILLED);
+
+  std::string label = Platform::format("%lu", frameIndex);
+  cv::putText(image, label, cv::Point(image.cols / 2 + offset, image.rows / 2),
+    cv::FONT_HERSHEY_SIMPLEX, 4.0, cv::Scalar(0, 0, 0), 8);
+}
+
+#endif
@@ -0,0 +1,263 @@
+#pragma once
+
+#ifdef HAVE_OPENCV
+
+#include "StereoCapture.h"
+#include "DecodePool.h"
+#include "SessionRecorder.h"
+
+/**
+ * How much of what the cameras deliver gets decoded, so that a loaded
+ * machine can trade image quality for latency.
+ */
+struct StreamQuality {
+  // decode at 1/scale of the resolution: 1, 2, 4 or 8.  Only YUV frames
+  // can be scaled.
+  int decodeScale{ 1 };
+  // keep only every n-th pair
+  int frameDecimation{ 1 };
+
+  StreamQuality() {
+  }
+
+  StreamQuality(int decodeScale, int frameDecimation)
+    : decodeScale(decodeScale), frameDecimation(frameDecimation) {
+  }
+};
+
+/**
+ * Delivers pairs of left and right frames, e.g. from two cameras, a
+ * recording or a generator.  Pairs are handed to a callback on a thread
+ * of the source, written into the memory of the sinks, just like the
+ * frames of a CameraCapture.
+ */
+class StereoSource {
+public:
+  typedef std::function<void(CapturedFrame & left, CapturedFrame & right)> Callback;
+
+  virtual ~StereoSource() {
+  }
+
+  // Must be called before start().  The sink has to outlive the source.
+  void setSink(ovrEyeType eye, FrameSink * sink) {
+    sinks[eye] = sink;
+  }
+
+  virtual void start(Callback callback) = 0;
+  virtual void stop() = 0;
+
+  // May be called at any time, takes effect within a frame or two.
+  // Returns false if the source can't change its quality.
+  virtual bool setQuality(const StreamQuality & /*quality*/) {
+    return false;
+  }
+
+  // A line about frames lost since the last call, for the log
+  virtual std::string describeStats() = 0;
+
+protected:
+  FrameSink * sinks[2]{ nullptr, nullptr };
+};
+
+/**
+ * Two cameras, decoded on a shared pool and paired by capture time.
+ */
+class LiveStereoSource : public StereoSource {
+public:
+  struct Config {
+    int devices[2]{ 0, 1 };
+    glm::uvec2 size;
+    cv::Rect crop;
+    FrameFormat format{ FRAME_BGR };
+    double maxSkewSeconds{ 0.015 };
+    size_t decodeThreads{ 2 };
+    size_t decodeQueue{ 6 };
+    int driverBuffers{ 3 };
+    // CPUs the capture thread of each camera and the decode threads may
+    // run on, any if empty
+    std::vector<int> captureCpus[2];
+    std::vector<int> decodeCpus;
+    // decodes taking longer are counted, zero for no budget
+    double decodeBudgetSeconds{ 0 };
+  };
+
+  LiveStereoSource(const Config & config);
+  virtual ~LiveStereoSource();
+
+  // Must be called before start().  Records the compressed frames of
+  // both cameras, the camera's index being the stream.  The recorder has
+  // to outlive the source.
+  void setRecorder(SessionRecorder * recorder) {
+    this->recorder = recorder;
+  }
+
+  void start(Callback callback);
+  void stop();
+  bool setQuality(const StreamQuality & quality);
+  std::string describeStats();
+
+private:
+  const Config config;
+  StreamQuality quality;
+  PairDecimator decimator;
+  SessionRecorder * recorder{ nullptr };
+  std::unique_ptr<StereoPairer> pairer;
+  std::unique_ptr<DecodePool> pool;
+  std::unique_ptr<CameraCapture> cameras[2];
+};
+
+/**
+ * Base of sources that produce both frames of a pair at once, either at
+ * the pace given by the frame times or as fast as the consumer takes them.
+ * Frames of the crop size are delivered as they are, larger ones are
+ * cropped and anything else is scaled to the crop size.
+ */
+class TimedStereoSource : public StereoSource {
+public:
+  TimedStereoSource(const cv::Rect & crop);
+  virtual ~TimedStereoSource();
+
+  // Must be called before start().  Without real time pacing, pairs are
+  // produced flat out, limited only by free sink memory.  Real time
+  // pacing drops pairs the sinks have no memory for.
+  void setRealtime(bool realtime) {
+    this->realtime = realtime;
+  }
+
+  // Must be called before start().  BGR or BGRA.
+  void setFormat(FrameFormat format) {
+    this->format = FRAME_BGRA == format ? FRAME_BGRA : FRAME_BGR;
+  }
+
+  void start(Callback callback);
+  void stop();
+  std::string describeStats();
+
+protected:
+  // Produces the next pair and its time in seconds, relative to the
+  // first pair.  Returns false once there are no more pairs.  Called on
+  // the thread of the source, so subclasses have to stop() it in their
+  // destructor.
+  virtual bool next(cv::Mat & left, cv::Mat & right, double & time) = 0;
+
+private:
+  void run();
+  bool deliver(const cv::Mat images[2], CapturedFrame frames[2], unsigned long sequence);
+  bool fill(ovrEyeType eye, const cv::Mat & image, CapturedFrame & frame);
+
+  const cv::Rect crop;
+  FrameFormat format{ FRAME_BGR };
+  bool realtime{ true };
+  Callback callback;
+  std::thread thread;
+  std::atomic<bool> running;
+  std::atomic<unsigned long> producedCount;
+  std::atomic<unsigned long> droppedCount;
+};
+
+/**
+ * Replays a recorded pair of videos or image sequences (anything
+ * cv::VideoCapture opens, e.g. "left_%04d.png"), looping at the end.
+ */
+class FileStereoSource : public TimedStereoSource {
+public:
+  FileStereoSource(const std::string & leftFile, const std::string & rightFile, const cv::Rect & crop);
+  virtual ~FileStereoSource();
+
+  bool isOpen() const {
+    return files[0].isOpened() && files[1].isOpened();
+  }
+
+protected:
+  bool next(cv::Mat & left, cv::Mat & right, double & time);
+
+private:
+  bool read(cv::Mat & left, cv::Mat & right);
+
+  std::string names[2];
+  cv::VideoCapture files[2];
+  double frameInterval;
+  unsigned long frameIndex{ 0 };
+};
+
+/**
+ * Replays the camera frames of a SessionRecorder file, pairing the frames
+ * of streams 0 and 1 by capture time like the live cameras are paired.
+ * Starts at any point of the session by jumping to the chunk holding it,
+ * and loops at the end.
+ */
+class SessionStereoSource : public TimedStereoSource {
+public:
+  SessionStereoSource(const std::string & path, const cv::Rect & crop, double maxSkewSeconds);
+  virtual ~SessionStereoSource();
+
+  bool isOpen() const {
+    return reader.isOpen() && reader.getChunkCount() > 0;
+  }
+
+  // Must be called before start().  Seconds after the first record.
+  void setStartTime(double seconds);
+
+protected:
+  bool next(cv::Mat & left, cv::Mat & right, double & time);
+
+private:
+  struct Pair {
+    SessionReader::Record frames[2];
+  };
+
+  // Pairs up the frames of the next chunk, false at the end of the file
+  bool readChunk();
+  bool decode(const SessionReader::Record & record, cv::Mat & image);
+
+  SessionReader reader;
+  const cv::Rect crop;
+  const double maxSkewSeconds;
+  FrameDecoder decoder;
+  CapturedFrame decoded;
+  size_t startChunk{ 0 };
+  size_t nextChunk{ 0 };
+  std::deque<Pair> pairs;
+  // the newest frame of each stream that isn't part of a pair yet
+  SessionReader::Record waiting[2];
+  bool isWaiting[2]{ false, false };
+  // pair times keep going up across loops, the first pair of every pass
+  // sets the capture time they are counted from
+  double timeBase{ 0 };
+  double lastTime{ 0 };
+  double lastInterval{ 0 };
+  bool rebase{ true };
+  bool started{ false };
+  bool producedThisPass{ false };
+};
+
+/**
+ * Generates moving test patterns at a fixed resolution and frame rate.
+ * The pattern is offset between the eyes to give it some depth, and
+ * shows the pair number.
+ */
+class PatternStereoSource : public TimedStereoSource {
+public:
+  PatternStereoSource(const glm::uvec2 & size, double fps, const cv::Rect & crop);
+  virtual ~PatternStereoSource();
+
+  // Instead of the pattern, shows black with a flash coded for the
+  // LatencyHarness at the start of every period.  Zero turns it off.
+  void setFlashPeriod(double seconds) {
+    flashPeriod = seconds;
+  }
+
+protected:
+  bool next(cv::Mat & left, cv::Mat & right, double & time);
+
+private:
+  void draw(cv::Mat & image, int offset);
+
+  const glm::uvec2 size;
+  const double fps;
+  double flashPeriod{ 0 };
+  unsigned long frameIndex{ 0 };
+  cv::Mat images[2];
+};
+
+#endif
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * A lock-free, single producer / single consumer "latest value" mailbox.
+ *
+ * Three instances of T are owned by the buffer.  At any time one of them
+ * belongs to the producer, one to the consumer and one sits in the middle.
+ * Publishing swaps the producer slot with the middle one, fetching swaps
+ * the middle slot with the consumer one, so neither side ever waits for
+ * the other and the consumer always sees the most recently completed value.
+ *
+ * Slots are reused, so T should be allocated once up front (e.g. images
+ * of a fixed size) and then overwritten in place by the producer.
+ */
+template<typename T>
+class TripleBuffer {
+  // Bits 0-1 hold the index of the middle slot, bit 2 is set while the
+  // middle slot holds a value the consumer hasn't picked up yet.
+  enum {
+    INDEX_MASK = 0x03,
+    FRESH_BIT = 0x04,
+  };
+
+  T slots[3];
+  std::atomic<uint8_t> middle;
+  uint8_t writeIndex;
+  uint8_t readIndex;
+
+public:
+  TripleBuffer()
+    : middle(1), writeIndex(0), readIndex(2) {
+  }
+
+  template<typename Function>
+  void forEachSlot(Function function) {
+    for (int i = 0; i < 3; ++i) {
+      function(slots[i]);
+    }
+  }
+
+  // Producer side: the slot to fill with the next value
+  T & writeSlot() {
+    return slots[writeIndex];
+  }
+
+  // Producer side: hand the filled slot over to the consumer.  Returns
+  // true if a previous value was overwritten before the consumer saw it.
+  // The overwritten value becomes the new write slot.
+  bool publish() {
+    uint8_t previous = middle.exchange(writeIndex | FRESH_BIT,
+      std::memory_order_acq_rel);
+    writeIndex = previous & INDEX_MASK;
+    return 0 != (previous & FRESH_BIT);
+  }
+
+  // Consumer side: pick up the most recent value, if there is a new one.
+  // Returns false (and leaves the read slot untouched) otherwise.
+  bool fetch() {
+    if (!hasNewValue()) {
+      return false;
+    }
+    uint8_t previous = middle.exchange(readIndex, std::memory_order_acq_rel);
+    readIndex = previous & INDEX_MASK;
+    return true;
+  }
+
+  bool hasNewValue() const {
+    return 0 != (middle.load(std::memory_order_acquire) & FRESH_BIT);
+  }
+
+  // Consumer side: the value returned by the last successful fetch()
+  T & readSlot() {
+    return slots[readIndex];
+  }
+
+  const T & readSlot() const {
+    return slots[readIndex];
+  }
+};
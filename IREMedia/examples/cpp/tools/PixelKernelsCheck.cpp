@@ -0,0 +1,136 @@
+// Checks the pixel kernels this CPU picks against the plain C++ ones.
+//
+//   PixelKernelsCheck
+//
+// Every pixel count from 0 to 1000 goes through swapRedBlue, in place and
+// out of place, and bgrToBgra, so every tail length of the vector loops
+// is covered.  cropFlip copies odd regions out of a padded image with
+// every combination of flipping and swapping, at three and four bytes per
+// pixel.  Buffers have exactly the size needed, so a build with
+// -fsanitize=address also catches reads and writes past the end.
+//
+// Prints what failed and exits with 1 if anything did.
+#include "Common.h"
+#include "PixelKernels.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define MAX_PIXELS 1000
+#define IMAGE_WIDTH 101
+#define IMAGE_HEIGHT 37
+#define IMAGE_PADDING 13
+
+typedef std::vector<unsigned char> Bytes;
+
+static unsigned failures = 0;
+
+static Bytes pattern(size_t bytes, unsigned seed) {
+  Bytes result(bytes);
+  for (size_t i = 0; i < bytes; ++i) {
+    seed = seed * 1103515245 + 12345;
+    result[i] = (unsigned char)(seed >> 16);
+  }
+  return result;
+}
+
+static void expect(bool equal, const char * kernel, const char * variant, size_t size) {
+  if (!equal) {
+    printf("FAILED: %s %s, %u\n", kernel, variant, (unsigned)size);
+    ++failures;
+  }
+}
+
+// An empty vector has no data() to pass on every standard library
+static unsigned char * at(Bytes & bytes) {
+  return bytes.empty() ? NULL : &bytes[0];
+}
+
+static void checkSwapRedBlue() {
+  for (size_t pixels = 0; pixels <= MAX_PIXELS; ++pixels) {
+    Bytes src = pattern(pixels * 3, (unsigned)pixels);
+    Bytes expected(pixels * 3);
+    PixelKernels::swapRedBlueScalar(at(src), at(expected), pixels);
+
+    Bytes dst(pixels * 3);
+    PixelKernels::swapRedBlue(at(src), at(dst), pixels);
+    expect(dst == expected, "swapRedBlue", "out of place", pixels);
+
+    Bytes inPlace = src;
+    PixelKernels::swapRedBlue(at(inPlace), at(inPlace), pixels);
+    expect(inPlace == expected, "swapRedBlue", "in place", pixels);
+  }
+}
+
+static void checkBgrToBgra() {
+  for (size_t pixels = 0; pixels <= MAX_PIXELS; ++pixels) {
+    Bytes src = pattern(pixels * 3, (unsigned)pixels);
+    unsigned char alpha = (unsigned char)(pixels * 7);
+    Bytes expected(pixels * 4);
+    PixelKernels::bgrToBgraScalar(at(src), at(expected), pixels, alpha);
+
+    Bytes dst(pixels * 4);
+    PixelKernels::bgrToBgra(at(src), at(dst), pixels, alpha);
+    expect(dst == expected, "bgrToBgra", "", pixels);
+  }
+}
+
+static void checkCropFlip() {
+  static const int regions[][4] = {
+    { 0, 0, IMAGE_WIDTH, IMAGE_HEIGHT },
+    { 3, 5, 17, 11 },
+    { 1, 0, 64, IMAGE_HEIGHT },
+    { IMAGE_WIDTH - 1, IMAGE_HEIGHT - 1, 1, 1 },
+    { 7, 2, 0, 4 },
+  };
+  for (int pixelBytes = 3; pixelBytes <= 4; ++pixelBytes) {
+    size_t srcStride = IMAGE_WIDTH * pixelBytes + IMAGE_PADDING;
+    Bytes src = pattern(srcStride * IMAGE_HEIGHT, pixelBytes);
+    for (size_t r = 0; r < sizeof(regions) / sizeof(regions[0]); ++r) {
+      int x = regions[r][0], y = regions[r][1], width = regions[r][2], height = regions[r][3];
+      size_t rowBytes = (size_t)width * pixelBytes;
+      size_t dstStride = rowBytes + IMAGE_PADDING;
+      for (int variant = 0; variant < 4; ++variant) {
+        bool flip = 0 != (variant & 1);
+        bool swap = 0 != (variant & 2);
+
+        // padding the kernel mustn't touch keeps its pattern
+        Bytes expected = pattern(dstStride * height, 99);
+        Bytes dst = expected;
+        for (int row = 0; row < height; ++row) {
+          int sourceRow = flip ? y + height - 1 - row : y + row;
+          const unsigned char * from = &src[sourceRow * srcStride + (size_t)x * pixelBytes];
+          unsigned char * to = &expected[row * dstStride];
+          if (swap && 3 == pixelBytes) {
+            PixelKernels::swapRedBlueScalar(from, to, width);
+          } else {
+            memcpy(to, from, rowBytes);
+          }
+        }
+        PixelKernels::cropFlip(at(src), srcStride, at(dst), dstStride, x, y, width, height,
+          pixelBytes, flip, swap);
+
+        std::string name = 3 == pixelBytes ? "3 bytes" : "4 bytes";
+        name += flip ? " flipped" : "";
+        name += swap ? " swapped" : "";
+        name += ", region";
+        expect(dst == expected, "cropFlip", name.c_str(), r);
+      }
+    }
+  }
+}
+
+int main() {
+  printf("Kernels: %s\n", PixelKernels::getInstructionSet());
+  checkSwapRedBlue();
+  checkBgrToBgra();
+  checkCropFlip();
+  if (failures) {
+    printf("%u checks failed\n", failures);
+    return 1;
+  }
+  printf("All kernels match\n");
+  return 0;
+}
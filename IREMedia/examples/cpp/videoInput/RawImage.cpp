@@ -5,6 +5,7 @@
 
 
 #include "RawImage.h"
+#include "PixelKernels.h"
 
 
 RawImage::RawImage(unsigned int size): ri_new(false), ri_pixels(NULL)
@@ -50,27 +51,9 @@ void RawImage::setCopy(const BYTE * pSampleBuffer)
 
 void RawImage::fastCopy(const BYTE * pSampleBuffer)
 {
-	int *bsrc = (int *)pSampleBuffer;
-
-	int *dst = (int *)ri_pixels.get();
-
-	unsigned int buffersize = ri_size/4;
-	
-	_asm
-	{
-		mov ESI, bsrc
-
-		mov EDI, dst
-
-		mov ECX, buffersize
-
-		cld
-
-		rep movsd
-	}
+	PixelKernels::copy(pSampleBuffer, ri_pixels.get(), ri_size);
 
 	ri_new = true;
-
 }
 
 unsigned char * RawImage::getpPixels()
@@ -4,6 +4,7 @@
 #include "videoDevice.h"
 #include "DebugPrintOut.h"
 #include "RawImage.h"
+#include "PixelKernels.h"
 
 template <class T> void SafeRelease(T *ppT)
 {
@@ -606,109 +607,15 @@ bool videoInput::getPixels(unsigned int deviceID, unsigned char * dstBuffer, boo
 
 void videoInput::processPixels(unsigned char * src, unsigned char * dst, unsigned int width, unsigned int height, unsigned int bpp, bool bRGB, bool bFlip)
 {
-	
 	unsigned int widthInBytes = width * bpp;
 
-	unsigned int numBytes = widthInBytes * height;
-
-	unsigned int numInts = numBytes >> 2;
-
-	unsigned int widthInInts = widthInBytes >> 2;
-
-	int *dstInt, *srcInt;
-	
-	if(!bRGB)
+	if(!bRGB && !bFlip)
 	{
-		
-		int x = 0;
-		int y = 0;
-	
-		if(bFlip)
-		{
-			for(int y = 0; y < height; y++)
-			{
-				dstInt = (int *)(dst + (y * widthInBytes));
-				
-				srcInt = (int *)(src + ( (height -y -1) * widthInBytes));
-				
-				_asm
-				{
-					mov ESI, srcInt
-
-					mov EDI, dstInt
-
-					mov ECX, widthInInts
-
-					cld
-
-					rep movsd
-				}
-			}
-									
-		}
-		else
-		{		
-			_asm
-			{
-				mov ESI, src
-
-				mov EDI, dst
-
-				mov ECX, numInts
-
-				cld
-
-				rep movsd
-			}
-		}
+		PixelKernels::copy(src, dst, widthInBytes * height);
 	}
 	else
 	{
-		if(bFlip)
-		{
-			
-			int x = 0;
-			int y = (height - 1) * widthInBytes;
-			src += y;
-			
-			for(unsigned int i = 0; i < numBytes; i+=3)
-			{
-				if(x >= width)
-				{
-					x = 0;
-					src -= widthInBytes*2;
-				}
-				
-				*dst = *(src+2);
-				dst++;
-				
-				*dst = *(src+1);
-				dst++; 
-				
-				*dst = *src;
-				dst++; 
-				
-				src+=3;	
-				x++;		
-			}
-		}
-		else
-		{						
-			for(unsigned int i = 0; i < numBytes; i+=3)
-			{
-				*dst = *(src+2);
-				dst++;
-				
-				*dst = *(src+1);
-				dst++; 
-				
-				*dst = *src;
-				dst++; 
-				
-				src+=3;			
-			}
-		}
+		PixelKernels::cropFlip(src, widthInBytes, dst, widthInBytes, 0, 0, width, height, bpp, bFlip, bRGB);
 	}
-
 }
 
@@ -192,6 +192,8 @@ CV_EXPORTS_W bool imwrite( const string& filename, InputArray img,
               const vector<int>& params=vector<int>());
 CV_EXPORTS_W Mat imdecode( InputArray buf, int flags );
 CV_EXPORTS Mat imdecode( InputArray buf, int flags, Mat* dst );
+// decodes only the given region of the image, where the codec supports it
+CV_EXPORTS Mat imdecode( InputArray buf, int flags, const Rect& roi, Mat* dst=0 );
 CV_EXPORTS_W bool imencode( const string& ext, InputArray img,
                             CV_OUT vector<uchar>& buf,
                             const vector<int>& params=vector<int>());
@@ -385,6 +385,19 @@ enum
     CV_CAP_PROP_ROLL          =35,
     CV_CAP_PROP_IRIS          =36,
     CV_CAP_PROP_SETTINGS      =37,
+    CV_CAP_PROP_BUFFERSIZE    =38,
+
+    // region of the frames to decode, V4L MJPEG only.  Frames are
+    // retrieved at the size of the region.
+    CV_CAP_PROP_ROI_X         =1100,
+    CV_CAP_PROP_ROI_Y         =1101,
+    CV_CAP_PROP_ROI_WIDTH     =1102,
+    CV_CAP_PROP_ROI_HEIGHT    =1103,
+    // V4L only: hand out the newest filled buffer on each grab, dropping
+    // older ones, and how many milliseconds ago the last grabbed frame's
+    // buffer was filled (readonly)
+    CV_CAP_PROP_LATEST_FRAME  =1104,
+    CV_CAP_PROP_FRAME_AGE_MSEC=1105,
 
     CV_CAP_PROP_AUTOGRAB      =1024, // property for highgui class CvCapture_Android only
     CV_CAP_PROP_SUPPORTED_PREVIEW_SIZES_STRING=1025, // readonly, tricky property, returns cpnst char* indeed
@@ -161,6 +161,11 @@ Added v4l2 support for getting capture property CV_CAP_PROP_POS_MSEC.
 Returns the millisecond timestamp of the last frame grabbed or 0 if no frames have been grabbed
 Used to successfully synchonize 2 Logitech C310 USB webcams to within 16 ms of one another
 
+12th patch: v4l2 low latency capture.  CV_CAP_PROP_BUFFERSIZE sets the number of
+driver buffers, CV_CAP_PROP_LATEST_FRAME makes a grab skip all but the newest
+filled buffer, and CV_CAP_PROP_FRAME_AGE_MSEC tells how long ago the driver
+filled the buffer of the last grabbed frame.
+
 
 make & enjoy!
 
@@ -220,6 +225,8 @@ make & enjoy!
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
 
 #ifdef HAVE_CAMV4L
 #include <linux/videodev.h>
@@ -327,6 +334,21 @@ typedef struct CvCaptureCAM_V4L
    struct v4l2_queryctrl queryctrl;
 
    struct timeval timestamp;
+   /* V4L2_BUF_FLAG_TIMESTAMP_* of the last grabbed buffer, tells which
+      clock the timestamp is on */
+   unsigned int timestamp_flags;
+
+   /* requeue all filled buffers but the newest on each grab */
+   int latest_frame;
+
+   /* with CV_CAP_PROP_CONVERT_RGB off, MJPEG frames are handed out as they
+      come from the device, as a single row of bytes in rawFrame */
+   int convert_rgb;
+   IplImage rawFrame;
+   unsigned int bytesused;
+
+   /* region of MJPEG frames to decode, the whole frame if empty */
+   CvRect roi;
 
    /* V4L2 control variables */
    int v4l2_brightness, v4l2_brightness_min, v4l2_brightness_max;
@@ -359,6 +381,23 @@ static int icvSetVideoSize( CvCaptureCAM_V4L* capture, int w, int h);
 
 /***********************   Implementations  ***************************************/
 
+#ifdef HAVE_CAMV4L2
+
+/* the region of the frame that is decoded, or the whole frame if no region
+   is set or it doesn't fit the frame */
+static CvRect icvFrameRegion( CvCaptureCAM_V4L* capture )
+{
+  CvRect frame = cvRect( 0, 0, capture->form.fmt.pix.width, capture->form.fmt.pix.height );
+  CvRect roi = capture->roi;
+  if (capture->palette != PALETTE_MJPEG || roi.width <= 0 || roi.height <= 0 ||
+      roi.x < 0 || roi.y < 0 || roi.x + roi.width > frame.width ||
+      roi.y + roi.height > frame.height)
+    return frame;
+  return roi;
+}
+
+#endif /* HAVE_CAMV4L2 */
+
 static int numCameras = 0;
 static int indexList = 0;
 
@@ -785,6 +824,109 @@ static void v4l2_scan_controls(CvCaptureCAM_V4L* capture)
 
 }
 
+/* Requests and maps buffer_number driver buffers, or as many as the driver
+   has memory for.  Returns -1 if there are none, the caller closes the
+   capture then. */
+static int v4l2_alloc_buffers (CvCaptureCAM_V4L *capture, const char *deviceName,
+                               unsigned int buffer_number)
+{
+   CLEAR (capture->req);
+
+   try_again:
+
+   capture->req.count = buffer_number;
+   capture->req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+   capture->req.memory = V4L2_MEMORY_MMAP;
+
+   if (-1 == ioctl (capture->deviceHandle, VIDIOC_REQBUFS, &capture->req))
+   {
+       if (EINVAL == errno)
+       {
+         fprintf (stderr, "%s does not support memory mapping\n", deviceName);
+       } else {
+         perror ("VIDIOC_REQBUFS");
+       }
+       return -1;
+   }
+
+   if (capture->req.count < buffer_number)
+   {
+       if (buffer_number == 1)
+       {
+           fprintf (stderr, "Insufficient buffer memory on %s\n", deviceName);
+
+           return -1;
+       } else {
+         buffer_number--;
+     fprintf (stderr, "Insufficient buffer memory on %s -- decreaseing buffers\n", deviceName);
+
+     goto try_again;
+       }
+   }
+
+   for (n_buffers = 0; n_buffers < capture->req.count; ++n_buffers)
+   {
+       struct v4l2_buffer buf;
+
+       CLEAR (buf);
+
+       buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+       buf.memory = V4L2_MEMORY_MMAP;
+       buf.index = n_buffers;
+
+       if (-1 == ioctl (capture->deviceHandle, VIDIOC_QUERYBUF, &buf)) {
+           perror ("VIDIOC_QUERYBUF");
+
+           return -1;
+       }
+
+       capture->buffers[n_buffers].length = buf.length;
+       capture->buffers[n_buffers].start =
+         mmap (NULL /* start anywhere */,
+               buf.length,
+               PROT_READ | PROT_WRITE /* required */,
+               MAP_SHARED /* recommended */,
+               capture->deviceHandle, buf.m.offset);
+
+       if (MAP_FAILED == capture->buffers[n_buffers].start) {
+           perror ("mmap");
+
+           return -1;
+       }
+
+       if (n_buffers == 0) {
+     capture->buffers[MAX_V4L_BUFFERS].start = malloc( buf.length );
+     capture->buffers[MAX_V4L_BUFFERS].length = buf.length;
+       }
+   }
+
+   return 0;
+}
+
+/* Stops streaming and unmaps the driver buffers, the next grab requeues
+   them after v4l2_alloc_buffers */
+static void v4l2_free_buffers (CvCaptureCAM_V4L *capture)
+{
+   capture->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+   if (-1 == ioctl(capture->deviceHandle, VIDIOC_STREAMOFF, &capture->type)) {
+       perror ("Unable to stop the stream.");
+   }
+
+   for (unsigned int n_buffers_ = 0; n_buffers_ < capture->req.count; ++n_buffers_)
+   {
+       if (-1 == munmap (capture->buffers[n_buffers_].start, capture->buffers[n_buffers_].length)) {
+           perror ("munmap");
+       }
+   }
+   capture->req.count = 0;
+
+   if (capture->buffers[MAX_V4L_BUFFERS].start)
+   {
+       free(capture->buffers[MAX_V4L_BUFFERS].start);
+       capture->buffers[MAX_V4L_BUFFERS].start = 0;
+   }
+}
+
 static int _capture_V4L2 (CvCaptureCAM_V4L *capture, char *deviceName)
 {
    int detect_v4l2 = 0;
@@ -886,86 +1028,13 @@ static int _capture_V4L2 (CvCaptureCAM_V4L *capture, char *deviceName)
    if (capture->form.fmt.pix.sizeimage < min)
        capture->form.fmt.pix.sizeimage = min;
 
-   CLEAR (capture->req);
-
-   unsigned int buffer_number = DEFAULT_V4L_BUFFERS;
-
-   try_again:
-
-   capture->req.count = buffer_number;
-   capture->req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-   capture->req.memory = V4L2_MEMORY_MMAP;
-
-   if (-1 == ioctl (capture->deviceHandle, VIDIOC_REQBUFS, &capture->req))
+   if (v4l2_alloc_buffers(capture, deviceName, DEFAULT_V4L_BUFFERS) == -1)
    {
-       if (EINVAL == errno)
-       {
-         fprintf (stderr, "%s does not support memory mapping\n", deviceName);
-       } else {
-         perror ("VIDIOC_REQBUFS");
-       }
        /* free capture, and returns an error code */
        icvCloseCAM_V4L (capture);
        return -1;
    }
 
-   if (capture->req.count < buffer_number)
-   {
-       if (buffer_number == 1)
-       {
-           fprintf (stderr, "Insufficient buffer memory on %s\n", deviceName);
-
-           /* free capture, and returns an error code */
-           icvCloseCAM_V4L (capture);
-           return -1;
-       } else {
-         buffer_number--;
-     fprintf (stderr, "Insufficient buffer memory on %s -- decreaseing buffers\n", deviceName);
-
-     goto try_again;
-       }
-   }
-
-   for (n_buffers = 0; n_buffers < capture->req.count; ++n_buffers)
-   {
-       struct v4l2_buffer buf;
-
-       CLEAR (buf);
-
-       buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-       buf.memory = V4L2_MEMORY_MMAP;
-       buf.index = n_buffers;
-
-       if (-1 == ioctl (capture->deviceHandle, VIDIOC_QUERYBUF, &buf)) {
-           perror ("VIDIOC_QUERYBUF");
-
-           /* free capture, and returns an error code */
-           icvCloseCAM_V4L (capture);
-           return -1;
-       }
-
-       capture->buffers[n_buffers].length = buf.length;
-       capture->buffers[n_buffers].start =
-         mmap (NULL /* start anywhere */,
-               buf.length,
-               PROT_READ | PROT_WRITE /* required */,
-               MAP_SHARED /* recommended */,
-               capture->deviceHandle, buf.m.offset);
-
-       if (MAP_FAILED == capture->buffers[n_buffers].start) {
-           perror ("mmap");
-
-           /* free capture, and returns an error code */
-           icvCloseCAM_V4L (capture);
-           return -1;
-       }
-
-       if (n_buffers == 0) {
-     capture->buffers[MAX_V4L_BUFFERS].start = malloc( buf.length );
-     capture->buffers[MAX_V4L_BUFFERS].length = buf.length;
-       }
-   }
-
    /* Set up Image data */
    cvInitImageHeader( &capture->frame,
                       cvSize( capture->form.fmt.pix.width,
@@ -1146,6 +1215,7 @@ static CvCaptureCAM_V4L * icvCaptureFromCAM_V4L (int index)
    capture->FirstCapture = 1;
 
 #ifdef HAVE_CAMV4L2
+   capture->convert_rgb = 1;
    if (_capture_V4L2 (capture, deviceName) == -1) {
        icvCloseCAM_V4L(capture);
        V4L2_SUPPORT = 0;
@@ -1197,6 +1267,25 @@ static int read_frame_v4l2(CvCaptureCAM_V4L* capture) {
         }
    }
 
+   /* the newest frame is all we want, give the older ones back to the
+      driver right away.  The device is non-blocking, so this stops as soon
+      as no more buffers are filled. */
+   while (capture->latest_frame) {
+       struct v4l2_buffer next;
+
+       CLEAR (next);
+
+       next.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+       next.memory = V4L2_MEMORY_MMAP;
+
+       if (-1 == ioctl (capture->deviceHandle, VIDIOC_DQBUF, &next))
+           break;
+
+       if (-1 == ioctl (capture->deviceHandle, VIDIOC_QBUF, &buf))
+           perror ("VIDIOC_QBUF");
+       buf = next;
+   }
+
    assert(buf.index < capture->req.count);
 
    memcpy(capture->buffers[MAX_V4L_BUFFERS].start,
@@ -1211,6 +1300,8 @@ static int read_frame_v4l2(CvCaptureCAM_V4L* capture) {
 
    //set timestamp in capture struct to be timestamp of most recent frame
    capture->timestamp = buf.timestamp;
+   capture->timestamp_flags = buf.flags;
+   capture->bytesused = buf.bytesused;
 
    return 1;
 }
@@ -1255,6 +1346,31 @@ static void mainloop_v4l2(CvCaptureCAM_V4L* capture) {
     }
 }
 
+/* Milliseconds since the driver filled the buffer of the last grabbed
+   frame, measured on the clock its timestamp is on */
+static double v4l2_frame_age_msec(CvCaptureCAM_V4L* capture) {
+    struct timespec now;
+
+    if (capture->FirstCapture)
+        return 0;
+
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+    if ((capture->timestamp_flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+        V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } else
+#endif
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        now.tv_sec = tv.tv_sec;
+        now.tv_nsec = tv.tv_usec * 1000;
+    }
+
+    return 1000.0 * (now.tv_sec - capture->timestamp.tv_sec) +
+        (now.tv_nsec / 1000 - capture->timestamp.tv_usec) / 1000.0;
+}
+
 #endif /* HAVE_CAMV4L2 */
 
 static int icvGrabFrameCAM_V4L(CvCaptureCAM_V4L* capture) {
@@ -1731,17 +1847,17 @@ uyvy_to_rgb24 (int width, int height, unsigned char *src, unsigned char *dst)
 
 #ifdef HAVE_JPEG
 
-/* convert from mjpeg to rgb24 */
+/* convert the region of interest of an mjpeg frame to rgb24, which is
+   decoded straight into dst */
 static bool
 mjpeg_to_rgb24 (int width, int height,
         unsigned char *src, int length,
-        unsigned char *dst)
+        CvRect roi, unsigned char *dst, int dst_step)
 {
-  cv::Mat temp=cv::imdecode(cv::Mat(std::vector<uchar>(src, src + length)), 1);
-  if( !temp.data || temp.cols != width || temp.rows != height )
-    return false;
-  memcpy(dst, temp.data, width*height*3);
-  return true;
+  cv::Mat temp(roi.height, roi.width, CV_8UC3, dst, dst_step);
+  cv::imdecode(cv::Mat(1, length, CV_8UC1, src), 1, roi, &temp);
+  /* the header is released if decoding failed */
+  return temp.data == dst;
 }
 
 #endif
@@ -2106,19 +2222,33 @@ static IplImage* icvRetrieveFrameCAM_V4L( CvCaptureCAM_V4L* capture, int) {
 
    /* Now get what has already been captured as a IplImage return */
 
+#ifdef HAVE_CAMV4L2
+  if (V4L2_SUPPORT == 1 && !capture->convert_rgb && capture->palette == PALETTE_MJPEG)
+  {
+    /* hand out the compressed frame, some drivers don't fill in bytesused */
+    unsigned int length = capture->bytesused;
+    if (length == 0 || length > capture->buffers[capture->bufferIndex].length)
+      length = capture->buffers[capture->bufferIndex].length;
+    cvInitImageHeader( &capture->rawFrame, cvSize( length, 1 ),
+                       IPL_DEPTH_8U, 1, IPL_ORIGIN_TL, 4 );
+    capture->rawFrame.imageData = (char *)capture->buffers[capture->bufferIndex].start;
+    return &capture->rawFrame;
+  }
+#endif /* HAVE_CAMV4L2 */
+
    /* First, reallocate imageData if the frame size changed */
 
 #ifdef HAVE_CAMV4L2
 
   if (V4L2_SUPPORT == 1)
   {
+    CvRect region = icvFrameRegion(capture);
 
-    if(((unsigned long)capture->frame.width != capture->form.fmt.pix.width)
-       || ((unsigned long)capture->frame.height != capture->form.fmt.pix.height)) {
+    if((capture->frame.width != region.width)
+       || (capture->frame.height != region.height)) {
         cvFree(&capture->frame.imageData);
         cvInitImageHeader( &capture->frame,
-              cvSize( capture->form.fmt.pix.width,
-                  capture->form.fmt.pix.height ),
+              cvSize( region.width, region.height ),
               IPL_DEPTH_8U, 3, IPL_ORIGIN_TL, 4 );
        capture->frame.imageData = (char *)cvAlloc(capture->frame.imageSize);
     }
@@ -2176,7 +2306,9 @@ static IplImage* icvRetrieveFrameCAM_V4L( CvCaptureCAM_V4L* capture, int) {
                     (unsigned char*)(capture->buffers[capture->bufferIndex]
                              .start),
                     capture->buffers[capture->bufferIndex].length,
-                    (unsigned char*)capture->frame.imageData))
+                    icvFrameRegion(capture),
+                    (unsigned char*)capture->frame.imageData,
+                    capture->frame.widthStep))
           return 0;
         break;
 #endif
@@ -2294,6 +2426,22 @@ static double icvGetPropertyCAM_V4L (CvCaptureCAM_V4L* capture,
           return capture->form.fmt.pix.width;
       case CV_CAP_PROP_FRAME_HEIGHT:
           return capture->form.fmt.pix.height;
+      case CV_CAP_PROP_CONVERT_RGB:
+          return capture->convert_rgb;
+      case CV_CAP_PROP_ROI_X:
+          return capture->roi.x;
+      case CV_CAP_PROP_ROI_Y:
+          return capture->roi.y;
+      case CV_CAP_PROP_ROI_WIDTH:
+          return capture->roi.width;
+      case CV_CAP_PROP_ROI_HEIGHT:
+          return capture->roi.height;
+      case CV_CAP_PROP_BUFFERSIZE:
+          return capture->req.count;
+      case CV_CAP_PROP_LATEST_FRAME:
+          return capture->latest_frame;
+      case CV_CAP_PROP_FRAME_AGE_MSEC:
+          return v4l2_frame_age_msec(capture);
       }
 
       /* initialize the control structure */
@@ -2784,6 +2932,57 @@ static int icvSetPropertyCAM_V4L( CvCaptureCAM_V4L* capture,
     case CV_CAP_PROP_EXPOSURE:
         retval = icvSetControl(capture, property_id, value);
         break;
+#ifdef HAVE_CAMV4L2
+    case CV_CAP_PROP_CONVERT_RGB:
+        /* only compressed frames can be handed out unconverted */
+        if (V4L2_SUPPORT == 1 && (value != 0 || capture->palette == PALETTE_MJPEG)) {
+            capture->convert_rgb = value != 0;
+            retval = 1;
+        }
+        break;
+    case CV_CAP_PROP_ROI_X:
+    case CV_CAP_PROP_ROI_Y:
+    case CV_CAP_PROP_ROI_WIDTH:
+    case CV_CAP_PROP_ROI_HEIGHT:
+        /* only the MJPEG decoder can restrict itself to a region */
+        if (V4L2_SUPPORT == 1 && capture->palette == PALETTE_MJPEG) {
+            int v = cvRound(value);
+            if (property_id == CV_CAP_PROP_ROI_X)
+                capture->roi.x = v;
+            else if (property_id == CV_CAP_PROP_ROI_Y)
+                capture->roi.y = v;
+            else if (property_id == CV_CAP_PROP_ROI_WIDTH)
+                capture->roi.width = v;
+            else
+                capture->roi.height = v;
+            retval = 1;
+        }
+        break;
+    case CV_CAP_PROP_BUFFERSIZE:
+        /* the buffers are remapped and requeued by the next grab */
+        if (V4L2_SUPPORT == 1) {
+            int count = MIN(MAX(cvRound(value), 1), MAX_V4L_BUFFERS);
+            unsigned int previous = capture->req.count;
+            if ((unsigned int)count == previous) {
+                retval = 1;
+                break;
+            }
+            v4l2_free_buffers(capture);
+            capture->FirstCapture = 1;
+            if (v4l2_alloc_buffers(capture, "V4L2 device", count) == 0) {
+                retval = 1;
+            } else if (v4l2_alloc_buffers(capture, "V4L2 device", previous) == -1) {
+                fprintf(stderr, "HIGHGUI ERROR: V4L2: Unable to restore %u buffers\n", previous);
+            }
+        }
+        break;
+    case CV_CAP_PROP_LATEST_FRAME:
+        if (V4L2_SUPPORT == 1) {
+            capture->latest_frame = value != 0;
+            retval = 1;
+        }
+        break;
+#endif /* HAVE_CAMV4L2 */
     default:
         fprintf(stderr,
                 "HIGHGUI ERROR: V4L: setting property #%d is not supported\n",
@@ -2818,23 +3017,7 @@ static void icvCloseCAM_V4L( CvCaptureCAM_V4L* capture ){
 #endif /* HAVE_CAMV4L && HAVE_CAMV4L2 */
 #ifdef HAVE_CAMV4L2
        {
-       capture->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-       if (-1 == ioctl(capture->deviceHandle, VIDIOC_STREAMOFF, &capture->type)) {
-           perror ("Unable to stop the stream.");
-       }
-
-       for (unsigned int n_buffers_ = 0; n_buffers_ < capture->req.count; ++n_buffers_)
-       {
-           if (-1 == munmap (capture->buffers[n_buffers_].start, capture->buffers[n_buffers_].length)) {
-               perror ("munmap");
-           }
-       }
-
-       if (capture->buffers[MAX_V4L_BUFFERS].start)
-       {
-           free(capture->buffers[MAX_V4L_BUFFERS].start);
-           capture->buffers[MAX_V4L_BUFFERS].start = 0;
-       }
+       v4l2_free_buffers(capture);
      }
 #endif /* HAVE_CAMV4L2 */
 
@@ -70,6 +70,11 @@ bool BaseImageDecoder::setSource( const Mat& buf )
     return true;
 }
 
+bool BaseImageDecoder::setRegion( const Rect& )
+{
+    return false;
+}
+
 size_t BaseImageDecoder::signatureLength() const
 {
     return m_signature.size();
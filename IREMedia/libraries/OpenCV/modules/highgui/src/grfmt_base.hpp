@@ -70,6 +70,10 @@ public:
     virtual bool readHeader() = 0;
     virtual bool readData( Mat& img ) = 0;
 
+    // restricts readData() to a region of the image, which then has to be
+    // of the size of the region.  Returns false if the decoder can't do it.
+    virtual bool setRegion( const Rect& roi );
+
     virtual size_t signatureLength() const;
     virtual bool checkSignature( const string& signature ) const;
     virtual ImageDecoder newDecoder() const;
@@ -78,6 +82,7 @@ protected:
     int  m_width;  // width  of the image ( filled by readHeader )
     int  m_height; // height of the image ( filled by readHeader )
     int  m_type;
+    Rect m_roi;    // region to decode, empty for the whole image
     string m_filename;
     string m_signature;
     Mat m_buf;
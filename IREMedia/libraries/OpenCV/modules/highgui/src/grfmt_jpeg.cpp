@@ -75,6 +75,11 @@ extern "C" {
 #include "jpeglib.h"
 }
 
+// libjpeg-turbo can skip rows and columns outside of a region of interest
+#if defined LIBJPEG_TURBO_VERSION_NUMBER && LIBJPEG_TURBO_VERSION_NUMBER >= 1005000
+#define HAVE_JPEG_CROP_SCANLINE
+#endif
+
 namespace cv
 {
 
@@ -204,6 +209,13 @@ void  JpegDecoder::close()
 
     m_width = m_height = 0;
     m_type = -1;
+    m_roi = Rect();
+}
+
+bool JpegDecoder::setRegion( const Rect& roi )
+{
+    m_roi = roi;
+    return true;
 }
 
 ImageDecoder JpegDecoder::newDecoder() const
@@ -389,6 +401,18 @@ int my_jpeg_load_dht (struct jpeg_decompress_struct *info, unsigned char *dht,
  * based on a message of Laurent Pinchart on the video4linux mailing list
  ***************************************************************************/
 
+/* same fixed point YCbCr -> RGB conversion as libjpeg, but writing BGR */
+static void icvCvt_YCbCr2BGR_8u_C3R( const uchar* ycbcr, uchar* bgr, int width )
+{
+    for( int i = 0; i < width; i++, ycbcr += 3, bgr += 3 )
+    {
+        int y = ycbcr[0], cb = ycbcr[1] - 128, cr = ycbcr[2] - 128;
+        bgr[0] = saturate_cast<uchar>( y + ((116130*cb + 32768) >> 16) );
+        bgr[1] = saturate_cast<uchar>( y + ((-22554*cb - 46802*cr + 32768) >> 16) );
+        bgr[2] = saturate_cast<uchar>( y + ((91881*cr + 32768) >> 16) );
+    }
+}
+
 bool  JpegDecoder::readData( Mat& img )
 {
     bool result = false;
@@ -417,8 +441,23 @@ bool  JpegDecoder::readData( Mat& img )
                     cinfo->dc_huff_tbl_ptrs );
             }
 
+            // only the region is decoded into img, by default it's the
+            // whole image
+            Rect roi = m_roi.area() > 0 ? m_roi : Rect(0, 0, m_width, m_height);
+            bool narrow = roi.width < m_width;
+
             if( color )
             {
+#ifndef HAVE_JPEG_CROP_SCANLINE
+                if( narrow && cinfo->jpeg_color_space == JCS_YCbCr )
+                {
+                    // libjpeg would colour convert whole rows, so convert
+                    // just the columns of the region here instead
+                    cinfo->out_color_space = JCS_YCbCr;
+                    cinfo->out_color_components = 3;
+                }
+                else
+#endif
                 if( cinfo->num_components != 4 )
                 {
                     cinfo->out_color_space = JCS_RGB;
@@ -446,30 +485,57 @@ bool  JpegDecoder::readData( Mat& img )
 
             jpeg_start_decompress( cinfo );
 
+            // columns to skip at the start of every decoded row
+            int skip = roi.x;
+#ifdef HAVE_JPEG_CROP_SCANLINE
+            if( narrow )
+            {
+                // iMCU columns outside of the crop are entropy decoded, but
+                // neither transformed nor colour converted.  The crop is
+                // widened to iMCU boundaries.
+                JDIMENSION xoffset = roi.x, width = roi.width;
+                jpeg_crop_scanline( cinfo, &xoffset, &width );
+                skip = roi.x - (int)xoffset;
+            }
+            if( roi.y > 0 )
+                jpeg_skip_scanlines( cinfo, roi.y );
+#endif
+
             buffer = (*cinfo->mem->alloc_sarray)((j_common_ptr)cinfo,
                                               JPOOL_IMAGE, m_width*4, 1 );
 
+            while( (int)cinfo->output_scanline < roi.y )
+                jpeg_read_scanlines( cinfo, buffer, 1 );
+
             uchar* data = img.data;
-            for( ; m_height--; data += step )
+            for( int y = 0; y < roi.height; y++, data += step )
             {
                 jpeg_read_scanlines( cinfo, buffer, 1 );
+                const uchar* src = buffer[0] + skip*cinfo->out_color_components;
                 if( color )
                 {
-                    if( cinfo->out_color_components == 3 )
-                        icvCvt_RGB2BGR_8u_C3R( buffer[0], 0, data, 0, cvSize(m_width,1) );
+                    if( cinfo->out_color_space == JCS_YCbCr )
+                        icvCvt_YCbCr2BGR_8u_C3R( src, data, roi.width );
+                    else if( cinfo->out_color_components == 3 )
+                        icvCvt_RGB2BGR_8u_C3R( src, 0, data, 0, cvSize(roi.width,1) );
                     else
-                        icvCvt_CMYK2BGR_8u_C4C3R( buffer[0], 0, data, 0, cvSize(m_width,1) );
+                        icvCvt_CMYK2BGR_8u_C4C3R( src, 0, data, 0, cvSize(roi.width,1) );
                 }
                 else
                 {
                     if( cinfo->out_color_components == 1 )
-                        memcpy( data, buffer[0], m_width );
+                        memcpy( data, src, roi.width );
                     else
-                        icvCvt_CMYK2Gray_8u_C4C1R( buffer[0], 0, data, 0, cvSize(m_width,1) );
+                        icvCvt_CMYK2Gray_8u_C4C1R( src, 0, data, 0, cvSize(roi.width,1) );
                 }
             }
             result = true;
-            jpeg_finish_decompress( cinfo );
+
+            // rows below the region are never decoded
+            if( cinfo->output_scanline < cinfo->output_height )
+                jpeg_abort_decompress( cinfo );
+            else
+                jpeg_finish_decompress( cinfo );
         }
     }
 
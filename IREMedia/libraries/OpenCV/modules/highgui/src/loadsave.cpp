@@ -302,7 +302,7 @@ bool imwrite( const string& filename, InputArray _img,
 }
 
 static void*
-imdecode_( const Mat& buf, int flags, int hdrtype, Mat* mat=0 )
+imdecode_( const Mat& buf, int flags, int hdrtype, Mat* mat=0, const Rect* roi=0 )
 {
     CV_Assert(buf.data && buf.isContinuous());
     IplImage* image = 0;
@@ -337,6 +337,22 @@ imdecode_( const Mat& buf, int flags, int hdrtype, Mat* mat=0 )
     size.width = decoder->width();
     size.height = decoder->height();
 
+    // decoders that can't restrict themselves to the region decode the
+    // whole image, which is cropped afterwards
+    bool cropAfterwards = false;
+    if( roi )
+    {
+        if( (*roi & Rect(0, 0, size.width, size.height)) != *roi || roi->area() == 0 )
+        {
+            if( !filename.empty() )
+                remove(filename.c_str());
+            return 0;
+        }
+        cropAfterwards = !decoder->setRegion(*roi);
+        size.width = roi->width;
+        size.height = roi->height;
+    }
+
     int type = decoder->type();
     if( flags != -1 )
     {
@@ -369,7 +385,16 @@ imdecode_( const Mat& buf, int flags, int hdrtype, Mat* mat=0 )
         temp = cvarrToMat(image);
     }
 
-    bool code = decoder->readData( *data );
+    bool code;
+    if( !cropAfterwards )
+        code = decoder->readData( *data );
+    else
+    {
+        Mat full( decoder->height(), decoder->width(), data->type() );
+        code = decoder->readData( full );
+        if( code )
+            full( *roi ).copyTo( *data );
+    }
     if( !filename.empty() )
         remove(filename.c_str());
 
@@ -402,6 +427,15 @@ Mat imdecode( InputArray _buf, int flags, Mat* dst )
     return *dst;
 }
 
+Mat imdecode( InputArray _buf, int flags, const Rect& roi, Mat* dst )
+{
+    Mat buf = _buf.getMat(), img;
+    dst = dst ? dst : &img;
+    if( !imdecode_( buf, flags, LOAD_MAT, dst, &roi ) )
+        dst->release();
+    return *dst;
+}
+
 bool imencode( const string& ext, InputArray _image,
                vector<uchar>& buf, const vector<int>& params )
 {
@@ -93,6 +93,18 @@ public:
   static void storage(GLsizeiptr size, GLbitfield flags) {
     glBufferStorage(BufferType, size, nullptr, flags);
   }
+
+  static bool hasStorage() {
+    return nullptr != glBufferStorage;
+  }
+
+  static void * map(GLsizeiptr size, GLbitfield access, GLintptr offset = 0) {
+    return glMapBufferRange(BufferType, offset, size, access);
+  }
+
+  static bool unmap() {
+    return GL_TRUE == glUnmapBuffer(BufferType);
+  }
 };
 
 typedef Buffer<GL_ELEMENT_ARRAY_BUFFER> IndexBuffer;
@@ -101,6 +113,9 @@ typedef std::shared_ptr<IndexBuffer> IndexBufferPtr;
 typedef Buffer<GL_ARRAY_BUFFER> VertexBuffer;
 typedef std::shared_ptr<VertexBuffer> VertexBufferPtr;
 
+typedef Buffer<GL_PIXEL_UNPACK_BUFFER> PixelUnpackBuffer;
+typedef std::shared_ptr<PixelUnpackBuffer> PixelUnpackBufferPtr;
+
 class BufferLoader {
 public:
   virtual ~BufferLoader() {
@@ -78,4 +78,49 @@ typedef SampleQuery::Ptr SampleQueryPtr;
 typedef Query<GL_PRIMITIVES_GENERATED> PrimitiveQuery;
 typedef PrimitiveQuery::Ptr PrimitiveQueryPtr;
 
+/**
+ * A sync object that is signaled once the GPU has executed all the
+ * commands issued before set() was called.
+ */
+class Fence {
+  GLsync sync;
+
+  Fence(const Fence &);
+  Fence & operator=(const Fence &);
+
+public:
+  Fence() : sync(0) {
+  }
+
+  virtual ~Fence() {
+    clear();
+  }
+
+  void set() {
+    clear();
+    sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+
+  bool isSet() const {
+    return 0 != sync;
+  }
+
+  // Returns true once the fence has passed.  A fence that isn't set
+  // counts as signaled.
+  bool signaled(GLuint64 timeoutNanos = 0) {
+    if (!sync) {
+      return true;
+    }
+    GLenum result = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, timeoutNanos);
+    return GL_ALREADY_SIGNALED == result || GL_CONDITION_SATISFIED == result;
+  }
+
+  void clear() {
+    if (sync) {
+      glDeleteSync(sync);
+      sync = 0;
+    }
+  }
+};
+
 }
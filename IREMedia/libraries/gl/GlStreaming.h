@@ -0,0 +1,175 @@
+#pragma once
+
+#ifndef GL_ZERO
+#error "You must include the gl headers before including this file"
+#endif
+
+#include <atomic>
+#include <memory>
+#include "GlBuffers.h"
+#include "GlQuery.h"
+
+namespace gl {
+
+/**
+ * A ring of pixel unpack buffers for streaming images to textures.
+ *
+ * Every slot is a buffer object that stays mapped while it's free, so
+ * a producer on any thread can acquire() a slot and write pixels straight
+ * into memory the GPU can read.  The GL thread then bind()s the slot,
+ * issues the texture copy with buffer offsets instead of client pointers
+ * and retire()s it, which fences the slot.  recycle() hands slots whose
+ * fence has passed back to the producer.
+ *
+ * Where glBufferStorage is available the buffers are persistently and
+ * coherently mapped once.  Otherwise every reuse orphans the buffer and
+ * maps it again, and bind() unmaps it before the copy.
+ *
+ * acquire(), data() and release() may be called from any thread, all
+ * other methods need the GL context.
+ */
+class StreamingUploader {
+  enum State {
+    // mapped and available to the producer
+    FREE,
+    // owned by the producer, or waiting to be uploaded
+    ACQUIRED,
+    // the GPU may still be reading from the buffer
+    IN_FLIGHT,
+  };
+
+  struct Slot {
+    PixelUnpackBufferPtr buffer;
+    void * data;
+    Fence fence;
+    std::atomic<int> state;
+    Slot() : data(nullptr), state(IN_FLIGHT) {
+    }
+  };
+
+  const size_t slotSize;
+  const size_t slotCount;
+  const bool persistent;
+  std::unique_ptr<Slot[]> slots;
+
+  void map(Slot & slot) {
+    slot.buffer->bind();
+    if (persistent) {
+      slot.data = PixelUnpackBuffer::map(slotSize,
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+    } else {
+      // orphan the old storage, the driver keeps it alive until any
+      // pending copy out of it is done
+      slot.buffer->load(slotSize, nullptr, GL_STREAM_DRAW);
+      slot.data = PixelUnpackBuffer::map(slotSize,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+    PixelUnpackBuffer::unbind();
+  }
+
+public:
+  StreamingUploader(size_t slotSize, size_t slotCount = 4)
+    : slotSize(slotSize), slotCount(slotCount),
+      persistent(PixelUnpackBuffer::hasStorage()),
+      slots(new Slot[slotCount]) {
+    for (size_t i = 0; i < slotCount; ++i) {
+      Slot & slot = slots[i];
+      slot.buffer = PixelUnpackBufferPtr(new PixelUnpackBuffer());
+      if (persistent) {
+        slot.buffer->bind();
+        PixelUnpackBuffer::storage(slotSize,
+          GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+        PixelUnpackBuffer::unbind();
+      }
+      map(slot);
+      slot.state = FREE;
+    }
+    GL_CHECK_ERROR;
+  }
+
+  virtual ~StreamingUploader() {
+    for (size_t i = 0; i < slotCount; ++i) {
+      Slot & slot = slots[i];
+      if (slot.data) {
+        slot.buffer->bind();
+        PixelUnpackBuffer::unmap();
+      }
+    }
+    PixelUnpackBuffer::unbind();
+  }
+
+  bool isPersistent() const {
+    return persistent;
+  }
+
+  size_t getSlotSize() const {
+    return slotSize;
+  }
+
+  // Claims a free slot for writing.  Returns -1 if every slot is either
+  // being written, waiting for upload or still read by the GPU.
+  int acquire() {
+    for (size_t i = 0; i < slotCount; ++i) {
+      int expected = FREE;
+      if (slots[i].state.compare_exchange_strong(expected, ACQUIRED)) {
+        return (int)i;
+      }
+    }
+    return -1;
+  }
+
+  void * data(int slot) {
+    return slots[slot].data;
+  }
+
+  // Gives back a slot that was acquired but won't be uploaded
+  void release(int slot) {
+    slots[slot].state = FREE;
+  }
+
+  // Binds the slot as the GL_PIXEL_UNPACK_BUFFER, so that pixel transfer
+  // calls take offsets into the slot instead of pointers
+  void bind(int slot) {
+    Slot & s = slots[slot];
+    s.buffer->bind();
+    if (!persistent && s.data) {
+      PixelUnpackBuffer::unmap();
+      s.data = nullptr;
+    }
+  }
+
+  static void unbind() {
+    PixelUnpackBuffer::unbind();
+  }
+
+  // Marks the slot as in use by the commands issued so far
+  void retire(int slot) {
+    Slot & s = slots[slot];
+    s.fence.set();
+    s.state = IN_FLIGHT;
+  }
+
+  // Returns every slot the GPU is done with to the producer.  Call once
+  // per frame on the GL thread.
+  void recycle() {
+    for (size_t i = 0; i < slotCount; ++i) {
+      Slot & slot = slots[i];
+      if (IN_FLIGHT != slot.state || !slot.fence.signaled()) {
+        continue;
+      }
+      slot.fence.clear();
+      if (!slot.data) {
+        map(slot);
+      }
+      slot.state = FREE;
+    }
+  }
+
+  static const GLvoid * offset(size_t bytes) {
+    return (const GLvoid *)bytes;
+  }
+};
+
+typedef std::shared_ptr<StreamingUploader> StreamingUploaderPtr;
+
+} // gl
@@ -95,6 +95,11 @@ public:
     GL_CHECK_ERROR;
   }
 
+  // Whether immutable storage (GL 4.2 or ARB_texture_storage) is there
+  static bool hasStorage() {
+    return nullptr != glTexStorage2D;
+  }
+
   void storage2d(const glm::uvec2 & size, GLint levels = 1) {
     glTexStorage2D(TextureType, levels, TextureFormat, size.x, size.y);
   }
@@ -116,11 +121,15 @@ public:
 
 typedef Texture<GL_TEXTURE_2D> Texture2d;
 typedef Texture<GL_TEXTURE_2D, GL_DEPTH_COMPONENT16> Texture2dDepth;
+typedef Texture<GL_TEXTURE_2D, GL_R8> Texture2dRed;
+typedef Texture<GL_TEXTURE_2D, GL_RG32F> Texture2dRg32f;
 typedef Texture<GL_TEXTURE_2D_MULTISAMPLE> Texture2dMs;
 typedef Texture<GL_TEXTURE_3D> Texture3d;
 typedef Texture<GL_TEXTURE_CUBE_MAP> TextureCubeMap;
 typedef Texture2d::Ptr Texture2dPtr;
 typedef Texture2dDepth::Ptr Texture2dDepthPtr;
+typedef Texture2dRed::Ptr Texture2dRedPtr;
+typedef Texture2dRg32f::Ptr Texture2dRg32fPtr;
 typedef TextureCubeMap::Ptr TextureCubeMapPtr;
 typedef Texture2dMs::Ptr Texture2dMsPtr;
 typedef Texture2d::Ptr TexturePtr;
@@ -0,0 +1,22 @@
+#version 330
+
+uniform sampler2D sampler;
+// Where to sample the image for each output texel, e.g. to undistort it
+uniform sampler2D RemapSampler;
+uniform float Alpha = 1.0;
+
+in vec2 vTexCoord;
+out vec4 vFragColor;
+
+const vec2 ZERO = vec2(0);
+const vec2 ONE = vec2(1);
+
+void main() {
+    vec2 source = texture(RemapSampler, vTexCoord).rg;
+    if (!all(equal(source, clamp(source, ZERO, ONE)))) {
+        discard;
+    }
+    vec4 c = texture(sampler, source);
+    c.a = min(Alpha, c.a);
+    vFragColor = c;
+}
@@ -0,0 +1,40 @@
+#version 330
+
+// Y, Cb and Cr planes of a JPEG image, the chroma planes may be subsampled
+uniform sampler2D LumaSampler;
+uniform sampler2D CbSampler;
+uniform sampler2D CrSampler;
+// Maps texture coordinates of the luma plane to the chroma planes
+uniform vec2 ChromaScale = vec2(1);
+uniform vec2 ChromaOffset = vec2(0);
+// Where to sample the planes for each output texel, e.g. to undistort
+// the image
+uniform sampler2D RemapSampler;
+uniform bool Remap = false;
+uniform float Alpha = 1.0;
+
+in vec2 vTexCoord;
+out vec4 vFragColor;
+
+const vec2 ZERO = vec2(0);
+const vec2 ONE = vec2(1);
+
+void main() {
+    vec2 texCoord = vTexCoord;
+    if (Remap) {
+        texCoord = texture(RemapSampler, vTexCoord).rg;
+        if (!all(equal(texCoord, clamp(texCoord, ZERO, ONE)))) {
+            discard;
+        }
+    }
+    vec2 chromaCoord = texCoord * ChromaScale + ChromaOffset;
+    float y = texture(LumaSampler, texCoord).r;
+    float cb = texture(CbSampler, chromaCoord).r - 128.0 / 255.0;
+    float cr = texture(CrSampler, chromaCoord).r - 128.0 / 255.0;
+    // Full range BT.601, as used by JFIF
+    vec3 c = vec3(
+        y + 1.402 * cr,
+        y - 0.344136 * cb - 0.714136 * cr,
+        y + 1.772 * cb);
+    vFragColor = vec4(clamp(c, 0.0, 1.0), Alpha);
+}